@@ -0,0 +1,86 @@
+// Lookups per second on one thread, synchronous find against find_async
+// with a growing number of coroutines in flight. Every page read that
+// misses the cache is slowed down by --latency-us (DelayedStorage), and the
+// tree is several times larger than the cache, so most lookups wait on at
+// least one read.
+//
+// usage: bpt_async_bench [--keys N] [--lookups N] [--latency-us US]
+//                        [--io-threads N]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "BPT.hpp"
+#include "timing.hpp"
+
+namespace {
+
+using Tree = BPT<long long, int, DelayedStorage<FileStorage<long long, int>>>;
+
+// one lane of the async run: its share of the lookups, one after another
+sjtu::Task<void> lane(Tree &tree, sjtu::Scheduler &scheduler,
+                      const std::vector<long long> &keys, size_t first,
+                      size_t step, long long &found) {
+  for (size_t i = first; i < keys.size(); i += step) {
+    sjtu::vector<int> values = co_await tree.find_async(scheduler, keys[i]);
+    found += values.size();
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  long long keys = 200000;
+  size_t lookups = 20000;
+  int latency_us = 100;
+  int io_threads = 64;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--keys") == 0) {
+      keys = std::atoll(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--lookups") == 0) {
+      lookups = std::atoll(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--latency-us") == 0) {
+      latency_us = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--io-threads") == 0) {
+      io_threads = std::atoi(argv[i + 1]);
+    }
+  }
+
+  std::remove("bench_async.index");
+  std::remove("bench_async.block");
+  Tree tree("bench_async");
+  for (long long key = 0; key < keys; ++key) {
+    tree.insert(key * 7919 % keys, 0);
+  }
+  std::mt19937_64 rng(7);
+  std::vector<long long> probe(lookups);
+  for (long long &key : probe) key = rng() % keys;
+  DelayedFile<MemoryRiver<Index<long long, int>, 2>>::delay_us = latency_us;
+  DelayedFile<MemoryRiver<Block<long long, int>, 2>>::delay_us = latency_us;
+
+  std::printf("%-10s %10s %12s %8s\n", "mode", "in-flight", "lookups/s",
+              "speedup");
+  long long found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (long long key : probe) found += tree.find(key).size();
+  double base = lookups / seconds_since(start);
+  std::printf("%-10s %10d %12.0f %8.2f\n", "sync", 1, base, 1.0);
+
+  sjtu::Scheduler scheduler(io_threads);
+  for (size_t in_flight = 1; in_flight <= 256; in_flight *= 4) {
+    long long async_found = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < in_flight; ++i) {
+      scheduler.spawn(lane(tree, scheduler, probe, i, in_flight, async_found));
+    }
+    scheduler.run();
+    double throughput = lookups / seconds_since(start);
+    std::printf("%-10s %10zu %12.0f %8.2f%s\n", "async", in_flight,
+                throughput, throughput / base,
+                async_found == found ? "" : "  WRONG");
+  }
+  return 0;
+}
@@ -0,0 +1,431 @@
+// Microbenchmarks of the hot paths, one result per line so runs on
+// different commits can be diffed with script/bench_compare.py:
+//   search   the binarySearch variants on a full leaf and a full index page
+//   lru      LRUCache get/put with the working set inside and 2x outside
+//            the capacity
+//   hashmap  HashMap put/get
+//   river    MemoryRiver read/update of random pages
+//   bpt      BPT insert, find and remove at 10^4 keys and every power of
+//            ten up to --max-keys, with uniform, zipfian and sequential keys;
+//            --max-keys is refused past MAX_KEYS, where .block would outgrow
+//            its int page addresses
+//   rebalance  the same delete/reinsert churn on an eager and a relaxed
+//            balance tree (see BPT::set_relaxed_balance); both lines carry
+//            the splits and merges it took, the relaxed one also how many
+//            of the eager run's it avoided
+//   buffer   random inserts into a tree 10x the leaves the cache holds,
+//            straight into the tree and through write buffers of a few
+//            capacities (see BPT::set_write_buffer)
+// Every line carries the suite, case, parameters, operation count, seconds,
+// ns/op and ops/s, plus --label (e.g. the commit) if given, and counters
+// where a case has them (JSON fields, or name=value;... in the CSV column).
+//
+// usage: bpt_bench [--max-keys N] [--filter SUITE] [--format json|csv]
+//                  [--label TEXT] [--out FILE]
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "BPT.hpp"
+#include "HashMap.hpp"
+#include "MemoryRiver.hpp"
+#include "bulk.hpp"
+#include "cache.hpp"
+#include "distribution.hpp"
+#include "timing.hpp"
+
+namespace {
+
+using Pair = Key_Value<long long, int>;
+
+// Page addresses are ints, so .block stops at INT_MAX bytes. Random inserts
+// leave leaves about 69% full (23.8 MB of .block per 10^6 uniform keys);
+// counting them two thirds full leaves some margin: about 8.5 * 10^7 keys.
+constexpr long long MAX_KEYS =
+    INT_MAX / sizeof(Block<long long, int>) * (DEFAULT_LEAF_SIZE * 2 / 3);
+
+// keeps results alive so the measured loops are not optimized away
+volatile long long sink;
+
+// a named count reported next to a timing
+using Counter = std::pair<const char *, long long>;
+
+class Reporter {
+ public:
+  Reporter(std::FILE *out, bool csv, const std::string &label)
+      : out_(out), csv_(csv), label_(label) {
+    if (csv_) {
+      std::fprintf(out_,
+                   "label,suite,case,dist,n,ops,seconds,ns_per_op,ops_per_sec,"
+                   "counters\n");
+    }
+  }
+
+  void report(const char *suite, const std::string &name, const char *dist,
+              long long n, long long ops, double seconds,
+              const std::vector<Counter> &counters = {}) {
+    double ns = seconds * 1e9 / ops;
+    double rate = ops / seconds;
+    std::string extra;
+    for (size_t i = 0; i < counters.size(); ++i) {
+      std::string value = std::to_string(counters[i].second);
+      extra += csv_ ? std::string(i == 0 ? "" : ";") + counters[i].first +
+                          "=" + value
+                    : std::string(",\"") + counters[i].first + "\":" + value;
+    }
+    if (csv_) {
+      std::fprintf(out_, "%s,%s,%s,%s,%lld,%lld,%.6f,%.2f,%.0f,%s\n",
+                   label_.c_str(), suite, name.c_str(), dist, n, ops, seconds,
+                   ns, rate, extra.c_str());
+    } else {
+      std::fprintf(out_,
+                   "{\"label\":\"%s\",\"suite\":\"%s\",\"case\":\"%s\","
+                   "\"dist\":\"%s\",\"n\":%lld,\"ops\":%lld,"
+                   "\"seconds\":%.6f,\"ns_per_op\":%.2f,"
+                   "\"ops_per_sec\":%.0f%s}\n",
+                   label_.c_str(), suite, name.c_str(), dist, n, ops, seconds,
+                   ns, rate, extra.c_str());
+    }
+    std::fflush(out_);
+  }
+
+ private:
+  std::FILE *out_;
+  bool csv_;
+  std::string label_;
+};
+
+template <class F>
+void measure(Reporter &reporter, const char *suite, const std::string &name,
+             const char *dist, long long n, long long ops, F body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  reporter.report(suite, name, dist, n, ops, seconds_since(start));
+}
+
+void bench_search(Reporter &reporter) {
+  constexpr int LEAF = DEFAULT_LEAF_SIZE;
+  constexpr int ORDER = Index<long long, int>::ORDER - 1;
+  constexpr long long PROBES = 1 << 22;
+  std::mt19937_64 rng(46);
+  Pair leaf[LEAF];
+  Index<long long, int> index;
+  long long key_space = 1 << 20;
+  for (int i = 0; i < LEAF; ++i) leaf[i] = {i * key_space / LEAF, i};
+  for (int i = 0; i < ORDER; ++i) {
+    index.keys[i] = Pair{i * key_space / ORDER, i};
+  }
+  std::vector<Pair> probes(PROBES);
+  for (Pair &p : probes) p = {static_cast<long long>(rng() % key_space), 0};
+
+  measure(reporter, "search", "leaf_key", "uniform", LEAF, PROBES, [&] {
+    long long s = 0;
+    for (const Pair &p : probes) s += binarySearch(leaf, p.key, 0, LEAF - 1);
+    sink = s;
+  });
+  measure(reporter, "search", "leaf_pair", "uniform", LEAF, PROBES, [&] {
+    long long s = 0;
+    for (const Pair &p : probes) s += binarySearch(leaf, p, 0, LEAF - 1);
+    sink = s;
+  });
+  measure(reporter, "search", "leaf_bigger", "uniform", LEAF, PROBES, [&] {
+    long long s = 0;
+    for (const Pair &p : probes) {
+      s += binarySearchForBigger(leaf, p.key, 0, LEAF - 1);
+    }
+    sink = s;
+  });
+  measure(reporter, "search", "index_key", "uniform", ORDER, PROBES, [&] {
+    long long s = 0;
+    for (const Pair &p : probes) {
+      s += binarySearch(index.keys, p.key, 0, ORDER - 1);
+    }
+    sink = s;
+  });
+  measure(reporter, "search", "index_big_or_equal", "uniform", ORDER, PROBES,
+          [&] {
+            long long s = 0;
+            for (const Pair &p : probes) {
+              s += binarySearchForBigOrEqual(index.keys, p, 0, ORDER - 1);
+            }
+            sink = s;
+          });
+}
+
+void bench_lru(Reporter &reporter) {
+  constexpr long long OPS = 1 << 20;
+  for (size_t capacity : {64, 1024, 16384}) {
+    // the working set fits, then is twice the capacity
+    for (size_t span : {capacity, capacity * 2}) {
+      sjtu::LRUCache<int, Block<long long, int>> cache(capacity);
+      Block<long long, int> block;
+      std::mt19937_64 rng(capacity + span);
+      std::vector<int> keys(OPS);
+      for (int &key : keys) key = rng() % span;
+      std::string name =
+          span == capacity ? "get_put_fit" : "get_put_2x";
+      measure(reporter, "lru", name, "uniform", capacity, OPS, [&] {
+        long long hits = 0;
+        for (int key : keys) {
+          if (cache.contains(key)) {
+            hits += cache.get(key).size;
+          } else {
+            cache.put(key, block, false);
+          }
+        }
+        sink = hits;
+      });
+    }
+  }
+}
+
+void bench_hashmap(Reporter &reporter) {
+  constexpr long long OPS = 1 << 20;
+  for (long long n : {1000LL, 100000LL}) {
+    // small maps are filled and probed several times to reach OPS
+    long long rounds = OPS / n;
+    std::mt19937_64 rng(n);
+    std::vector<int> keys(n);
+    for (int &key : keys) key = rng() % (n * 4);
+    sjtu::HashMap<int, int> map;
+    measure(reporter, "hashmap", "put", "uniform", n, n * rounds, [&] {
+      for (long long r = 0; r < rounds; ++r) {
+        for (long long i = 0; i < n; ++i) map.put(keys[i], i);
+      }
+    });
+    measure(reporter, "hashmap", "get", "uniform", n, n * rounds, [&] {
+      long long s = 0;
+      for (long long r = 0; r < rounds; ++r) {
+        for (int key : keys) s += map.get(key);
+      }
+      sink = s;
+    });
+  }
+}
+
+void bench_river(Reporter &reporter) {
+  constexpr int PAGES = 4096;
+  constexpr long long OPS = 20000;
+  using Page = Block<long long, int>;
+  std::remove("bench_suite.river");
+  MemoryRiver<Page, 2> river("bench_suite.river");
+  river.initialise();
+  Page page;
+  std::vector<int> addrs;
+  for (int i = 0; i < PAGES; ++i) addrs.push_back(river.write(page));
+  std::mt19937_64 rng(PAGES);
+  std::vector<int> order(OPS);
+  for (int &addr : order) addr = addrs[rng() % PAGES];
+  measure(reporter, "river", "read", "uniform", PAGES, OPS, [&] {
+    long long s = 0;
+    for (int addr : order) {
+      river.read(page, addr);
+      s += page.size;
+    }
+    sink = s;
+  });
+  measure(reporter, "river", "update", "uniform", PAGES, OPS, [&] {
+    for (int addr : order) river.update(page, addr);
+  });
+  std::remove("bench_suite.river");
+}
+
+void bench_bpt(Reporter &reporter, long long max_keys) {
+  for (long long n = 10000; n <= max_keys; n *= 10) {
+    for (KeyDistribution::Kind kind :
+         {KeyDistribution::UNIFORM, KeyDistribution::ZIPFIAN,
+          KeyDistribution::SEQUENTIAL}) {
+      const char *dist = KeyDistribution::name(kind);
+      // keys come from a space 4x the key count, so uniform inserts make a
+      // few duplicates and zipfian ones many
+      KeyDistribution keys(kind, n * 4, n);
+      std::vector<long long> inserted(n);
+      for (long long &key : inserted) key = keys.next();
+      long long probes = n < 1000000 ? n : 1000000;
+      std::vector<long long> lookups(probes);
+      for (long long &key : lookups) key = keys.next();
+
+      std::remove("bench_suite.index");
+      std::remove("bench_suite.block");
+      {
+        BPT<long long, int> tree("bench_suite");
+        measure(reporter, "bpt", "insert", dist, n, n, [&] {
+          for (long long i = 0; i < n; ++i) tree.insert(inserted[i], i);
+        });
+        measure(reporter, "bpt", "find", dist, n, probes, [&] {
+          long long s = 0;
+          for (long long key : lookups) s += tree.find(key).size();
+          sink = s;
+        });
+        // every removed pair exists: the i-th insert, spread over the run
+        long long step = n / probes;
+        measure(reporter, "bpt", "remove", dist, n, probes, [&] {
+          for (long long i = 0; i < probes; ++i) {
+            tree.remove(inserted[i * step], i * step);
+          }
+        });
+      }
+      std::remove("bench_suite.index");
+      std::remove("bench_suite.block");
+      std::remove("bench_suite.hot");
+    }
+  }
+}
+
+// Churn that drains whole leaves and refills them: each round removes a
+// window of consecutive pairs in key order, then inserts them again. An
+// eager tree merges the drained leaves and splits them again on the way
+// back; a relaxed one leaves them underfull until they are refilled.
+void bench_rebalance(Reporter &reporter, long long max_keys) {
+  constexpr int ROUNDS = 20;
+  using Tree = BPT<long long, int>;
+  for (long long n = 10000; n <= max_keys && n <= 1000000; n *= 10) {
+    KeyDistribution keys(KeyDistribution::UNIFORM, n * 4, n);
+    std::vector<Pair> pairs(n);
+    for (long long i = 0; i < n; ++i) {
+      pairs[i] = {static_cast<long long>(keys.next()), static_cast<int>(i)};
+    }
+    std::vector<Pair> sorted = pairs;
+    std::sort(sorted.begin(), sorted.end());
+    long long window = n / 20;
+    std::mt19937_64 rng(n);
+    std::vector<long long> starts(ROUNDS);
+    for (long long &start : starts) start = rng() % (n - window);
+
+    Tree::RebalanceStats eager{};
+    for (bool relaxed : {false, true}) {
+      std::remove("bench_suite.index");
+      std::remove("bench_suite.block");
+      Tree::RebalanceStats before, after;
+      {
+        Tree tree("bench_suite");
+        for (const Pair &p : pairs) tree.insert(p.key, p.value);
+        tree.set_relaxed_balance(relaxed);
+        before = tree.rebalance_stats();
+        auto start = std::chrono::steady_clock::now();
+        for (long long first : starts) {
+          for (long long i = first; i < first + window; ++i) {
+            tree.remove(sorted[i].key, sorted[i].value);
+          }
+          for (long long i = first; i < first + window; ++i) {
+            tree.insert(sorted[i].key, sorted[i].value);
+          }
+        }
+        tree.consolidate();
+        double seconds = seconds_since(start);
+        after = tree.rebalance_stats();
+        long long splits = after.splits - before.splits;
+        long long merges = after.merges - before.merges;
+        std::vector<Counter> counters = {
+            {"splits", splits},
+            {"merges", merges},
+            {"borrows", after.borrows - before.borrows}};
+        if (relaxed) {
+          counters.push_back({"splits_avoided", eager.splits - splits});
+          counters.push_back({"merges_avoided", eager.merges - merges});
+        } else {
+          eager.splits = splits;
+          eager.merges = merges;
+        }
+        reporter.report("rebalance", relaxed ? "churn_relaxed" : "churn_eager",
+                        "uniform", n, 2 * ROUNDS * window, seconds, counters);
+      }
+      std::remove("bench_suite.index");
+      std::remove("bench_suite.block");
+      std::remove("bench_suite.hot");
+    }
+  }
+}
+
+// Random inserts that mostly miss the cache: the tree is bulk loaded with
+// 10x the leaves BPTCacheManager keeps by default (2048), at the fill
+// inserts leave behind. A buffer applies its inserts in key order, so
+// inserts that land in the same leaf share one read and one write back.
+void bench_buffer(Reporter &reporter) {
+  constexpr long long CACHED_LEAVES = 2048;
+  constexpr double FILL = 0.7;
+  constexpr long long OPS = 200000;
+  const long long n =
+      10 * CACHED_LEAVES * static_cast<long long>(DEFAULT_LEAF_SIZE * FILL);
+  // stored keys are multiples of 8, inserted ones land anywhere among them
+  std::mt19937_64 rng(34);
+  std::vector<Pair> inserts(OPS);
+  for (long long i = 0; i < OPS; ++i) {
+    inserts[i] = {static_cast<long long>(rng() % (n * 8)), static_cast<int>(i)};
+  }
+  for (size_t capacity : {0, 1024, 16384, 131072}) {
+    {
+      BulkLoader<long long, int> loader("bench_suite", false, FILL);
+      for (long long i = 0; i < n; ++i) loader.add(i * 8, 0);
+    }
+    {
+      BPT<long long, int> tree("bench_suite");
+      tree.set_write_buffer(capacity);
+      std::string name =
+          capacity == 0 ? "insert" : "insert_buffered_" + std::to_string(capacity);
+      measure(reporter, "buffer", name, "uniform", n, OPS, [&] {
+        for (const Pair &p : inserts) tree.insert(p.key, p.value);
+        tree.flush_write_buffer();
+      });
+    }
+    std::remove("bench_suite.index");
+    std::remove("bench_suite.block");
+    std::remove("bench_suite.hot");
+  }
+}
+
+bool wanted(const char *filter, const char *suite) {
+  return filter == nullptr || std::strcmp(filter, suite) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  long long max_keys = 1000000;
+  const char *filter = nullptr;
+  bool csv = false;
+  std::string label;
+  const char *out_name = nullptr;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--max-keys") == 0) {
+      max_keys = std::atoll(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--filter") == 0) {
+      filter = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--format") == 0) {
+      csv = std::strcmp(argv[i + 1], "csv") == 0;
+    } else if (std::strcmp(argv[i], "--label") == 0) {
+      label = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--out") == 0) {
+      out_name = argv[i + 1];
+    }
+  }
+  if (max_keys > MAX_KEYS) {
+    std::fprintf(stderr,
+                 "--max-keys %lld does not fit in int page addresses, the "
+                 "limit is %lld\n",
+                 max_keys, MAX_KEYS);
+    return 1;
+  }
+  std::FILE *out = out_name ? std::fopen(out_name, "w") : stdout;
+  if (out == nullptr) {
+    std::fprintf(stderr, "cannot open %s\n", out_name);
+    return 1;
+  }
+  Reporter reporter(out, csv, label);
+  if (wanted(filter, "search")) bench_search(reporter);
+  if (wanted(filter, "lru")) bench_lru(reporter);
+  if (wanted(filter, "hashmap")) bench_hashmap(reporter);
+  if (wanted(filter, "river")) bench_river(reporter);
+  if (wanted(filter, "bpt")) bench_bpt(reporter, max_keys);
+  if (wanted(filter, "rebalance")) bench_rebalance(reporter, max_keys);
+  if (wanted(filter, "buffer")) bench_buffer(reporter);
+  if (out != stdout) std::fclose(out);
+  return 0;
+}
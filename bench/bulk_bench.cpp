@@ -0,0 +1,113 @@
+// Time to build a tree from unsorted pairs: one-by-one insert, the streaming
+// BulkLoader after a serial sort, and parallel_bulk_build as the number of
+// threads grows. Every build is opened with BPT and spot-checked.
+//
+// usage: bpt_bulk_bench [--pairs N] [--threads MAX] [--insert-pairs N]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "BPT.hpp"
+#include "bulk.hpp"
+#include "timing.hpp"
+
+namespace {
+
+using Pair = Key_Value<long long, int>;
+
+void remove_files() {
+  std::remove("bench_bulk.index");
+  std::remove("bench_bulk.block");
+  std::remove("bench_bulk.hot");
+}
+
+// a few keys of the input must be found with their value
+bool check(const std::vector<Pair> &pairs) {
+  BPT<long long, int> tree("bench_bulk");
+  for (size_t i = 0; i < pairs.size(); i += pairs.size() / 64 + 1) {
+    sjtu::vector<int> values = tree.find(pairs[i].key);
+    bool found = false;
+    for (size_t j = 0; j < values.size(); ++j) {
+      if (values[j] == pairs[i].value) found = true;
+    }
+    if (!found) return false;
+  }
+  return true;
+}
+
+void report(const char *method, int threads, size_t pairs, double seconds,
+            double base, bool ok) {
+  std::printf("%-16s %8d %10.3f %12.0f %8.2f %s\n", method, threads, seconds,
+              pairs / seconds, base / seconds, ok ? "ok" : "WRONG");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t pairs = 5000000;
+  size_t insert_pairs = 200000;
+  int max_threads = std::thread::hardware_concurrency();
+  if (max_threads <= 0) max_threads = 1;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--pairs") == 0) {
+      pairs = std::atoll(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--threads") == 0) {
+      max_threads = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--insert-pairs") == 0) {
+      insert_pairs = std::atoll(argv[i + 1]);
+    }
+  }
+
+  std::mt19937_64 rng(2024);
+  std::vector<Pair> input(pairs);
+  for (Pair &pair : input) {
+    pair.key = rng() % (pairs * 4);
+    pair.value = rng() % 1000;
+  }
+
+  std::printf("%-16s %8s %10s %12s %8s\n", "method", "threads", "seconds",
+              "pairs/s", "speedup");
+
+  // insert is far slower, so it only gets a prefix
+  size_t n = std::min(insert_pairs, pairs);
+  remove_files();
+  auto start = std::chrono::steady_clock::now();
+  {
+    BPT<long long, int> tree("bench_bulk");
+    for (size_t i = 0; i < n; ++i) tree.insert(input[i].key, input[i].value);
+  }
+  double seconds = seconds_since(start);
+  report("insert", 1, n, seconds, seconds,
+         check(std::vector<Pair>(input.begin(), input.begin() + n)));
+  // speedups are against inserting all the pairs at the same rate
+  double base = seconds * pairs / n;
+
+  remove_files();
+  start = std::chrono::steady_clock::now();
+  {
+    std::vector<Pair> sorted = input;
+    std::sort(sorted.begin(), sorted.end());
+    BulkLoader<long long, int> loader("bench_bulk");
+    for (const Pair &pair : sorted) loader.add(pair.key, pair.value);
+  }
+  report("sort+BulkLoader", 1, pairs, seconds_since(start), base,
+         check(input));
+
+  for (int threads = 1;; threads *= 2) {
+    if (threads > max_threads) threads = max_threads;
+    std::vector<Pair> work = input;
+    remove_files();
+    start = std::chrono::steady_clock::now();
+    parallel_bulk_build("bench_bulk", work.data(), work.size(), threads);
+    report("parallel", threads, pairs, seconds_since(start), base,
+           check(input));
+    if (threads == max_threads) break;
+  }
+  remove_files();
+  return 0;
+}
@@ -0,0 +1,105 @@
+// Throughput of concurrent find/insert/remove against one BPT as the number
+// of threads grows. Each workload runs for a fixed time per thread count and
+// reports operations per second and the speedup over one thread.
+//
+// usage: bpt_concurrent_bench [--keys N] [--seconds S] [--threads MAX]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BPT.hpp"
+
+namespace {
+
+struct Workload {
+  const char *name;
+  int read_percent;
+};
+
+// Writers insert fresh keys and delete the ones they inserted earlier, so the
+// tree keeps roughly its initial size no matter how long the run is.
+double run(BPT<long long, int> &tree, long long keys, const Workload &workload,
+           int threads, double seconds) {
+  std::atomic<bool> stop(false);
+  std::atomic<long long> total(0);
+  std::vector<std::thread> workers;
+  for (int id = 0; id < threads; ++id) {
+    workers.emplace_back([&, id] {
+      std::mt19937_64 rng(id * 1000003 + threads);
+      long long next_key = keys + id;
+      long long oldest_key = next_key;
+      long long done = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 64; ++i) {
+          if (static_cast<int>(rng() % 100) < workload.read_percent) {
+            tree.find(static_cast<long long>(rng() % keys));
+          } else if (next_key - oldest_key < 64 * threads) {
+            tree.insert(next_key, id);
+            next_key += threads;
+          } else {
+            tree.remove(oldest_key, id);
+            oldest_key += threads;
+          }
+        }
+        done += 64;
+      }
+      // leave the tree as we found it for the next round
+      for (long long key = oldest_key; key < next_key; key += threads) {
+        tree.remove(key, id);
+      }
+      total += done;
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto &worker : workers) worker.join();
+  return total / seconds;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  long long keys = 50000;
+  double seconds = 1.0;
+  int max_threads = std::thread::hardware_concurrency();
+  if (max_threads <= 0) max_threads = 1;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--keys") == 0) {
+      keys = std::atoll(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--seconds") == 0) {
+      seconds = std::atof(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--threads") == 0) {
+      max_threads = std::atoi(argv[i + 1]);
+    }
+  }
+
+  std::remove("bench_concurrent.index");
+  std::remove("bench_concurrent.block");
+  BPT<long long, int> tree("bench_concurrent");
+  for (long long key = 0; key < keys; ++key) {
+    tree.insert(key, 0);
+  }
+
+  const Workload workloads[] = {{"read-mostly(95/5)", 95},
+                                {"balanced(50/50)", 50}};
+  std::printf("%-18s %8s %14s %8s\n", "workload", "threads", "ops/s",
+              "speedup");
+  for (const Workload &workload : workloads) {
+    double base = 0;
+    for (int threads = 1;; threads *= 2) {
+      if (threads > max_threads) threads = max_threads;
+      double throughput = run(tree, keys, workload, threads, seconds);
+      if (threads == 1) base = throughput;
+      std::printf("%-18s %8d %14.0f %8.2f\n", workload.name, threads,
+                  throughput, throughput / base);
+      if (threads == max_threads) break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,125 @@
+// Key hashing throughput: the legacy polynomial Hash against FastHash, and
+// FastHash through a KeyTable, on three key-length distributions: decimal
+// indices as the test generator writes them, strings of 1 to 64 bytes as
+// the command format allows, and 256-byte keys. Also counts how many
+// distinct keys each hash maps to the same value.
+//
+// usage: bpt_hash_bench [--keys N] [--rounds N]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "hash.hpp"
+#include "keys.hpp"
+#include "timing.hpp"
+
+namespace {
+
+std::vector<std::string> decimal_keys(size_t n, std::mt19937_64 &rng) {
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < n; ++i) keys.push_back(std::to_string(rng() % 1000000));
+  return keys;
+}
+
+std::vector<std::string> random_keys(size_t n, size_t min_len, size_t max_len,
+                                     std::mt19937_64 &rng) {
+  static const char alphabet[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < n; ++i) {
+    size_t len = min_len + rng() % (max_len - min_len + 1);
+    std::string key(len, ' ');
+    for (char &c : key) c = alphabet[rng() % (sizeof(alphabet) - 1)];
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+// distinct keys minus distinct hashes
+size_t collisions(const std::vector<std::string> &keys, HashKind kind) {
+  std::vector<std::string> distinct = keys;
+  std::sort(distinct.begin(), distinct.end());
+  distinct.erase(std::unique(distinct.begin(), distinct.end()),
+                 distinct.end());
+  std::vector<long long> hashes;
+  for (const std::string &key : distinct) {
+    hashes.push_back(HashKey(kind, key.data(), key.size()));
+  }
+  std::sort(hashes.begin(), hashes.end());
+  return distinct.size() -
+         (std::unique(hashes.begin(), hashes.end()) - hashes.begin());
+}
+
+template <class F>
+double time_keys(const std::vector<std::string> &keys, int rounds, F hash) {
+  long long sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (const std::string &key : keys) sink += hash(key);
+  }
+  double seconds = seconds_since(start);
+  // keep the loop from being optimized away
+  if (sink == 42) std::printf(" ");
+  return seconds;
+}
+
+void run(const char *name, const std::vector<std::string> &keys, int rounds) {
+  size_t bytes = 0;
+  for (const std::string &key : keys) bytes += key.size();
+  double mib = double(bytes) * rounds / (1 << 20);
+  double calls = double(keys.size()) * rounds;
+
+  double legacy = time_keys(keys, rounds, [](const std::string &key) {
+    return Hash(key.data(), key.size());
+  });
+  double fast = time_keys(keys, rounds, [](const std::string &key) {
+    return static_cast<long long>(FastHash(key.data(), key.size()));
+  });
+  std::remove("bench_hash.keys");
+  double table_seconds;
+  {
+    KeyTable table("bench_hash", HashKind::FAST, KeyTable::CHAIN);
+    table_seconds = time_keys(keys, rounds, [&](const std::string &key) {
+      long long hash;
+      table.resolve(key.data(), key.size(), true, hash);
+      return hash;
+    });
+  }
+  std::remove("bench_hash.keys");
+
+  std::printf("%-10s %-12s %12.0f %10.1f %8.2f %10zu\n", name, "Hash",
+              calls / legacy, mib / legacy, 1.0,
+              collisions(keys, HashKind::LEGACY));
+  std::printf("%-10s %-12s %12.0f %10.1f %8.2f %10zu\n", name, "FastHash",
+              calls / fast, mib / fast, legacy / fast,
+              collisions(keys, HashKind::FAST));
+  std::printf("%-10s %-12s %12.0f %10.1f %8.2f %10s\n", name, "+KeyTable",
+              calls / table_seconds, mib / table_seconds,
+              legacy / table_seconds, "-");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t keys = 1000000;
+  int rounds = 5;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--keys") == 0) {
+      keys = std::atoll(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--rounds") == 0) {
+      rounds = std::atoi(argv[i + 1]);
+    }
+  }
+  std::mt19937_64 rng(44);
+  std::printf("%-10s %-12s %12s %10s %8s %10s\n", "keys", "hash", "keys/s",
+              "MiB/s", "speedup", "collisions");
+  run("decimal", decimal_keys(keys, rng), rounds);
+  run("1-64", random_keys(keys, 1, 64, rng), rounds);
+  run("256", random_keys(keys / 4, 256, 256, rng), rounds);
+  return 0;
+}
@@ -0,0 +1,167 @@
+// Where the time of bpt_main goes: the same command text is parsed with
+// iostreams and the legacy Hash (the old driver) and with CommandReader and
+// FastHash, the parsed commands are run against the tree on their own, and
+// the find answers are formatted through an ostream and through
+// OutputBuffer into /dev/null.
+//
+// usage: bpt_parse_bench [--commands N] [--keys N]
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BPT.hpp"
+#include "command.hpp"
+#include "hash.hpp"
+#include "timing.hpp"
+
+namespace {
+
+// 50% insert, 30% find, 20% delete over a pool of string keys
+std::string generate(size_t commands, size_t keys) {
+  std::mt19937_64 rng(41);
+  std::string text = std::to_string(commands) + "\n";
+  for (size_t i = 0; i < commands; ++i) {
+    int roll = rng() % 10;
+    std::string key = "key" + std::to_string(rng() % keys);
+    if (roll < 5) {
+      text += "insert " + key + " " + std::to_string(rng() % 100000) + "\n";
+    } else if (roll < 8) {
+      text += "find " + key + "\n";
+    } else {
+      text += "delete " + key + " " + std::to_string(rng() % 100000) + "\n";
+    }
+  }
+  return text;
+}
+
+void report(const char *stage, size_t commands, double seconds, double total) {
+  std::printf("%-20s %10.3f %14.0f %8.1f%%\n", stage, seconds,
+              commands / seconds, 100 * seconds / total);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  size_t commands = 2000000;
+  size_t keys = 100000;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--commands") == 0) {
+      commands = std::atoll(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--keys") == 0) {
+      keys = std::atoll(argv[i + 1]);
+    }
+  }
+  std::string text = generate(commands, keys);
+
+  // iostream parse, as the old driver did it (minus the stdio sync)
+  auto start = std::chrono::steady_clock::now();
+  long long checksum_stream = 0;
+  long long hashed = 0;
+  {
+    std::istringstream in(text);
+    size_t n;
+    in >> n;
+    std::string order, key;
+    int value;
+    for (size_t i = 0; i < n; ++i) {
+      in >> order >> key;
+      hashed ^= Hash(key);
+      if (order != "find") {
+        in >> value;
+        checksum_stream += value;
+      }
+    }
+  }
+  double stream_parse = seconds_since(start);
+  // the keys hash differently, only the values are compared below
+  volatile long long keep = hashed;
+  (void)keep;
+
+  start = std::chrono::steady_clock::now();
+  std::vector<Command> parsed;
+  parsed.reserve(commands);
+  long long checksum_fast = 0;
+  {
+    sjtu::CommandReader in(text.data(), text.size());
+    long long n;
+    in.count(n);
+    Command command;
+    while (in.next(command)) {
+      parsed.push_back(command);
+      checksum_fast += command.value;
+    }
+  }
+  double fast_parse = seconds_since(start);
+
+  std::remove("bench_parse.index");
+  std::remove("bench_parse.block");
+  std::vector<sjtu::vector<int>> answers;
+  start = std::chrono::steady_clock::now();
+  {
+    BPT<long long, int> tree("bench_parse");
+    for (const Command &command : parsed) {
+      if (command.kind == Command::INSERT) {
+        tree.insert(command.key, command.value);
+      } else if (command.kind == Command::FIND) {
+        answers.push_back(tree.find(command.key));
+      } else if (command.kind == Command::REMOVE) {
+        tree.remove(command.key, command.value);
+      }
+    }
+  }
+  double execute = seconds_since(start);
+  std::remove("bench_parse.index");
+  std::remove("bench_parse.block");
+  std::remove("bench_parse.hot");
+
+  start = std::chrono::steady_clock::now();
+  {
+    std::ofstream out("/dev/null");
+    for (const sjtu::vector<int> &result : answers) {
+      if (result.size() == 0) {
+        out << "null\n";
+      } else {
+        for (size_t i = 0; i < result.size(); ++i) out << result[i] << ' ';
+        out << '\n';
+      }
+    }
+  }
+  double stream_format = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  {
+    int fd = open("/dev/null", O_WRONLY);
+    sjtu::OutputBuffer out(fd);
+    for (const sjtu::vector<int> &result : answers) out.put_values(result);
+    out.flush();
+    close(fd);
+  }
+  double fast_format = seconds_since(start);
+
+  double old_total = stream_parse + execute + stream_format;
+  double new_total = fast_parse + execute + fast_format;
+  std::printf("%zu commands, %zu finds, %.1f MiB of input\n", commands,
+              answers.size(), text.size() / double(1 << 20));
+  std::printf("%-20s %10s %14s %9s\n", "stage", "seconds", "commands/s",
+              "share");
+  report("iostream parse", commands, stream_parse, old_total);
+  report("tree", commands, execute, old_total);
+  report("iostream format", commands, stream_format, old_total);
+  std::printf("\n");
+  report("CommandReader", commands, fast_parse, new_total);
+  report("tree", commands, execute, new_total);
+  report("OutputBuffer", commands, fast_format, new_total);
+  std::printf("\nparse speedup %.2fx, format speedup %.2fx%s\n",
+              stream_parse / fast_parse, stream_format / fast_format,
+              checksum_stream == checksum_fast ? "" : "  WRONG");
+  return 0;
+}
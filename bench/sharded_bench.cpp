@@ -0,0 +1,123 @@
+// Throughput of ShardedBPT as the number of threads grows: with t threads
+// the engine runs t shards (t workers) and t client threads, each with its
+// own session. Reads are synchronous round trips, writes are queued, so the
+// write-heavy mix mostly measures how fast the workers drain the queues.
+//
+// usage: bpt_sharded_bench [--keys N] [--seconds S] [--threads MAX]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sharded.hpp"
+
+namespace {
+
+struct Workload {
+  const char *name;
+  int read_percent;
+};
+
+void remove_files(int shards) {
+  for (int i = 0; i < shards; ++i) {
+    std::string name = "bench_sharded_shard" + std::to_string(i);
+    std::remove((name + ".index").c_str());
+    std::remove((name + ".block").c_str());
+    std::remove((name + ".hot").c_str());
+  }
+}
+
+// Like bpt_concurrent_bench, writers insert fresh keys and delete their
+// oldest ones, so the trees keep roughly the initial size.
+double run(long long keys, const Workload &workload, int threads,
+           double seconds) {
+  remove_files(threads);
+  double throughput;
+  {
+    ShardedBPT<long long, int> tree("bench_sharded", threads);
+    for (long long key = 0; key < keys; ++key) {
+      tree.insert(key, 0);
+    }
+    tree.sync();
+
+    std::atomic<bool> stop(false);
+    std::atomic<long long> total(0);
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    for (int id = 0; id < threads; ++id) {
+      clients.emplace_back([&, id] {
+        auto session = tree.session();
+        std::mt19937_64 rng(id * 1000003 + threads);
+        long long next_key = keys + id;
+        long long oldest_key = next_key;
+        long long done = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+          for (int i = 0; i < 64; ++i) {
+            if (static_cast<int>(rng() % 100) < workload.read_percent) {
+              session.find(static_cast<long long>(rng() % keys));
+            } else if (next_key - oldest_key < 64 * threads) {
+              session.insert(next_key, id);
+              next_key += threads;
+            } else {
+              session.remove(oldest_key, id);
+              oldest_key += threads;
+            }
+          }
+          done += 64;
+        }
+        // count queued writes only once they are applied
+        session.sync();
+        total += done;
+      });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto &client : clients) client.join();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    throughput = total / elapsed.count();
+  }
+  remove_files(threads);
+  return throughput;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  long long keys = 50000;
+  double seconds = 1.0;
+  int max_threads = std::thread::hardware_concurrency();
+  if (max_threads <= 0) max_threads = 1;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--keys") == 0) {
+      keys = std::atoll(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--seconds") == 0) {
+      seconds = std::atof(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--threads") == 0) {
+      max_threads = std::atoi(argv[i + 1]);
+    }
+  }
+
+  const Workload workloads[] = {{"read-mostly(95/5)", 95},
+                                {"balanced(50/50)", 50},
+                                {"write-only", 0}};
+  std::printf("%-18s %8s %14s %8s\n", "workload", "threads", "ops/s",
+              "speedup");
+  for (const Workload &workload : workloads) {
+    double base = 0;
+    for (int threads = 1;; threads *= 2) {
+      if (threads > max_threads) threads = max_threads;
+      double throughput = run(keys, workload, threads, seconds);
+      if (threads == 1) base = throughput;
+      std::printf("%-18s %8d %14.0f %8.2f\n", workload.name, threads,
+                  throughput, throughput / base);
+      if (threads == max_threads) break;
+    }
+  }
+  return 0;
+}
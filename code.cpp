@@ -1,51 +1,166 @@
-#include <iostream>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 
 #include "src/BPT.hpp"
+#include "src/command.hpp"
+#include "src/keys.hpp"
+#include "src/metrics.hpp"
+#include "src/pipeline.hpp"
+#include "src/server.hpp"
+#include "src/trace.hpp"
 #include "src/vector.hpp"
+#include "src/window.hpp"
 
-
-constexpr long long PR = 998244353;
-constexpr long long MOD = 99234523452349217;
-
-long long Hash(const std::string &s) {
-  __int128_t hash = 0;
-  for (char c : s) {
-    hash = (hash * PR + c + 1) % MOD;
+// usage: bpt_main [--pipeline | --window N] [--legacy-hash]
+//                 [--key-table chain|reject] [--record TRACE]
+//                 [--metrics JSON] [--warm-up off|sync|background]
+//                 < commands
+//        bpt_main --serve unix:PATH|tcp:PORT [--legacy-hash]
+//                 [--key-table chain|reject] [--record TRACE]
+//                 [--metrics JSON] [--warm-up off|sync|background]
+// --legacy-hash reads databases written before keys were hashed with
+// FastHash; the database records which hash it was created with and is
+// refused if the flag does not match. --key-table keeps <database>.keys to
+// catch hash collisions.
+// --serve keeps the database open and answers clients until SIGINT or
+// SIGTERM, see server.hpp. --record writes the commands executed, with
+// their arrival times, as a trace for bpt_workload replay.
+// --metrics writes the metrics.hpp snapshot to JSON at exit and whenever
+// SIGUSR1 arrives; the counters are only kept in a build with
+// -DBPT_ENABLE_METRICS=ON.
+// --warm-up reloads the pages listed in database.hot, the cache content
+// saved at the last close, before the first command (sync) or alongside
+// the first commands (background, the default); see BPT::warm_up.
+int main(int argc, char **argv) {
+  bool pipeline = false;
+  size_t window = 0;
+  KeyHasher hasher;
+  const char *key_table = nullptr;
+  const char *serve = nullptr;
+  const char *record = nullptr;
+  const char *metrics = nullptr;
+  const char *warm_up = "background";
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--pipeline") == 0) {
+      pipeline = true;
+    } else if (std::strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+      window = std::atoll(argv[++i]);
+    } else if (std::strcmp(argv[i], "--legacy-hash") == 0) {
+      hasher.kind = HashKind::LEGACY;
+    } else if (std::strcmp(argv[i], "--key-table") == 0 && i + 1 < argc) {
+      key_table = argv[++i];
+    } else if (std::strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      serve = argv[++i];
+    } else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record = argv[++i];
+    } else if (std::strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+      metrics = argv[++i];
+    } else if (std::strcmp(argv[i], "--warm-up") == 0 && i + 1 < argc) {
+      warm_up = argv[++i];
+    }
   }
-  return hash;
-}
-int main() {
-  int n;
-  std::cin >> n;
-  BPT<long long, int> bpt("database");
-  
-  for (int i = 0; i < n; ++i) {
-    std::string order;
-    std::cin >> order;
-    if (order == "insert") {
-      std::string key;
-      int value;
-      std::cin >> key >> value;
-      bpt.insert(Hash(key), value);
-    } else if (order == "find") {
-      std::string key;
-      std::cin >> key;
-      
-      auto result = bpt.find(Hash(key));
-      if (result.size() == 0) {
-        std::cout << "null\n";
-      } else {
-        for (auto &item : result) {
-          std::cout << item << ' ';
-        }
-        std::cout << '\n';
+  auto warm = [warm_up](BPT<long long, int> &bpt) {
+    if (std::strcmp(warm_up, "off") != 0) {
+      bpt.warm_up(std::strcmp(warm_up, "sync") != 0);
+    }
+  };
+  // null, after saying why, when the files cannot be used
+  auto open = [&hasher]() -> std::unique_ptr<BPT<long long, int>> {
+    std::unique_ptr<BPT<long long, int>> tree;
+    try {
+      tree.reset(new BPT<long long, int>("database", false,
+                                         static_cast<int>(hasher.kind)));
+    } catch (sjtu::runtime_error &) {
+      std::fprintf(stderr,
+                   "database.index / database.block use another page format\n");
+      return nullptr;
+    }
+    if (tree->key_tag() != static_cast<int>(hasher.kind)) {
+      std::fprintf(stderr, "database was written with the %s hash, %s\n",
+                   hasher.kind == HashKind::LEGACY ? "fast" : "legacy",
+                   hasher.kind == HashKind::LEGACY ? "drop --legacy-hash"
+                                                   : "pass --legacy-hash");
+      return nullptr;
+    }
+    return tree;
+  };
+  std::unique_ptr<KeyTable> table;
+  if (key_table != nullptr) {
+    try {
+      table.reset(new KeyTable("database", hasher.kind,
+                               std::strcmp(key_table, "reject") == 0
+                                   ? KeyTable::REJECT
+                                   : KeyTable::CHAIN));
+    } catch (sjtu::runtime_error &) {
+      std::fprintf(stderr,
+                   "database.keys cannot be opened or uses the other hash\n");
+      return 1;
+    }
+    hasher.table = table.get();
+  }
+  std::unique_ptr<TraceWriter> trace;
+  if (record != nullptr) {
+    try {
+      trace.reset(new TraceWriter(record));
+    } catch (sjtu::runtime_error &) {
+      std::fprintf(stderr, "%s cannot be written\n", record);
+      return 1;
+    }
+  }
+  if (metrics != nullptr) sjtu::metrics::watch_dump_signal(metrics);
+  if (serve != nullptr) {
+    {
+      std::unique_ptr<BPT<long long, int>> tree = open();
+      if (!tree) return 1;
+      BPT<long long, int> &bpt = *tree;
+      warm(bpt);
+      CommandServer<BPT<long long, int>> server(bpt, hasher);
+      server.record(trace.get());
+      if (!server.listen(serve)) return 1;
+      server.run();
+    }
+    // after the tree is closed, so its final write-backs are counted
+    if (metrics != nullptr) sjtu::metrics::dump_json(metrics);
+    return 0;
+  }
+  sjtu::CommandReader in(STDIN_FILENO, hasher);
+  sjtu::OutputBuffer out(STDOUT_FILENO);
+  long long n;
+  if (!in.count(n)) return 0;
+  std::unique_ptr<BPT<long long, int>> tree = open();
+  if (!tree) return 1;
+  BPT<long long, int> &bpt = *tree;
+  warm(bpt);
+
+  if (pipeline) {
+    run_pipelined(in, n, bpt, out, trace.get());
+  } else if (window > 0) {
+    run_windowed(in, n, bpt, out, window, trace.get());
+  } else {
+    Command command;
+    for (long long i = 0; i < n && in.next(command); ++i) {
+      if (trace && command.kind != Command::UNKNOWN) {
+        trace->record(command.kind, command.key, command.value);
+      }
+      if (command.kind == Command::INSERT) {
+        bpt.insert(command.key, command.value);
+      } else if (command.kind == Command::FIND) {
+        out.put_values(bpt.find(command.key));
+      } else if (command.kind == Command::REMOVE) {
+        bpt.remove(command.key, command.value);
       }
-    } else if (order == "delete") {
-      std::string key;
-      int value;
-      std::cin >> key >> value;
-      bpt.remove(Hash(key), value);
+      sjtu::metrics::dump_if_requested();
     }
   }
-  
-}
\ No newline at end of file
+  tree.reset();
+  if (metrics != nullptr) sjtu::metrics::dump_json(metrics);
+  if (table && table->collisions() > 0) {
+    std::fprintf(stderr, "%zu key hash collisions %s\n", table->collisions(),
+                 std::strcmp(key_table, "reject") == 0 ? "rejected"
+                                                       : "chained");
+  }
+}
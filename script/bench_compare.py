@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    """读取 bpt_bench 的 JSON 行输出, 按 (suite, case, dist, n) 索引"""
+    results = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            row = json.loads(line)
+            results[(row["suite"], row["case"], row["dist"], row["n"])] = row
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description="比较两次 bpt_bench 运行结果")
+    parser.add_argument("base", help="基准结果文件")
+    parser.add_argument("new", help="新结果文件")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="标记为变化的百分比阈值 (默认 5)")
+    args = parser.parse_args()
+
+    base = load(args.base)
+    new = load(args.new)
+    regressions = 0
+    print(f"{'suite':<8} {'case':<20} {'dist':<11} {'n':>10} "
+          f"{'base ns/op':>12} {'new ns/op':>12} {'change':>9}")
+    for key in sorted(base.keys() & new.keys()):
+        old_ns = base[key]["ns_per_op"]
+        new_ns = new[key]["ns_per_op"]
+        change = (new_ns - old_ns) / old_ns * 100 if old_ns else 0.0
+        mark = ""
+        if change > args.threshold:
+            mark = "  slower"
+            regressions += 1
+        elif change < -args.threshold:
+            mark = "  faster"
+        suite, case, dist, n = key
+        print(f"{suite:<8} {case:<20} {dist:<11} {n:>10} "
+              f"{old_ns:>12.2f} {new_ns:>12.2f} {change:>+8.1f}%{mark}")
+    for key in sorted(base.keys() - new.keys()):
+        print(f"only in {args.base}: {' '.join(map(str, key))}")
+    for key in sorted(new.keys() - base.keys()):
+        print(f"only in {args.new}: {' '.join(map(str, key))}")
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -22,8 +22,8 @@ rm -f your_output_*.txt
 
 # 删除数据库文件
 echo -e "${YELLOW}删除数据库文件...${NC}"
-rm -f database.block database.index
-rm -f build/database.block build/database.index
+rm -f database.block database.index database.hot
+rm -f build/database.block build/database.index build/database.hot
 
 # 删除临时目录
 echo -e "${YELLOW}删除临时目录...${NC}"
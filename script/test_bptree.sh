@@ -207,7 +207,7 @@ EOF
     # 运行C++程序
     echo "运行C++程序..."
     cd build
-    rm -f database.block database.index  # 清理之前的数据文件
+    rm -f database.block database.index database.hot  # 清理之前的数据文件
     
     if [ "$USE_VALGRIND" = true ]; then
         # 使用Valgrind运行 - 简化选项，减少干扰
@@ -1,10 +1,65 @@
 #include "BPT.hpp"
 
+#include <algorithm>
 
 
-template <class Key, class Value>
-void BPT<Key, Value>::insert(const Key &key, const Value &value) {
-  if (root_ == -1) {
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::insert(const Key &key, const Value &value) {
+  sjtu::metrics::OpTimer timer(sjtu::metrics::INSERT);
+  {
+    std::shared_lock<std::shared_mutex> bloom(bloom_mutex_);
+    bloomAdd(key);
+    if (!bufferWrite({key, value}, false)) {
+      applyInsert(key, value);
+    }
+  }
+  rebuildBloom(false);
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::applyInsert(const Key &key, const Value &value) {
+  std::shared_lock<std::shared_mutex> gate(snapshot_gate_);
+  bool inserted;
+  if (tryFingerInsert({key, value}, false, inserted)) {
+    return;
+  }
+  while (!tryInsert(key, value, false, inserted)) {
+  }
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::upsert(const Key &key, const Value &value) {
+  flush_write_buffer();
+  bool inserted;
+  {
+    std::shared_lock<std::shared_mutex> bloom(bloom_mutex_);
+    bloomAdd(key);
+    std::shared_lock<std::shared_mutex> gate(snapshot_gate_);
+    if (!tryFingerInsert({key, value}, true, inserted)) {
+      while (!tryInsert(key, value, true, inserted)) {
+      }
+    }
+  }
+  rebuildBloom(false);
+  return inserted;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryInsert(const Key &key, const Value &value,
+                                bool unique, bool &inserted) {
+  inserted = true;
+  sjtu::LatchGuard guard;
+  sjtu::vector<pathFrame<Key, Value>> path;
+  sjtu::vector<uint64_t> versions;
+  int leaf_addr = findLeafNode({key, value}, path, versions);
+  if (leaf_addr == -2) {
+    return false;
+  }
+  if (leaf_addr == -1) {
+    if (!guard.upgrade(root_latch_, versions[0])) {
+      return false;
+    }
     Block<Key, Value> new_block;
     new_block.data[0] = Key_Value<Key, Value>{key, value};
     new_block.size++;
@@ -12,101 +67,1356 @@ void BPT<Key, Value>::insert(const Key &key, const Value &value) {
     //int head_ = block_file_.write(new_block);
     int head_ = cache_manager_.write_block(new_block);
     root_ = head_;
-    block_file_.write_info(head_, 1);
     //index_file_.write_info(root_, 1);
     height_ = 0;
-    return;
+    return true;
   }
 
-  sjtu::vector<pathFrame<Key, Value>> path;
-  int leaf_addr = findLeafNode({key, value}, path);
+  Block<Key, Value> leaf;
+  cache_manager_.read_block(leaf, leaf_addr);
+  if (!block_latches_[leaf_addr].validate(versions.back())) {
+    return false;
+  }
+  // leaves before this one that may hold the pair too, validated once the
+  // path is latched
+  sjtu::vector<std::pair<int, uint64_t>> seen;
+  if (unique) {
+    Key_Value<Key, Value> kv{key, value};
+    int pos = leaf.size == 0 ? 0 : binarySearch(leaf.data, kv, 0, leaf.size - 1);
+    if (pos < leaf.size && leaf.data[pos] == kv) {
+      inserted = false;
+      return true;
+    }
+    if (mayPrecede(path, kv)) {
+      bool found;
+      if (!tryFindBefore(kv, leaf_addr, found, seen)) {
+        return false;
+      }
+      if (found) {
+        inserted = false;
+        return true;
+      }
+    }
+  }
+  // latch from the deepest node that absorbs the new key without splitting
+  int top = path.size();
+  if (leaf.size == DEFAULT_LEAF_SIZE) {
+    top = path.size() - 1;
+    while (top >= 0 && path[top].index.size == ORDER - 1) {
+      top--;
+    }
+  }
+  // every ancestor's count changes
+  if (counted_ && top > 0) {
+    top = 0;
+  }
+  if (!lockPath(guard, path, versions, leaf_addr, top)) {
+    return false;
+  }
+  for (size_t i = 0; i < seen.size(); ++i) {
+    if (!block_latches_[seen[i].first].validate(seen[i].second)) {
+      return false;
+    }
+  }
+  if (counted_) {
+    adjustCounts(path, 1);
+  }
 
   Key_Value<Key, Value> split_key;
-  int new_leaf_addr;
-  bool leaf_split =
-      insertIntoLeaf(leaf_addr, key, value, split_key, new_leaf_addr);
+  int new_leaf_addr, new_leaf_size;
+  bool leaf_split = insertIntoLeaf(leaf_addr, key, value, split_key,
+                                   new_leaf_addr, new_leaf_size);
 
   if (leaf_split) {
-    insertIntoParent(path, path.size() - 1, split_key, new_leaf_addr);
+    insertIntoParent(path, path.size() - 1, split_key, new_leaf_addr,
+                     DEFAULT_LEAF_SIZE + 1 - new_leaf_size, new_leaf_size);
+  } else if (!counted_) {
+    // the leaf latch is bumped once more when the guard lets go
+    setFinger(leaf_addr, versions.back() + 2, fenceOf(path));
+  }
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryFingerInsert(const Key_Value<Key, Value> &kv,
+                                      bool unique, bool &inserted) {
+  // a counted insert has to bump the counts along the whole path
+  if (counted_) {
+    return false;
+  }
+  Finger finger;
+  {
+    std::lock_guard<std::mutex> lock(finger_mutex_);
+    finger = finger_;
+  }
+  if (finger.addr == -1 || !finger.fence.contains(kv)) {
+    return false;
+  }
+  sjtu::LatchGuard guard;
+  if (!guard.upgrade(block_latches_[finger.addr], finger.version)) {
+    return false;
+  }
+  Block<Key, Value> leaf;
+  cache_manager_.read_block(leaf, finger.addr);
+  int pos = leaf.size == 0 ? 0 : binarySearch(leaf.data, kv, 0, leaf.size - 1);
+  if (unique && pos < leaf.size && leaf.data[pos] == kv) {
+    inserted = false;
+    return true;
+  }
+  // the pair may end the leaf before, which only the full path checks
+  if (unique && finger.fence.has_low && finger.fence.low == kv) {
+    return false;
+  }
+  if (leaf.size >= DEFAULT_LEAF_SIZE) {
+    return false;
+  }
+  for (int i = leaf.size; i > pos; --i) {
+    leaf.data[i] = leaf.data[i - 1];
+  }
+  leaf.data[pos] = kv;
+  leaf.size++;
+  cache_manager_.update_block(leaf, finger.addr);
+  inserted = true;
+  setFinger(finger.addr, finger.version + 2, finger.fence);
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::setFinger(int addr, uint64_t version,
+                                const leafFence<Key, Value> &fence) {
+  std::lock_guard<std::mutex> lock(finger_mutex_);
+  finger_.addr = addr;
+  finger_.version = version;
+  finger_.fence = fence;
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::remove(const Key &key, const Value &value) {
+  sjtu::metrics::OpTimer timer(sjtu::metrics::REMOVE);
+  // the filter holds every key stored or buffered
+  if (bloomRejects(key)) {
+    return;
+  }
+  if (!bufferWrite({key, value}, true)) {
+    applyRemove(key, value);
+  }
+  rebuildBloom(false);
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::applyRemove(const Key &key, const Value &value) {
+  std::shared_lock<std::shared_mutex> gate(snapshot_gate_);
+  bool removed;
+  while (!tryRemove(key, value, removed)) {
+  }
+  // only a pair taken out leaves a stale key in the filter
+  if (removed && bloom_bits_ > 0) {
+    bloom_removes_++;
+  }
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryRemove(const Key &key, const Value &value,
+                                         bool &removed, bool leftmost) {
+  removed = false;
+  sjtu::LatchGuard guard;
+  sjtu::vector<pathFrame<Key, Value>> path;
+  sjtu::vector<uint64_t> versions;
+  Key_Value<Key, Value> kv = Key_Value<Key, Value>{key, value};
+  int leaf_addr = findLeafNode(kv, path, versions, leftmost);
+  if (leaf_addr == -2) {
+    return false;
+  }
+  if (leaf_addr == -1) {
+    return true;
+  }
+  Block<Key, Value> leaf;
+  //block_file_.read(leaf, leaf_addr);
+  cache_manager_.read_block(leaf, leaf_addr);
+  if (!block_latches_[leaf_addr].validate(versions.back())) {
+    return false;
+  }
+  int pos = -1;
+  pos = leaf.size == 0 ? 0 : binarySearch(leaf.data, kv, 0, leaf.size - 1);
+  if (pos >= leaf.size || leaf.data[pos] != kv) {
+    // the run of kv may have been split, leaving the copies further left
+    if (!leftmost && mayPrecede(path, kv)) {
+      return tryRemove(key, value, removed, true);
+    }
+    return true;
+  }
+
+  bool underflow = leaf.size - 1 < (DEFAULT_LEAF_SIZE + 1) / 3;
+  bool rebalance = underflow && !relaxed_balance_;
+  if (rebalance) {
+    if (!lockForRebalance(guard, path, versions, leaf_addr, leaf.size == 1)) {
+      return false;
+    }
+  } else if (!lockPath(guard, path, versions, leaf_addr,
+                       counted_ ? 0 : path.size())) {
+    return false;
+  }
+  if (counted_) {
+    adjustCounts(path, -1);
+  }
+  removed = true;
+
+  for (int i = pos; i < leaf.size - 1; ++i) {
+    leaf.data[i] = leaf.data[i + 1];
+  }
+  leaf.size--;
+  if (!rebalance) {
+    //block_file_.update(leaf, leaf_addr);
+    cache_manager_.update_block(leaf, leaf_addr);
+    guard.release();
+    if (underflow && (!path.empty() || leaf.size == 0)) {
+      deferRebalance(kv, leaf_addr);
+    }
+    return true;
+  }
+  balanceAfterRemove(leaf, leaf_addr, path);
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::replace(const Key &key, const Value &old_value,
+                              const Value &new_value) {
+  bool found, in_place;
+  flush_write_buffer();
+  {
+    std::shared_lock<std::shared_mutex> gate(snapshot_gate_);
+    while (!tryReplace(key, old_value, new_value, found, in_place)) {
+    }
+  }
+  if (found && !in_place) {
+    remove(key, old_value);
+    insert(key, new_value);
+  }
+  return found;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryReplace(const Key &key, const Value &old_value,
+                                 const Value &new_value, bool &found,
+                                 bool &in_place, bool leftmost) {
+  found = false;
+  in_place = true;
+  sjtu::LatchGuard guard;
+  sjtu::vector<pathFrame<Key, Value>> path;
+  sjtu::vector<uint64_t> versions;
+  Key_Value<Key, Value> old_kv{key, old_value};
+  Key_Value<Key, Value> new_kv{key, new_value};
+  int leaf_addr = findLeafNode(old_kv, path, versions, leftmost);
+  if (leaf_addr == -2) {
+    return false;
+  }
+  if (leaf_addr == -1) {
+    return true;
+  }
+  Block<Key, Value> leaf;
+  cache_manager_.read_block(leaf, leaf_addr);
+  if (!block_latches_[leaf_addr].validate(versions.back())) {
+    return false;
+  }
+  int pos = leaf.size == 0 ? 0 : binarySearch(leaf.data, old_kv, 0, leaf.size - 1);
+  if (pos >= leaf.size || leaf.data[pos] != old_kv) {
+    if (!leftmost && mayPrecede(path, old_kv)) {
+      return tryReplace(key, old_value, new_value, found, in_place, true);
+    }
+    return true;
+  }
+  found = true;
+  if (old_kv == new_kv) {
+    return true;
+  }
+  if (!fenceOf(path).contains(new_kv)) {
+    in_place = false;
+    return true;
+  }
+  if (!lockPath(guard, path, versions, leaf_addr, path.size())) {
+    return false;
+  }
+  // the leaf keeps its size, so nothing above it changes
+  for (int i = pos; i < leaf.size - 1; ++i) {
+    leaf.data[i] = leaf.data[i + 1];
+  }
+  leaf.size--;
+  int new_pos = leaf.size == 0 ? 0 : binarySearch(leaf.data, new_kv, 0, leaf.size - 1);
+  for (int i = leaf.size; i > new_pos; --i) {
+    leaf.data[i] = leaf.data[i - 1];
+  }
+  leaf.data[new_pos] = new_kv;
+  leaf.size++;
+  cache_manager_.update_block(leaf, leaf_addr);
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::contains(const Key &key) {
+  bool filtered;
+  if (bloomRejects(key, filtered)) {
+    return false;
+  }
+  flush_write_buffer();
+  bool found;
+  while (!tryContains(key, found)) {
+  }
+  if (filtered && !found) {
+    bloom_stats_.false_positives++;
+  }
+  return found;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::contains(const Key &key, const Value &value) {
+  bool filtered;
+  if (bloomRejects(key, filtered)) {
+    return false;
+  }
+  flush_write_buffer();
+  bool found;
+  while (!tryContains(Key_Value<Key, Value>{key, value}, found)) {
+  }
+  return found;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryContains(const Key &key, bool &found) {
+  found = false;
+  sjtu::OptimisticLatch *latch = &root_latch_;
+  uint64_t version = root_latch_.read_version();
+  int ptr = root_;
+  int height = height_;
+  if (!root_latch_.validate(version)) {
+    return false;
+  }
+  if (ptr == -1) {
+    return true;
+  }
+  for (int level = 1; level <= height; ++level) {
+    Index<Key, Value> index;
+    sjtu::metrics::set_level(level);
+    if (!readIndexCoupled(latch, version, ptr, index)) return false;
+    int idx = binarySearch(index.keys, key, 0, index.size - 1);
+    ptr = index.children[idx];
+  }
+  Block<Key, Value> block;
+  if (!readBlockCoupled(latch, version, ptr, block)) return false;
+  int idx = block.size == 0 ? 0 : binarySearch(block.data, key, 0, block.size - 1);
+  // the first pair not below key may sit at the head of a later leaf
+  while (idx == block.size) {
+    ptr = block.next;
+    if (ptr == -1) {
+      return true;
+    }
+    if (!readBlockCoupled(latch, version, ptr, block)) return false;
+    idx = 0;
+  }
+  found = block.data[idx].key == key;
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryContains(const Key_Value<Key, Value> &kv,
+                                  bool &found) {
+  found = false;
+  sjtu::OptimisticLatch *latch = &root_latch_;
+  uint64_t version = root_latch_.read_version();
+  int ptr = root_;
+  int height = height_;
+  if (!root_latch_.validate(version)) {
+    return false;
+  }
+  if (ptr == -1) {
+    return true;
+  }
+  for (int level = 1; level <= height; ++level) {
+    Index<Key, Value> index;
+    sjtu::metrics::set_level(level);
+    if (!readIndexCoupled(latch, version, ptr, index)) return false;
+    int idx = binarySearchForNotLess(index.keys, kv, 0, index.size - 1);
+    ptr = index.children[idx];
+  }
+  Block<Key, Value> block;
+  if (!readBlockCoupled(latch, version, ptr, block)) return false;
+  int pos = block.size == 0 ? 0 : binarySearch(block.data, kv, 0, block.size - 1);
+  // the first pair not below kv may sit at the head of a later leaf
+  while (pos == block.size) {
+    ptr = block.next;
+    if (ptr == -1) {
+      return true;
+    }
+    if (!readBlockCoupled(latch, version, ptr, block)) return false;
+    pos = 0;
+  }
+  found = block.data[pos] == kv;
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryFindBefore(
+    const Key_Value<Key, Value> &kv, int stop, bool &found,
+    sjtu::vector<std::pair<int, uint64_t>> &seen) {
+  found = false;
+  seen.clear();
+  sjtu::vector<pathFrame<Key, Value>> path;
+  sjtu::vector<uint64_t> versions;
+  int ptr = findLeafNode(kv, path, versions, true);
+  if (ptr == -2) {
+    return false;
+  }
+  uint64_t version = versions.back();
+  while (ptr != -1 && ptr != stop) {
+    Block<Key, Value> block;
+    cache_manager_.read_block(block, ptr);
+    if (!block_latches_[ptr].validate(version)) {
+      return false;
+    }
+    seen.push_back({ptr, version});
+    int pos = block.size == 0 ? 0 : binarySearch(block.data, kv, 0, block.size - 1);
+    if (pos < block.size && block.data[pos] == kv) {
+      found = true;
+      return true;
+    }
+    ptr = block.next;
+    if (ptr != -1) {
+      version = block_latches_[ptr].read_version();
+    }
+  }
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::set_relaxed_balance(bool relaxed) {
+  relaxed_balance_ = relaxed;
+  if (!relaxed) {
+    consolidate();
+  }
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::consolidate() {
+  std::shared_lock<std::shared_mutex> gate(snapshot_gate_);
+  consolidatePending();
+}
+
+template <class Key, class Value, class Storage>
+typename BPT<Key, Value, Storage>::RebalanceStats BPT<Key, Value, Storage>::rebalance_stats()
+    const {
+  return {stats_.splits, stats_.merges, stats_.borrows, stats_.deferred,
+          stats_.merges_avoided};
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::deferRebalance(const Key_Value<Key, Value> &key,
+                                     int addr) {
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    for (size_t i = 0; i < pending_.size(); ++i) {
+      if (pending_[i].addr == addr) return;
+    }
+    pending_.push_back({key, addr});
+    stats_.deferred++;
+    if (pending_.size() < REBALANCE_BATCH) return;
+  }
+  consolidatePending();
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::consolidatePending() {
+  sjtu::vector<PendingLeaf> batch;
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    batch = pending_;
+    pending_.clear();
+  }
+  for (size_t i = 0; i < batch.size(); ++i) {
+    while (!tryRebalance(batch[i].key, batch[i].addr)) {
+    }
+  }
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryRebalance(const Key_Value<Key, Value> &key, int addr) {
+  sjtu::LatchGuard guard;
+  sjtu::vector<pathFrame<Key, Value>> path;
+  sjtu::vector<uint64_t> versions;
+  int leaf_addr = findLeafNode(key, path, versions);
+  if (leaf_addr == -2) {
+    return false;
+  }
+  if (leaf_addr == -1) {
+    return true;
+  }
+  Block<Key, Value> leaf;
+  cache_manager_.read_block(leaf, leaf_addr);
+  if (!block_latches_[leaf_addr].validate(versions.back())) {
+    return false;
+  }
+  if (leaf.size >= (DEFAULT_LEAF_SIZE + 1) / 3 ||
+      (path.empty() && leaf.size > 0)) {
+    if (leaf_addr == addr) stats_.merges_avoided++;
+    return true;
+  }
+  if (!lockForRebalance(guard, path, versions, leaf_addr, leaf.size == 0)) {
+    return false;
+  }
+  balanceAfterRemove(leaf, leaf_addr, path);
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+sjtu::vector<Value> BPT<Key, Value, Storage>::find(const Key &key) {
+  sjtu::metrics::OpTimer timer(sjtu::metrics::FIND);
+  bool filtered;
+  if (bloomRejects(key, filtered)) {
+    return sjtu::vector<Value>();
+  }
+  return findFiltered(key, filtered);
+}
+
+template <class Key, class Value, class Storage>
+sjtu::vector<Value> BPT<Key, Value, Storage>::findFiltered(const Key &key,
+                                                           bool filtered) {
+  sjtu::vector<Value> result;
+  if (buffer_capacity_ == 0) {
+    while (!tryFind(key, result)) {
+      result.clear();
+    }
+  } else {
+    std::shared_lock<std::shared_mutex> lock(buffer_mutex_);
+    while (!tryFind(key, result)) {
+      result.clear();
+    }
+    mergeBuffered(key, result);
+  }
+  if (filtered && result.empty()) {
+    bloom_stats_.false_positives++;
+  }
+  return result;
+}
+
+template <class Key, class Value, class Storage>
+sjtu::Task<sjtu::vector<Value>> BPT<Key, Value, Storage>::find_async(
+    sjtu::Scheduler &scheduler, Key key) {
+  bool filtered;
+  if (bloomRejects(key, filtered)) {
+    co_return sjtu::vector<Value>();
+  }
+  co_await prefetchPath(scheduler, {key, Value()}, false);
+  co_return findFiltered(key, filtered);
+}
+
+template <class Key, class Value, class Storage>
+sjtu::Task<void> BPT<Key, Value, Storage>::insert_async(
+    sjtu::Scheduler &scheduler, Key key, Value value) {
+  // a buffered write touches no page
+  if (buffer_capacity_ == 0) {
+    co_await prefetchPath(scheduler, {key, value}, true);
+  }
+  insert(key, value);
+}
+
+template <class Key, class Value, class Storage>
+sjtu::Task<void> BPT<Key, Value, Storage>::remove_async(
+    sjtu::Scheduler &scheduler, Key key, Value value) {
+  if (buffer_capacity_ == 0) {
+    co_await prefetchPath(scheduler, {key, value}, true);
+  }
+  remove(key, value);
+}
+
+template <class Key, class Value, class Storage>
+sjtu::Task<void> BPT<Key, Value, Storage>::prefetchPath(
+    sjtu::Scheduler &scheduler, Key_Value<Key, Value> kv, bool by_pair) {
+  // only a hint: pages are never freed, so a path that is concurrently
+  // restructured still leads to valid pages, and the synchronous call
+  // validates whatever it reads
+  int ptr = root_;
+  int height = height_;
+  if (ptr == -1) {
+    co_return;
+  }
+  for (int level = 1; level <= height; ++level) {
+    Index<Key, Value> index;
+    if (!cache_manager_.try_read_index(index, ptr)) {
+      co_await scheduler.offload([this, ptr, &index] {
+        cache_manager_.read_index(index, ptr);
+      });
+    }
+    if (index.size == 0) {
+      ptr = index.children[0];
+      continue;
+    }
+    int idx = by_pair
+                  ? binarySearchForBigOrEqual(index.keys, kv, 0, index.size - 1)
+                  : binarySearch(index.keys, kv.key, 0, index.size - 1);
+    ptr = index.children[idx];
+  }
+  Block<Key, Value> block;
+  if (!cache_manager_.try_read_block(block, ptr)) {
+    co_await scheduler.offload([this, ptr, &block] {
+      cache_manager_.read_block(block, ptr);
+    });
+  }
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::set_bloom_filter(size_t bits_per_key) {
+  bloom_bits_ = bits_per_key;
+  rebuildBloom(true);
+}
+
+template <class Key, class Value, class Storage>
+typename BPT<Key, Value, Storage>::BloomStats
+BPT<Key, Value, Storage>::bloom_stats() {
+  std::shared_lock<std::shared_mutex> lock(bloom_mutex_);
+  return {bloom_stats_.probes, bloom_stats_.negatives,
+          bloom_stats_.false_positives, bloom_ ? bloom_->memory_usage() : 0,
+          bloom_ ? (size_t)bloom_capacity_ : 0};
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::save_hot_pages() {
+  return cache_manager_.save_hot_pages(hotPagesFile());
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::warm_up(bool background) {
+  return cache_manager_.warm_up(hotPagesFile(), background);
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::bloomRejects(const Key &key, bool &filtered) {
+  filtered = false;
+  if (bloom_bits_ == 0) {
+    return false;
+  }
+  std::shared_lock<std::shared_mutex> lock(bloom_mutex_);
+  if (!bloom_) {
+    return false;
+  }
+  bloom_stats_.probes++;
+  if (!bloom_->may_contain(keyHash(key))) {
+    bloom_stats_.negatives++;
+    return true;
+  }
+  filtered = true;
+  return false;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::bloomRejects(const Key &key) {
+  if (bloom_bits_ == 0) {
+    return false;
+  }
+  std::shared_lock<std::shared_mutex> lock(bloom_mutex_);
+  return bloom_ && !bloom_->may_contain(keyHash(key));
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::bloomAdd(const Key &key) {
+  if (bloom_) {
+    bloom_->add(keyHash(key));
+    bloom_adds_++;
+  }
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::bloomStale() const {
+  // the capacity is twice the keys, so a quarter of it is half the keys
+  return bloom_keys_ + bloom_adds_ > bloom_capacity_ ||
+         bloom_removes_ > bloom_capacity_ / 4;
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::rebuildBloom(bool force) {
+  if (!force && (bloom_bits_ == 0 || !bloomStale())) {
+    return;
+  }
+  std::unique_lock<std::shared_mutex> lock(bloom_mutex_);
+  // another thread may have rebuilt it meanwhile
+  if (!force && !bloomStale()) {
+    return;
+  }
+  size_t bits = bloom_bits_;
+  if (bits == 0) {
+    bloom_.reset();
+    return;
+  }
+  // buffered pairs only reach the leaves on a flush
+  flush_write_buffer();
+  sjtu::vector<uint64_t> hashes;
+  while (!tryCollectKeys(hashes)) {
+    hashes.clear();
+  }
+  size_t capacity = hashes.size() * 2;
+  if (capacity < BLOOM_MIN_KEYS) {
+    capacity = BLOOM_MIN_KEYS;
+  }
+  bloom_.reset(new sjtu::BloomFilter(capacity, bits));
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    bloom_->add(hashes[i]);
+  }
+  bloom_capacity_ = capacity;
+  bloom_keys_ = hashes.size();
+  bloom_adds_ = 0;
+  bloom_removes_ = 0;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryCollectKeys(sjtu::vector<uint64_t> &hashes) {
+  sjtu::OptimisticLatch *latch = &root_latch_;
+  uint64_t version = root_latch_.read_version();
+  int ptr = root_;
+  int height = height_;
+  if (!root_latch_.validate(version)) {
+    return false;
+  }
+  if (ptr == -1) {
+    return true;
+  }
+  for (int level = 1; level <= height; ++level) {
+    Index<Key, Value> index;
+    sjtu::metrics::set_level(level);
+    if (!readIndexCoupled(latch, version, ptr, index)) return false;
+    ptr = index.children[0];
+  }
+  Block<Key, Value> block;
+  bool first = true;
+  Key last;
+  while (ptr != -1) {
+    if (!readBlockCoupled(latch, version, ptr, block)) return false;
+    for (size_t i = 0; i < block.size; ++i) {
+      if (first || last < block.data[i].key) {
+        hashes.push_back(keyHash(block.data[i].key));
+        last = block.data[i].key;
+        first = false;
+      }
+    }
+    ptr = block.next;
+  }
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::set_write_buffer(size_t capacity) {
+  std::unique_lock<std::shared_mutex> lock(buffer_mutex_);
+  buffer_capacity_ = capacity;
+  if (capacity == 0 || buffer_run_.size() + buffer_tail_.size() >= capacity) {
+    flushBufferLocked();
+  }
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::flush_write_buffer() {
+  if (buffer_capacity_ == 0) {
+    return;
+  }
+  {
+    std::shared_lock<std::shared_mutex> lock(buffer_mutex_);
+    if (buffer_run_.empty() && buffer_tail_.empty()) {
+      return;
+    }
+  }
+  std::unique_lock<std::shared_mutex> lock(buffer_mutex_);
+  flushBufferLocked();
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::bufferWrite(const Key_Value<Key, Value> &kv,
+                                           bool remove) {
+  if (buffer_capacity_ == 0) {
+    return false;
+  }
+  std::unique_lock<std::shared_mutex> lock(buffer_mutex_);
+  // turned off while we waited for the lock
+  if (buffer_capacity_ == 0) {
+    return false;
+  }
+  buffer_tail_.push_back({kv, buffer_seq_++, remove});
+  if (buffer_tail_.size() >= WRITE_BUFFER_TAIL &&
+      buffer_tail_.size() >= buffer_run_.size() / 16) {
+    mergeBufferTail();
+  }
+  if (buffer_run_.size() + buffer_tail_.size() >= buffer_capacity_) {
+    flushBufferLocked();
+  }
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::mergeBufferTail() {
+  if (buffer_tail_.empty()) {
+    return;
+  }
+  std::sort(&buffer_tail_[0], &buffer_tail_[0] + buffer_tail_.size());
+  sjtu::vector<Message> merged;
+  size_t i = 0, j = 0;
+  while (i < buffer_run_.size() || j < buffer_tail_.size()) {
+    if (j == buffer_tail_.size() ||
+        (i < buffer_run_.size() && buffer_run_[i] < buffer_tail_[j])) {
+      merged.push_back(buffer_run_[i++]);
+    } else {
+      merged.push_back(buffer_tail_[j++]);
+    }
+  }
+  buffer_run_ = merged;
+  buffer_tail_.clear();
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::flushBufferLocked() {
+  mergeBufferTail();
+  for (size_t i = 0; i < buffer_run_.size(); ++i) {
+    const Message &message = buffer_run_[i];
+    if (message.remove) {
+      applyRemove(message.kv.key, message.kv.value);
+    } else {
+      applyInsert(message.kv.key, message.kv.value);
+    }
   }
+  buffer_run_.clear();
 }
 
-template <class Key, class Value>
-void BPT<Key, Value>::remove(const Key &key, const Value &value) {
-  sjtu::vector<pathFrame<Key, Value>> path;
-  Key_Value<Key, Value> kv = Key_Value<Key, Value>{key, value};
-  int leaf_addr = findLeafNode(kv, path);
-  if (leaf_addr == -1) {
-    return;
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::mergeBuffered(const Key &key,
+                                             sjtu::vector<Value> &values) {
+  sjtu::vector<Message> messages;
+  size_t l = 0, r = buffer_run_.size();
+  while (l < r) {
+    size_t mid = l + (r - l) / 2;
+    if (buffer_run_[mid].kv.key < key) {
+      l = mid + 1;
+    } else {
+      r = mid;
+    }
   }
-  Block<Key, Value> leaf;
-  //block_file_.read(leaf, leaf_addr);
-  cache_manager_.read_block(leaf, leaf_addr);
-  int pos = -1;
-  pos = leaf.size == 0 ? 0 : binarySearch(leaf.data, kv, 0, leaf.size - 1);
-  if (pos >= leaf.size || leaf.data[pos] != kv) {
-    return;
+  for (size_t i = l; i < buffer_run_.size() && buffer_run_[i].kv.key == key;
+       ++i) {
+    messages.push_back(buffer_run_[i]);
   }
-  for (int i = pos; i < leaf.size - 1; ++i) {
-    leaf.data[i] = leaf.data[i + 1];
+  for (size_t i = 0; i < buffer_tail_.size(); ++i) {
+    if (buffer_tail_[i].kv.key == key) {
+      messages.push_back(buffer_tail_[i]);
+    }
   }
-  leaf.size--;
-  if (leaf.size >= (DEFAULT_LEAF_SIZE + 1) / 3) {
-    //block_file_.update(leaf, leaf_addr);
-    cache_manager_.update_block(leaf, leaf_addr);
+  if (messages.empty()) {
     return;
   }
-  balanceAfterRemove(leaf, leaf_addr, path);
+  std::sort(&messages[0], &messages[0] + messages.size());
+  // per value: copies in the tree, then each message in arrival order, the
+  // way applying them would end up
+  sjtu::vector<Value> merged;
+  size_t i = 0, j = 0;
+  while (i < values.size() || j < messages.size()) {
+    Value value = j == messages.size() ||
+                          (i < values.size() && values[i] < messages[j].kv.value)
+                      ? values[i]
+                      : messages[j].kv.value;
+    long long copies = 0;
+    while (i < values.size() && values[i] == value) {
+      copies++;
+      i++;
+    }
+    while (j < messages.size() && messages[j].kv.value == value) {
+      if (!messages[j].remove) {
+        copies++;
+      } else if (copies > 0) {
+        copies--;
+      }
+      j++;
+    }
+    for (long long c = 0; c < copies; ++c) {
+      merged.push_back(value);
+    }
+  }
+  values = merged;
 }
 
-template <class Key, class Value>
-sjtu::vector<Value> BPT<Key, Value>::find(const Key &key) {
-  sjtu::vector<Value> result;
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryFind(const Key &key, sjtu::vector<Value> &result) {
+  sjtu::OptimisticLatch *latch = &root_latch_;
+  uint64_t version = root_latch_.read_version();
   size_t level = 1;
   int ptr = root_;
+  int height = height_;
+  if (!root_latch_.validate(version)) {
+    return false;
+  }
   if (ptr == -1) {
-    return result;
+    return true;
   }
-  if (height_ >= 1) {
-    while (level < height_) {
+  if (height >= 1) {
+    while (level < height) {
       Index<Key, Value> index;
       // index_file_.read(index, ptr);
-      cache_manager_.read_index(index, ptr);
+      sjtu::metrics::set_level(level);
+      if (!readIndexCoupled(latch, version, ptr, index)) return false;
       int idx = binarySearch(index.keys, key, 0, index.size - 1);
       ptr = index.children[idx];
       level++;
     }
     Index<Key, Value> index;
     //index_file_.read(index, ptr);
-    cache_manager_.read_index(index, ptr);
+    sjtu::metrics::set_level(level);
+    if (!readIndexCoupled(latch, version, ptr, index)) return false;
     int idx = binarySearch(index.keys, key, 0, index.size - 1);
     ptr = index.children[idx];
   }
 
   Block<Key, Value> block;
   //block_file_.read(block, ptr);
-  cache_manager_.read_block(block, ptr);
-  int idx = binarySearch(block.data, key, 0, block.size - 1);
+  if (!readBlockCoupled(latch, version, ptr, block)) return false;
+  int idx = block.size == 0 ? 0 : binarySearch(block.data, key, 0, block.size - 1);
   if (idx >= block.size) {
     ptr = block.next;
     if (ptr == -1) {
-      return result;
+      return true;
     }
     //block_file_.read(block, ptr);
-    cache_manager_.read_block(block, ptr);
+    if (!readBlockCoupled(latch, version, ptr, block)) return false;
     idx = 0;
   } else if (block.data[idx].key > key) {
+    return true;
+  }
+  while (true) {
+    if (idx == block.size) {
+      ptr = block.next;
+      if (ptr == -1) {
+        return true;
+      }
+      //block_file_.read(block, ptr);
+      if (!readBlockCoupled(latch, version, ptr, block)) return false;
+      idx = 0;
+    }
+    if (block.data[idx].key > key) {
+      return true;
+    }
+    result.push_back(block.data[idx].value);
+    ++idx;
+  }
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::find_many(
+    const sjtu::vector<Key> &keys,
+    const std::function<void(const Key &, const Value &)> &sink) {
+  if (keys.empty()) {
+    return;
+  }
+  flush_write_buffer();
+  sjtu::vector<Key> sorted;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    bool filtered;
+    if (!bloomRejects(keys[i], filtered)) {
+      sorted.push_back(keys[i]);
+    }
+  }
+  if (sorted.empty()) {
+    return;
+  }
+  std::sort(&sorted[0], &sorted[0] + sorted.size());
+  int n = 1;
+  for (size_t i = 1; i < sorted.size(); ++i) {
+    if (sorted[n - 1] < sorted[i]) {
+      sorted[n++] = sorted[i];
+    }
+  }
+  sjtu::vector<Value> buffer;
+  int done = 0;
+  while (done < n) {
+    uint64_t version = root_latch_.read_version();
+    int root = root_;
+    int height = height_;
+    if (!root_latch_.validate(version)) {
+      continue;
+    }
+    if (root == -1) {
+      return;
+    }
+    // a conflict only restarts the keys that are not answered yet
+    tryFindMany(sorted, done, n, root, 0, height, &root_latch_, version, sink,
+                buffer, done);
+  }
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryFindMany(
+    const sjtu::vector<Key> &keys, int begin, int end, int addr, int level,
+    int height, sjtu::OptimisticLatch *latch, uint64_t version,
+    const std::function<void(const Key &, const Value &)> &sink,
+    sjtu::vector<Value> &buffer, int &done) {
+  if (level < height) {
+    Index<Key, Value> index;
+    sjtu::metrics::set_level(level + 1);
+    if (!readIndexCoupled(latch, version, addr, index)) return false;
+    int i = begin;
+    while (i < end) {
+      int idx = binarySearch(index.keys, keys[i], 0, index.size - 1);
+      int j = i + 1;
+      while (j < end && (idx == index.size || !(index.keys[idx].key < keys[j]))) {
+        ++j;
+      }
+      // coupling revalidates this page before every child is read
+      if (!tryFindMany(keys, i, j, index.children[idx], level + 1, height,
+                       latch, version, sink, buffer, done)) {
+        return false;
+      }
+      i = j;
+    }
+    return true;
+  }
+
+  Block<Key, Value> leaf;
+  if (!readBlockCoupled(latch, version, addr, leaf)) return false;
+  Block<Key, Value> spill;
+  for (int i = begin; i < end; ++i) {
+    const Key &key = keys[i];
+    // values may run on into the next leaves, like in find
+    const Block<Key, Value> *block = &leaf;
+    sjtu::OptimisticLatch *block_latch = latch;
+    uint64_t block_version = version;
+    int idx = leaf.size == 0 ? 0 : binarySearch(leaf.data, key, 0, leaf.size - 1);
+    buffer.clear();
+    while (true) {
+      if (idx == block->size) {
+        if (block->next == -1) break;
+        if (!readBlockCoupled(block_latch, block_version, block->next, spill)) {
+          return false;
+        }
+        block = &spill;
+        idx = 0;
+        continue;
+      }
+      if (key < block->data[idx].key) break;
+      buffer.push_back(block->data[idx].value);
+      ++idx;
+    }
+    for (size_t j = 0; j < buffer.size(); ++j) {
+      sink(key, buffer[j]);
+    }
+    done = i + 1;
+  }
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::scan(
+    const Key &lo, const Key &hi,
+    const std::function<void(const Key &, const Value &)> &sink) {
+  if (hi < lo) {
+    return;
+  }
+  flush_write_buffer();
+  sjtu::vector<Key_Value<Key, Value>> result;
+  while (!tryScan(lo, hi, result)) {
+    result.clear();
+  }
+  for (size_t i = 0; i < result.size(); ++i) {
+    sink(result[i].key, result[i].value);
+  }
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryScan(
+    const Key &lo, const Key &hi, sjtu::vector<Key_Value<Key, Value>> &result) {
+  sjtu::OptimisticLatch *latch = &root_latch_;
+  uint64_t version = root_latch_.read_version();
+  int ptr = root_;
+  int height = height_;
+  if (!root_latch_.validate(version)) {
+    return false;
+  }
+  if (ptr == -1) {
+    return true;
+  }
+  for (int level = 1; level <= height; ++level) {
+    Index<Key, Value> index;
+    sjtu::metrics::set_level(level);
+    if (!readIndexCoupled(latch, version, ptr, index)) return false;
+    int idx = binarySearch(index.keys, lo, 0, index.size - 1);
+    ptr = index.children[idx];
+  }
+  Block<Key, Value> block;
+  if (!readBlockCoupled(latch, version, ptr, block)) return false;
+  int idx = block.size == 0 ? 0 : binarySearch(block.data, lo, 0, block.size - 1);
+  while (true) {
+    if (idx == block.size) {
+      if (block.next == -1) {
+        return true;
+      }
+      if (!readBlockCoupled(latch, version, block.next, block)) return false;
+      idx = 0;
+      continue;
+    }
+    if (hi < block.data[idx].key) {
+      return true;
+    }
+    result.push_back(block.data[idx]);
+    idx++;
+  }
+}
+
+template <class Key, class Value, class Storage>
+long long BPT<Key, Value, Storage>::count(const Key &key) {
+  return count(key, key);
+}
+
+template <class Key, class Value, class Storage>
+long long BPT<Key, Value, Storage>::count(const Key &lo, const Key &hi) {
+  if (hi < lo) {
+    return 0;
+  }
+  flush_write_buffer();
+  long long result;
+  while (!tryCount(lo, hi, result)) {
+  }
+  return result;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryCount(const Key &lo, const Key &hi,
+                               long long &result) {
+  result = 0;
+  if (counted_) {
+    // every counted write latches the root page, so if it has not moved
+    // the two ranks describe the same tree
+    uint64_t root_version = root_latch_.read_version();
+    int root = root_;
+    int height = height_;
+    if (!root_latch_.validate(root_version)) {
+      return false;
+    }
+    if (root == -1) {
+      return true;
+    }
+    sjtu::OptimisticLatch &page =
+        height == 0 ? block_latches_[root] : index_latches_[root];
+    uint64_t page_version = page.read_version();
+    long long below, upto;
+    if (!tryRank(lo, false, below) || !tryRank(hi, true, upto)) {
+      return false;
+    }
+    if (!page.validate(page_version) || !root_latch_.validate(root_version)) {
+      return false;
+    }
+    result = upto - below;
+    return true;
+  }
+  // walk the leaves from lo like find does
+  sjtu::OptimisticLatch *latch = &root_latch_;
+  uint64_t version = root_latch_.read_version();
+  int ptr = root_;
+  int height = height_;
+  if (!root_latch_.validate(version)) {
+    return false;
+  }
+  if (ptr == -1) {
+    return true;
+  }
+  for (int level = 1; level <= height; ++level) {
+    Index<Key, Value> index;
+    sjtu::metrics::set_level(level);
+    if (!readIndexCoupled(latch, version, ptr, index)) return false;
+    int idx = binarySearch(index.keys, lo, 0, index.size - 1);
+    ptr = index.children[idx];
+  }
+  Block<Key, Value> block;
+  if (!readBlockCoupled(latch, version, ptr, block)) return false;
+  int idx = block.size == 0 ? 0 : binarySearch(block.data, lo, 0, block.size - 1);
+  while (true) {
+    if (idx == block.size) {
+      if (block.next == -1) {
+        return true;
+      }
+      if (!readBlockCoupled(latch, version, block.next, block)) return false;
+      idx = 0;
+      continue;
+    }
+    if (hi < block.data[idx].key) {
+      return true;
+    }
+    result++;
+    idx++;
+  }
+}
+
+template <class Key, class Value, class Storage>
+long long BPT<Key, Value, Storage>::rank(const Key &key) {
+  flush_write_buffer();
+  long long result;
+  while (!tryRank(key, false, result)) {
+  }
+  return result;
+}
+
+template <class Key, class Value, class Storage>
+Key_Value<Key, Value> BPT<Key, Value, Storage>::select(long long i) {
+  flush_write_buffer();
+  Key_Value<Key, Value> kv;
+  bool found;
+  while (!trySelect(i, kv, found)) {
+  }
+  if (!found) {
+    throw sjtu::index_out_of_bound();
+  }
+  return kv;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::tryRank(const Key &key, bool inclusive,
+                              long long &rank) {
+  rank = 0;
+  sjtu::OptimisticLatch *latch = &root_latch_;
+  uint64_t version = root_latch_.read_version();
+  int ptr = root_;
+  int height = height_;
+  if (!root_latch_.validate(version)) {
+    return false;
+  }
+  if (ptr == -1) {
+    return true;
+  }
+  for (int level = 1; level <= height; ++level) {
+    Index<Key, Value> index;
+    sjtu::metrics::set_level(level);
+    if (!readIndexCoupled(latch, version, ptr, index)) return false;
+    // without counts, start from the leftmost leaf and count every pair
+    int idx = 0;
+    if (counted_) {
+      idx = inclusive
+                ? binarySearchForBigger(index.keys, key, 0, index.size - 1)
+                : binarySearch(index.keys, key, 0, index.size - 1);
+      for (int i = 0; i < idx; ++i) {
+        rank += index.counts[i];
+      }
+    }
+    ptr = index.children[idx];
+  }
+  Block<Key, Value> block;
+  if (!readBlockCoupled(latch, version, ptr, block)) return false;
+  while (true) {
+    int below = 0;
+    if (block.size > 0) {
+      below = inclusive
+                  ? binarySearchForBigger(block.data, key, 0, block.size - 1)
+                  : binarySearch(block.data, key, 0, block.size - 1);
+    }
+    rank += below;
+    // in a counted tree the later leaves only hold bigger keys
+    if (counted_ || below < block.size || block.next == -1) {
+      return true;
+    }
+    if (!readBlockCoupled(latch, version, block.next, block)) return false;
+  }
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::trySelect(long long i, Key_Value<Key, Value> &kv,
+                                bool &found) {
+  found = false;
+  if (i < 0) {
+    return true;
+  }
+  sjtu::OptimisticLatch *latch = &root_latch_;
+  uint64_t version = root_latch_.read_version();
+  int ptr = root_;
+  int height = height_;
+  if (!root_latch_.validate(version)) {
+    return false;
+  }
+  if (ptr == -1) {
+    return true;
+  }
+  for (int level = 1; level <= height; ++level) {
+    Index<Key, Value> index;
+    sjtu::metrics::set_level(level);
+    if (!readIndexCoupled(latch, version, ptr, index)) return false;
+    int idx = 0;
+    if (counted_) {
+      while (idx < index.size && i >= index.counts[idx]) {
+        i -= index.counts[idx];
+        idx++;
+      }
+    }
+    ptr = index.children[idx];
+  }
+  Block<Key, Value> block;
+  if (!readBlockCoupled(latch, version, ptr, block)) return false;
+  while (i >= block.size) {
+    i -= block.size;
+    if (block.next == -1) {
+      return true;
+    }
+    if (!readBlockCoupled(latch, version, block.next, block)) return false;
+  }
+  kv = block.data[i];
+  found = true;
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+typename BPT<Key, Value, Storage>::Snapshot BPT<Key, Value, Storage>::snapshot() {
+  flush_write_buffer();
+  std::unique_lock<std::shared_mutex> gate(snapshot_gate_);
+  uint64_t epoch = cache_manager_.begin_snapshot();
+  return Snapshot(this, epoch, root_, height_);
+}
+
+template <class Key, class Value, class Storage>
+BPT<Key, Value, Storage>::Snapshot::Snapshot(BPT *tree, uint64_t epoch, int root,
+                                    int height)
+    : tree_(tree), epoch_(epoch), root_(root), height_(height) {}
+
+template <class Key, class Value, class Storage>
+BPT<Key, Value, Storage>::Snapshot::Snapshot(Snapshot &&other) noexcept
+    : tree_(other.tree_),
+      epoch_(other.epoch_),
+      root_(other.root_),
+      height_(other.height_) {
+  other.tree_ = nullptr;
+}
+
+template <class Key, class Value, class Storage>
+BPT<Key, Value, Storage>::Snapshot::~Snapshot() {
+  if (tree_ != nullptr) {
+    tree_->cache_manager_.end_snapshot(epoch_);
+  }
+}
+
+template <class Key, class Value, class Storage>
+sjtu::vector<Value> BPT<Key, Value, Storage>::Snapshot::find(const Key &key) const {
+  return tree_->findAt(key, epoch_, root_, height_);
+}
+
+template <class Key, class Value, class Storage>
+sjtu::vector<Value> BPT<Key, Value, Storage>::findAt(const Key &key, uint64_t epoch,
+                                            int root, int height) {
+  sjtu::vector<Value> result;
+  int ptr = root;
+  if (ptr == -1) {
     return result;
   }
+  for (int level = 1; level <= height; ++level) {
+    Index<Key, Value> index;
+    cache_manager_.read_index_at(index, ptr, epoch);
+    int idx = binarySearch(index.keys, key, 0, index.size - 1);
+    ptr = index.children[idx];
+  }
+
+  Block<Key, Value> block;
+  cache_manager_.read_block_at(block, ptr, epoch);
+  int idx = block.size == 0 ? 0 : binarySearch(block.data, key, 0, block.size - 1);
   while (true) {
     if (idx == block.size) {
       ptr = block.next;
       if (ptr == -1) {
         return result;
       }
-      //block_file_.read(block, ptr);
-      cache_manager_.read_block(block, ptr);
+      cache_manager_.read_block_at(block, ptr, epoch);
       idx = 0;
+      continue;
     }
     if (block.data[idx].key > key) {
       return result;
@@ -116,31 +1426,164 @@ sjtu::vector<Value> BPT<Key, Value>::find(const Key &key) {
   }
 }
 
-template <class Key, class Value>
-int BPT<Key, Value>::findLeafNode(const Key_Value<Key, Value> &key,
-                                  sjtu::vector<pathFrame<Key, Value>> &path) {
-  int ptr = root_;
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::readIndexCoupled(sjtu::OptimisticLatch *&latch,
+                                       uint64_t &version, int addr,
+                                       Index<Key, Value> &index) {
+  sjtu::OptimisticLatch &node_latch = index_latches_[addr];
+  uint64_t node_version = node_latch.read_version();
+  if (!latch->validate(version)) {
+    return false;
+  }
+  cache_manager_.read_index(index, addr);
+  if (!node_latch.validate(node_version)) {
+    return false;
+  }
+  latch = &node_latch;
+  version = node_version;
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::readBlockCoupled(sjtu::OptimisticLatch *&latch,
+                                       uint64_t &version, int addr,
+                                       Block<Key, Value> &block) {
+  sjtu::OptimisticLatch &node_latch = block_latches_[addr];
+  uint64_t node_version = node_latch.read_version();
+  if (!latch->validate(version)) {
+    return false;
+  }
+  cache_manager_.read_block(block, addr);
+  if (!node_latch.validate(node_version)) {
+    return false;
+  }
+  latch = &node_latch;
+  version = node_version;
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+int BPT<Key, Value, Storage>::findLeafNode(const Key_Value<Key, Value> &key,
+                                  sjtu::vector<pathFrame<Key, Value>> &path,
+                                  sjtu::vector<uint64_t> &versions,
+                                  bool leftmost) {
   path.clear();
+  versions.clear();
+  sjtu::OptimisticLatch *latch = &root_latch_;
+  uint64_t version = root_latch_.read_version();
+  int ptr = root_;
+  int height = height_;
+  if (!root_latch_.validate(version)) {
+    return -2;
+  }
+  versions.push_back(version);
   if (ptr == -1) {
     return -1;
   }
-  for (int level = 1; level <= height_; level++) {
+  for (int level = 1; level <= height; level++) {
     Index<Key, Value> node;
     // index_file_.read(node, ptr);
-    cache_manager_.read_index(node, ptr);
-    int idx =
-        (node.size == 0) ? 0 : binarySearchForBigOrEqual(node.keys, key, 0, node.size - 1);
+    sjtu::metrics::set_level(level);
+    if (!readIndexCoupled(latch, version, ptr, node)) {
+      return -2;
+    }
+    int idx = node.size == 0 ? 0
+              : leftmost
+                  ? binarySearchForNotLess(node.keys, key, 0, node.size - 1)
+                  : binarySearchForBigOrEqual(node.keys, key, 0, node.size - 1);
     path.push_back({node, ptr, idx});
+    versions.push_back(version);
     ptr = node.children[idx];
   }
+  versions.push_back(block_latches_[ptr].read_version());
+  if (!latch->validate(version)) {
+    return -2;
+  }
   return ptr;
 }
 
-template <class Key, class Value>
-bool BPT<Key, Value>::insertIntoLeaf(int leaf_addr, const Key &key,
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::lockPath(sjtu::LatchGuard &guard,
+                               const sjtu::vector<pathFrame<Key, Value>> &path,
+                               const sjtu::vector<uint64_t> &versions,
+                               int leaf_addr, int top) {
+  if (top < 0 && !guard.upgrade(root_latch_, versions[0])) {
+    return false;
+  }
+  for (int level = top < 0 ? 0 : top; level < (int)path.size(); ++level) {
+    if (!guard.upgrade(index_latches_[path[level].index_addr],
+                       versions[level + 1])) {
+      return false;
+    }
+  }
+  return guard.upgrade(block_latches_[leaf_addr], versions[path.size() + 1]);
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::lockSiblings(sjtu::LatchGuard &guard,
+                                   const pathFrame<Key, Value> &frame,
+                                   bool leaf_children) {
+  sjtu::LatchTable<> &latches = leaf_children ? block_latches_ : index_latches_;
+  if (frame.pos >= 1 &&
+      !guard.lock(latches[frame.index.children[frame.pos - 1]])) {
+    return false;
+  }
+  if (frame.pos + 1 <= (int)frame.index.size &&
+      !guard.lock(latches[frame.index.children[frame.pos + 1]])) {
+    return false;
+  }
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::lockForRebalance(
+    sjtu::LatchGuard &guard, const sjtu::vector<pathFrame<Key, Value>> &path,
+    const sjtu::vector<uint64_t> &versions, int leaf_addr, bool leaf_empties) {
+  if (path.empty()) {
+    // a root leaf only changes root_ when it runs empty
+    return lockPath(guard, path, versions, leaf_addr, leaf_empties ? -1 : 0);
+  }
+  int top = path.size() - 1;
+  while (true) {
+    const Index<Key, Value> &node = path[top].index;
+    if (top == 0) {
+      if (node.size == 1) top = -1;
+      break;
+    }
+    if (node.size - 1 >= ORDER / 3) break;
+    top--;
+  }
+  if (counted_ && top > 0) {
+    top = 0;
+  }
+  if (!lockPath(guard, path, versions, leaf_addr, top)) {
+    return false;
+  }
+  if (!lockSiblings(guard, path.back(), true)) {
+    return false;
+  }
+  for (int level = path.size() - 1; level > top && level > 0; --level) {
+    if (!lockSiblings(guard, path[level - 1], false)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::adjustCounts(sjtu::vector<pathFrame<Key, Value>> &path,
+                                   int delta) {
+  for (size_t level = 0; level < path.size(); ++level) {
+    path[level].index.counts[path[level].pos] += delta;
+    cache_manager_.update_index(path[level].index, path[level].index_addr);
+  }
+}
+
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::insertIntoLeaf(int leaf_addr, const Key &key,
                                      const Value &value,
                                      Key_Value<Key, Value> &split_key,
-                                     int &new_leaf_addr) {
+                                     int &new_leaf_addr, int &new_leaf_size) {
   Block<Key, Value> leaf;
   //block_file_.read(leaf, leaf_addr);
   cache_manager_.read_block(leaf, leaf_addr);
@@ -157,16 +1600,35 @@ bool BPT<Key, Value>::insertIntoLeaf(int leaf_addr, const Key &key,
   cache_manager_.update_block(leaf, leaf_addr);
   
   if (leaf.size == DEFAULT_LEAF_SIZE + 1) {
-    return splitLeaf(leaf, leaf_addr, split_key, new_leaf_addr);
+    bool append = leaf.next == -1 && pos == leaf.size - 1;
+    return splitLeaf(leaf, leaf_addr, split_key, new_leaf_addr, new_leaf_size,
+                     append);
   }
   return false;
 }
 
-template <class Key, class Value>
-bool BPT<Key, Value>::splitLeaf(Block<Key, Value> &leaf, int leaf_addr,
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::splitLeaf(Block<Key, Value> &leaf, int leaf_addr,
                                 Key_Value<Key, Value> &split_key,
-                                int &new_leaf_addr) {
-  int mid = (DEFAULT_LEAF_SIZE + 1) / 2;
+                                int &new_leaf_addr, int &new_leaf_size,
+                                bool append) {
+  int mid = append ? DEFAULT_LEAF_SIZE * APPEND_SPLIT_TENTHS / 10
+                   : (DEFAULT_LEAF_SIZE + 1) / 2;
+  if (!append) {
+    // prefer a split between two different keys near the middle, so the
+    // separator is a plain key boundary and a find for it reads one leaf
+    int slack = (DEFAULT_LEAF_SIZE + 1) / 8;
+    for (int d = 0; d <= slack; ++d) {
+      if (leaf.data[mid - d - 1].key != leaf.data[mid - d].key) {
+        mid -= d;
+        break;
+      }
+      if (leaf.data[mid + d - 1].key != leaf.data[mid + d].key) {
+        mid += d;
+        break;
+      }
+    }
+  }
   Block<Key, Value> new_leaf;
   new_leaf.size = DEFAULT_LEAF_SIZE + 1 - mid;
   for (int i = 0; i < new_leaf.size; ++i) {
@@ -175,24 +1637,30 @@ bool BPT<Key, Value>::splitLeaf(Block<Key, Value> &leaf, int leaf_addr,
   leaf.size = mid;
   new_leaf.next = leaf.next;
   split_key = new_leaf.data[0];
+  new_leaf_size = new_leaf.size;
   //new_leaf_addr = block_file_.write(new_leaf);
   new_leaf_addr = cache_manager_.write_block(new_leaf);
+  stats_.splits++;
+  sjtu::metrics::count(sjtu::metrics::SPLITS);
   leaf.next = new_leaf_addr;
   //block_file_.update(leaf, leaf_addr);
   cache_manager_.update_block(leaf, leaf_addr);
   return true;
 }
 
-template <class Key, class Value>
-bool BPT<Key, Value>::insertIntoParent(
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::insertIntoParent(
     const sjtu::vector<pathFrame<Key, Value>> &path, int level,
-    const Key_Value<Key, Value> &key, int right_child) {
+    const Key_Value<Key, Value> &key, int right_child, int left_count,
+    int right_count) {
   if (level < 0) {
     Index<Key, Value> new_root;
     new_root.size = 1;
     new_root.keys[0] = key;
-    new_root.children[0] = path.empty() ? root_ : path[0].index_addr;
+    new_root.children[0] = path.empty() ? root_.load() : path[0].index_addr;
     new_root.children[1] = right_child;
+    new_root.counts[0] = left_count;
+    new_root.counts[1] = right_count;
     //root_ = index_file_.write(new_root);
     root_ = cache_manager_.write_index(new_root);
     //index_file_.write_info(root_, 1);
@@ -205,49 +1673,70 @@ bool BPT<Key, Value>::insertIntoParent(
   for (int i = parent.size; i > child_idx; --i) {
     parent.keys[i] = parent.keys[i - 1];
     parent.children[i + 1] = parent.children[i];
+    parent.counts[i + 1] = parent.counts[i];
   }
   parent.keys[child_idx] = key;
   parent.children[child_idx + 1] = right_child;
+  parent.counts[child_idx] = left_count;
+  parent.counts[child_idx + 1] = right_count;
   parent.size++;
-  if (parent.size < DEFAULT_ORDER) {
+  if (parent.size < ORDER) {
     //index_file_.update(parent, parent_addr);
     cache_manager_.update_index(parent, parent_addr);
     return false;
   }
 
+  int total = 0, kept = 0;
+  for (int i = 0; i <= parent.size; ++i) {
+    total += parent.counts[i];
+  }
+  // the new child was appended to the rightmost node of its level
+  bool append = child_idx == (int)parent.size - 1;
+  for (int i = 0; i < level && append; ++i) {
+    append = path[i].pos == (int)path[i].index.size;
+  }
   Key_Value<Key, Value> new_split_key;
   int new_index_addr;
-  bool result =
-      splitInternal(parent, parent_addr, new_split_key, new_index_addr);
+  bool result = splitInternal(parent, parent_addr, new_split_key,
+                              new_index_addr, append);
   if (result) {
-    return insertIntoParent(path, level - 1, new_split_key, new_index_addr);
+    for (int i = 0; i <= parent.size; ++i) {
+      kept += parent.counts[i];
+    }
+    return insertIntoParent(path, level - 1, new_split_key, new_index_addr,
+                            kept, total - kept);
   }
   return false;
 }
 
-template <class Key, class Value>
-bool BPT<Key, Value>::splitInternal(Index<Key, Value> &node, int node_addr,
+template <class Key, class Value, class Storage>
+bool BPT<Key, Value, Storage>::splitInternal(Index<Key, Value> &node, int node_addr,
                                     Key_Value<Key, Value> &split_key,
-                                    int &new_node_addr) {
+                                    int &new_node_addr, bool append) {
   Index<Key, Value> new_node;
-  int split_pos = DEFAULT_ORDER / 2;
-  new_node.size = DEFAULT_ORDER - split_pos - 1;
+  int split_pos = append ? ORDER * APPEND_SPLIT_TENTHS / 10
+                         : ORDER / 2;
+  new_node.size = ORDER - split_pos - 1;
   for (int i = 0; i < new_node.size; ++i) {
     new_node.keys[i] = node.keys[i + split_pos + 1];
     new_node.children[i] = node.children[i + split_pos + 1];
+    new_node.counts[i] = node.counts[i + split_pos + 1];
   }
-  new_node.children[new_node.size] = node.children[DEFAULT_ORDER];
+  new_node.children[new_node.size] = node.children[ORDER];
+  new_node.counts[new_node.size] = node.counts[ORDER];
   split_key = node.keys[split_pos];
   node.size = split_pos;
   //index_file_.update(node, node_addr);
   //new_node_addr = index_file_.write(new_node);
   cache_manager_.update_index(node, node_addr);
   new_node_addr = cache_manager_.write_index(new_node);
+  stats_.splits++;
+  sjtu::metrics::count(sjtu::metrics::SPLITS);
   return true;
 }
 
-template <class Key, class Value>
-void BPT<Key, Value>::balanceAfterRemove(
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::balanceAfterRemove(
     Block<Key, Value> &node, int node_addr,
     sjtu::vector<pathFrame<Key, Value>> &path) {
   if (path.empty()) {
@@ -279,12 +1768,16 @@ void BPT<Key, Value>::balanceAfterRemove(
       node.size++;
       left_sibling.size--;
       parent.keys[child_idx - 1] = node.data[0];
+      parent.counts[child_idx - 1]--;
+      parent.counts[child_idx]++;
       //block_file_.update(node, node_addr);
       //block_file_.update(left_sibling, left_sibling_addr);
       //index_file_.update(parent, parent_addr);
       cache_manager_.update_block(node, node_addr);
       cache_manager_.update_block(left_sibling, left_sibling_addr);
       cache_manager_.update_index(parent, parent_addr);
+      stats_.borrows++;
+      sjtu::metrics::count(sjtu::metrics::BORROWS);
       return;
     }
   }
@@ -302,12 +1795,16 @@ void BPT<Key, Value>::balanceAfterRemove(
       node.size++;
       right_sibling.size--;
       parent.keys[child_idx] = right_sibling.data[0];
+      parent.counts[child_idx]++;
+      parent.counts[child_idx + 1]--;
       //block_file_.update(node, node_addr);
       //block_file_.update(right_sibling, right_sibling_addr);
       //index_file_.update(parent, parent_addr);
       cache_manager_.update_block(node, node_addr);
       cache_manager_.update_block(right_sibling, right_sibling_addr);
       cache_manager_.update_index(parent, parent_addr);
+      stats_.borrows++;
+      sjtu::metrics::count(sjtu::metrics::BORROWS);
       return;
     }
   }
@@ -318,8 +1815,11 @@ void BPT<Key, Value>::balanceAfterRemove(
     }
     left_sibling.size += node.size;
     left_sibling.next = node.next;
+    parent.counts[child_idx - 1] += parent.counts[child_idx];
     //block_file_.update(left_sibling, left_sibling_addr);
     cache_manager_.update_block(left_sibling, left_sibling_addr);
+    stats_.merges++;
+    sjtu::metrics::count(sjtu::metrics::MERGES);
     removeFromParent(parent, parent_addr, child_idx - 1, path);
   } else if (child_idx <= parent.size - 1) {
     for (int i = 0; i < right_sibling.size; ++i) {
@@ -327,14 +1827,17 @@ void BPT<Key, Value>::balanceAfterRemove(
     }
     node.size += right_sibling.size;
     node.next = right_sibling.next;
+    parent.counts[child_idx] += parent.counts[child_idx + 1];
     //block_file_.update(node, node_addr);
     cache_manager_.update_block(node, node_addr);
+    stats_.merges++;
+    sjtu::metrics::count(sjtu::metrics::MERGES);
     removeFromParent(parent, parent_addr, child_idx, path);
   }
 }
 
-template <class Key, class Value>
-void BPT<Key, Value>::removeFromParent(
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::removeFromParent(
     Index<Key, Value> &parent, int parent_addr, int key_idx,
     sjtu::vector<pathFrame<Key, Value>> &path) {
   for (int i = key_idx; i < parent.size - 1; ++i) {
@@ -342,6 +1845,7 @@ void BPT<Key, Value>::removeFromParent(
   }
   for (int i = key_idx + 1; i < parent.size; ++i) {
     parent.children[i] = parent.children[i + 1];
+    parent.counts[i] = parent.counts[i + 1];
   }
   parent.size--;
   if (path.empty() && parent.size == 0) {
@@ -351,7 +1855,7 @@ void BPT<Key, Value>::removeFromParent(
     //index_file_.write_info(height_ , 2);
     return;
   }
-  if (path.empty() || parent.size >= DEFAULT_ORDER / 3) {
+  if (path.empty() || parent.size >= ORDER / 3) {
     //index_file_.update(parent, parent_addr);
     cache_manager_.update_index(parent, parent_addr);
     return;
@@ -359,8 +1863,8 @@ void BPT<Key, Value>::removeFromParent(
   balanceInternalNode(parent, parent_addr, path);
 }
 
-template <class Key, class Value>
-void BPT<Key, Value>::balanceInternalNode(
+template <class Key, class Value, class Storage>
+void BPT<Key, Value, Storage>::balanceInternalNode(
     Index<Key, Value> &node, int node_addr,
     sjtu::vector<pathFrame<Key, Value>> &path) {
   auto [parent, parent_addr, node_idx] = path.back();
@@ -372,15 +1876,20 @@ void BPT<Key, Value>::balanceInternalNode(
     //index_file_.read(left_sibling, left_sibling_addr);
     cache_manager_.read_index(left_sibling, left_sibling_addr);
 
-    if (left_sibling.size > DEFAULT_ORDER / 2) {
+    if (left_sibling.size > ORDER / 2) {
       for (int i = node.size; i > 0; --i) {
         node.keys[i] = node.keys[i - 1];
       }
       for (int i = node.size + 1; i > 0; --i) {
         node.children[i] = node.children[i - 1];
+        node.counts[i] = node.counts[i - 1];
       }
+      int moved = left_sibling.counts[left_sibling.size];
       node.keys[0] = parent.keys[node_idx - 1];
       node.children[0] = left_sibling.children[left_sibling.size];
+      node.counts[0] = moved;
+      parent.counts[node_idx - 1] -= moved;
+      parent.counts[node_idx] += moved;
       parent.keys[node_idx - 1] = left_sibling.keys[left_sibling.size - 1];
       node.size++;
       left_sibling.size--;
@@ -390,6 +1899,8 @@ void BPT<Key, Value>::balanceInternalNode(
       cache_manager_.update_index(node, node_addr);
       cache_manager_.update_index(left_sibling, left_sibling_addr);
       cache_manager_.update_index(parent, parent_addr);
+      stats_.borrows++;
+      sjtu::metrics::count(sjtu::metrics::BORROWS);
       return;
     }
   }
@@ -401,16 +1912,21 @@ void BPT<Key, Value>::balanceInternalNode(
     //index_file_.read(right_sibling, right_sibling_addr);
     cache_manager_.read_index(right_sibling, right_sibling_addr);
 
-    if (right_sibling.size > DEFAULT_ORDER / 2) {
+    if (right_sibling.size > ORDER / 2) {
+      int moved = right_sibling.counts[0];
       node.keys[node.size] = parent.keys[node_idx];
       node.children[node.size + 1] = right_sibling.children[0];
+      node.counts[node.size + 1] = moved;
       parent.keys[node_idx] = right_sibling.keys[0];
+      parent.counts[node_idx] += moved;
+      parent.counts[node_idx + 1] -= moved;
       node.size++;
       for (int i = 0; i < right_sibling.size - 1; ++i) {
         right_sibling.keys[i] = right_sibling.keys[i + 1];
       }
       for (int i = 0; i < right_sibling.size; ++i) {
         right_sibling.children[i] = right_sibling.children[i + 1];
+        right_sibling.counts[i] = right_sibling.counts[i + 1];
       }
       right_sibling.size--;
       //index_file_.update(node, node_addr);
@@ -419,6 +1935,8 @@ void BPT<Key, Value>::balanceInternalNode(
       cache_manager_.update_index(node, node_addr);
       cache_manager_.update_index(right_sibling, right_sibling_addr);
       cache_manager_.update_index(parent, parent_addr);
+      stats_.borrows++;
+      sjtu::metrics::count(sjtu::metrics::BORROWS);
       return;
     }
   }
@@ -430,10 +1948,14 @@ void BPT<Key, Value>::balanceInternalNode(
     }
     for (int i = 0; i <= node.size; ++i) {
       left_sibling.children[left_sibling.size + 1 + i] = node.children[i];
+      left_sibling.counts[left_sibling.size + 1 + i] = node.counts[i];
     }
     left_sibling.size += node.size + 1;
+    parent.counts[node_idx - 1] += parent.counts[node_idx];
     //index_file_.update(left_sibling, left_sibling_addr);
     cache_manager_.update_index(left_sibling, left_sibling_addr);
+    stats_.merges++;
+    sjtu::metrics::count(sjtu::metrics::MERGES);
     removeFromParent(parent, parent_addr, node_idx - 1, path);
   } else if (node_idx <= parent.size - 1) {
     node.keys[node.size] = parent.keys[node_idx];
@@ -442,12 +1964,20 @@ void BPT<Key, Value>::balanceInternalNode(
     }
     for (int i = 0; i <= right_sibling.size; ++i) {
       node.children[node.size + 1 + i] = right_sibling.children[i];
+      node.counts[node.size + 1 + i] = right_sibling.counts[i];
     }
     node.size += right_sibling.size + 1;
+    parent.counts[node_idx] += parent.counts[node_idx + 1];
     //index_file_.update(node, node_addr);
     cache_manager_.update_index(node, node_addr);
+    stats_.merges++;
+    sjtu::metrics::count(sjtu::metrics::MERGES);
     removeFromParent(parent, parent_addr, node_idx , path);
   }
 }
 
-template class BPT<int, int>;
\ No newline at end of file
+template class BPT<int, int>;
+template class BPT<long long, int>;
+template class BPT<long long, int, MemoryStorage<long long, int>>;
+template class BPT<long long, int, CountingStorage<FileStorage<long long, int>>>;
+template class BPT<long long, int, DelayedStorage<FileStorage<long long, int>>>;
@@ -1,11 +1,33 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
 #include <string>
+#include <utility>
 
-#include "MemoryRiver.hpp"
+#include "async.hpp"
+#include "bloom.hpp"
 #include "cache.hpp"
+#include "latch.hpp"
+#include "metrics.hpp"
+#include "storage.hpp"
 #include "vector.hpp"
 #include "IndexBlock.hpp"
 
+// in relaxed balance mode, underfull leaves are fixed in batches this big
+constexpr size_t REBALANCE_BATCH = 128;
+// share of the keys the left half keeps when the rightmost node splits on
+// an append, in tenths; sequential loads then leave nodes nearly full
+constexpr size_t APPEND_SPLIT_TENTHS = 9;
+// buffered writes are first appended unsorted, then merged into the sorted
+// run once this many, and at least 1/16 of the run, have piled up
+constexpr size_t WRITE_BUFFER_TAIL = 256;
+// the Bloom filter is sized for at least this many keys
+constexpr size_t BLOOM_MIN_KEYS = 1024;
+
 template <class Key, class Value>
 struct pathFrame {
   Index<Key, Value> index;
@@ -13,6 +35,46 @@ struct pathFrame {
   int pos;
 };
 
+// key range of the leaf a path leads to: pairs p with low <= p < high are
+// routed there (a missing bound is unbounded)
+template <class Key, class Value>
+struct leafFence {
+  bool has_low = false;
+  bool has_high = false;
+  Key_Value<Key, Value> low;
+  Key_Value<Key, Value> high;
+
+  bool contains(const Key_Value<Key, Value> &kv) const {
+    return (!has_low || !(kv < low)) && (!has_high || kv < high);
+  }
+};
+
+template <class Key, class Value>
+leafFence<Key, Value> fenceOf(const sjtu::vector<pathFrame<Key, Value>> &path) {
+  leafFence<Key, Value> fence;
+  for (int level = path.size() - 1; level >= 0; --level) {
+    const pathFrame<Key, Value> &frame = path[level];
+    if (!fence.has_low && frame.pos > 0) {
+      fence.low = frame.index.keys[frame.pos - 1];
+      fence.has_low = true;
+    }
+    if (!fence.has_high && frame.pos < (int)frame.index.size) {
+      fence.high = frame.index.keys[frame.pos];
+      fence.has_high = true;
+    }
+  }
+  return fence;
+}
+
+// whether copies of kv may also sit in leaves before the one path leads to
+// (kv is the separator in front of it)
+template <class Key, class Value>
+bool mayPrecede(const sjtu::vector<pathFrame<Key, Value>> &path,
+                const Key_Value<Key, Value> &kv) {
+  leafFence<Key, Value> fence = fenceOf(path);
+  return fence.has_low && fence.low == kv;
+}
+
 template <class Key, class Value>
 int binarySearch(Key_Value<Key, Value> *array, const Key &key, int left,
                  int right) {
@@ -48,6 +110,98 @@ int binarySearch(Key *array, const Key &key, int left, int right) {
   return l;
 }
 
+// first position whose key is greater than key
+template <class Key, class Value>
+int binarySearchForBigger(Key_Value<Key, Value> *array, const Key &key,
+                          int left, int right) {
+  if (key < array[left].key) return left;
+  if (!(key < array[right].key)) return right + 1;
+
+  int l = left, r = right;
+  while (l < r) {
+    int mid = l + (r - l) / 2;
+    if (key < array[mid].key) {
+      r = mid;
+    } else {
+      l = mid + 1;
+    }
+  }
+  return l;
+}
+
+// the same three searches over index separators
+template <class Key, class Value, size_t N>
+int binarySearch(const Separators<Key, Value, N> &array, const Key &key,
+                 int left, int right) {
+  if (key <= array.key_[left]) return left;
+  if (key > array.key_[right]) return right + 1;
+
+  int l = left, r = right;
+  while (l < r) {
+    int mid = l + (r - l) / 2;
+    if (array.key_[mid] < key) {
+      l = mid + 1;
+    } else {
+      r = mid;
+    }
+  }
+  return l;
+}
+
+template <class Key, class Value, size_t N>
+int binarySearchForBigger(const Separators<Key, Value, N> &array,
+                          const Key &key, int left, int right) {
+  if (key < array.key_[left]) return left;
+  if (!(key < array.key_[right])) return right + 1;
+
+  int l = left, r = right;
+  while (l < r) {
+    int mid = l + (r - l) / 2;
+    if (key < array.key_[mid]) {
+      r = mid;
+    } else {
+      l = mid + 1;
+    }
+  }
+  return l;
+}
+
+// first separator greater than kv
+template <class Key, class Value, size_t N>
+int binarySearchForBigOrEqual(const Separators<Key, Value, N> &array,
+                              const Key_Value<Key, Value> &kv, int left,
+                              int right) {
+  int l = left, r = right + 1;
+  while (l < r) {
+    int mid = l + (r - l) / 2;
+    if (kv < array[mid]) {
+      r = mid;
+    } else {
+      l = mid + 1;
+    }
+  }
+  return l;
+}
+
+// first separator not less than kv. A run of equal pairs can be split
+// across leaves, so pairs equal to a separator may also end the leaf to its
+// left: this routes to the leftmost leaf that can hold kv
+template <class Key, class Value, size_t N>
+int binarySearchForNotLess(const Separators<Key, Value, N> &array,
+                           const Key_Value<Key, Value> &kv, int left,
+                           int right) {
+  int l = left, r = right + 1;
+  while (l < r) {
+    int mid = l + (r - l) / 2;
+    if (array[mid] < kv) {
+      l = mid + 1;
+    } else {
+      r = mid;
+    }
+  }
+  return l;
+}
+
 template <class Key>
 int binarySearchForBigOrEqual(Key *array, const Key &key, int left, int right) {
   if (key < array[left]) return left;
@@ -67,14 +221,38 @@ int binarySearchForBigOrEqual(Key *array, const Key &key, int left, int right) {
   return l;
 }
 
-template <class Key, class Value>
+// Thread-safe: find descends with optimistic lock coupling and never writes
+// to shared state except the cache, writers descend the same way and then
+// latch only the nodes they are going to modify.
+// A counted tree (counted = true when the files are created) also keeps
+// subtree sizes in the index pages, so count/rank/select cost O(height)
+// pages, at the price of writers latching their whole path.
+// Storage picks where pages live, see storage.hpp.
+// Opening files written in another page layout (see PAGE_FORMAT_VERSION)
+// throws sjtu::runtime_error. key_tag is recorded in the files when they
+// are created, for the caller to say how its keys were made (bpt_main
+// stores the HashKind); key_tag() returns it when they are opened again.
+template <class Key, class Value, class Storage = FileStorage<Key, Value>>
 class BPT {
  public:
-  BPT(const std::string &filename = "database")
+  // index fanout, see index_order
+  static constexpr size_t ORDER = Index<Key, Value>::ORDER;
+
+  BPT(const std::string &filename = "database", bool counted = false,
+      int key_tag = 0)
       : filename_(filename),
-        index_file_(filename + ".index"),
-        block_file_(filename + ".block"),
-        cache_manager_(index_file_, block_file_) {
+        storage_(filename),
+        index_file_(storage_.index),
+        block_file_(storage_.block),
+        cache_manager_(storage_),
+        relaxed_balance_(false),
+        buffer_capacity_(0),
+        buffer_seq_(0),
+        bloom_bits_(0),
+        bloom_capacity_(0),
+        bloom_keys_(0),
+        bloom_adds_(0),
+        bloom_removes_(0) {
     if (!index_file_.exist()) {
       index_file_.initialise();
       block_file_.initialise();
@@ -82,50 +260,380 @@ class BPT {
       // block_file_.write_info(-1, 1);
       // index_file_.write_info(0, 2);
       // block_file_.write_info(0, 2);
+      block_file_.write_info(page_format_word(key_tag), 1);
+      block_file_.write_info(counted, 2);
+      // a manifest left by an earlier tree of this name lists its pages
+      if constexpr (Storage::cached) std::remove(hotPagesFile().c_str());
       root_ = -1;
       height_ = 0;
+      counted_ = counted;
+      key_tag_ = key_tag;
     } else {
-      index_file_.get_info(root_, 1);
-      index_file_.get_info(height_, 2);
+      int root, height, format, flag;
+      block_file_.get_info(format, 1);
+      if (page_format_version(format) != PAGE_FORMAT_VERSION) {
+        throw sjtu::runtime_error();
+      }
+      key_tag_ = page_format_key_tag(format);
+      index_file_.get_info(root, 1);
+      index_file_.get_info(height, 2);
+      block_file_.get_info(flag, 2);
+      root_ = root;
+      height_ = height;
+      counted_ = flag;
     }
   }
   ~BPT(){
+    cache_manager_.stop_warm_up();
+    flush_write_buffer();
+    consolidate();
     cache_manager_.flush_cache();
     index_file_.write_info(root_, 1);
     index_file_.write_info(height_,2);
+    save_hot_pages();
   }
   void insert(const Key &key, const Value &value);
   void remove(const Key &key, const Value &value);
   sjtu::vector<Value> find(const Key &key);
+  // find for a batch of keys: they are sorted and pushed down the tree
+  // together, so shared index pages and leaves are read once. sink gets
+  // every (key, value) in key order; duplicate keys are answered once.
+  void find_many(const sjtu::vector<Key> &keys,
+                 const std::function<void(const Key &, const Value &)> &sink);
+
+  // Coroutine variants of find/insert/remove, with the same results. They
+  // first walk the path to the leaf through the cache, and every page that
+  // misses is read on one of the scheduler's I/O threads while the
+  // coroutine is suspended, so one thread can keep many operations in
+  // flight. The synchronous call then finishes the job on cached pages.
+  // Arguments are taken by value so they live in the coroutine frame.
+  sjtu::Task<sjtu::vector<Value>> find_async(sjtu::Scheduler &scheduler,
+                                             Key key);
+  sjtu::Task<void> insert_async(sjtu::Scheduler &scheduler, Key key,
+                                Value value);
+  sjtu::Task<void> remove_async(sjtu::Scheduler &scheduler, Key key,
+                                Value value);
+
+  // true if any value is stored under key
+  bool contains(const Key &key);
+  // true if the exact pair is stored
+  bool contains(const Key &key, const Value &value);
+  // swap one (key, old_value) for (key, new_value), editing the leaf in
+  // place when the new pair still belongs to it; false if old is absent
+  bool replace(const Key &key, const Value &old_value, const Value &new_value);
+  // insert the pair unless it is already stored; true if it was inserted
+  bool upsert(const Key &key, const Value &value);
+
+  // every pair whose key lies in [lo, hi], in order; the pairs are
+  // collected first, so sink may call back into the tree
+  void scan(const Key &lo, const Key &hi,
+            const std::function<void(const Key &, const Value &)> &sink);
+
+  // number of values stored under key
+  long long count(const Key &key);
+  // number of pairs whose key lies in [lo, hi]
+  long long count(const Key &lo, const Key &hi);
+  // number of pairs whose key is smaller than key
+  long long rank(const Key &key);
+  // the i-th pair in key order, 0-based; throws index_out_of_bound
+  Key_Value<Key, Value> select(long long i);
+  // without counts the three above walk the leaves instead
+  bool counted() const { return counted_; }
+  int key_tag() const { return key_tag_; }
+
+  // Read-only view of the tree as it was when snapshot() returned. Writers
+  // are not held up by it: pages they overwrite later are kept aside until
+  // the last snapshot that can see them is destroyed. Must not outlive the
+  // tree.
+  class Snapshot {
+   public:
+    Snapshot(Snapshot &&other) noexcept;
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+    ~Snapshot();
+    sjtu::vector<Value> find(const Key &key) const;
+
+   private:
+    friend class BPT;
+    Snapshot(BPT *tree, uint64_t epoch, int root, int height);
+    BPT *tree_;
+    uint64_t epoch_;
+    int root_;
+    int height_;
+  };
+
+  Snapshot snapshot();
+
+  // Relaxed balance: remove only takes the pair out of its leaf, which may
+  // then drop to any fill, even empty. Underfull leaves are queued and
+  // borrowed into or merged REBALANCE_BATCH at a time, or on consolidate().
+  // Turning the mode off consolidates whatever is still queued.
+  void set_relaxed_balance(bool relaxed);
+  void consolidate();
+
+  struct RebalanceStats {
+    long long splits;          // leaf and index splits
+    long long merges;          // leaf and index merges
+    long long borrows;         // leaf and index borrows
+    long long deferred;        // underfull leaves queued in relaxed mode
+    long long merges_avoided;  // queued leaves refilled before consolidation
+  };
+  RebalanceStats rebalance_stats() const;
+
+  // Write buffering: with a capacity > 0, insert and remove only record a
+  // message; once `capacity` messages are buffered they are applied in
+  // key order, so a batch touches each leaf once and mostly through the
+  // finger. find merges the buffered messages into what it reads from the
+  // tree, every other operation flushes the buffer first. 0 turns it off.
+  void set_write_buffer(size_t capacity);
+  void flush_write_buffer();
+
+  // Bloom filter over the keys, bits_per_key bits each (10 gives about 1%
+  // false positives): find, contains and remove of a key that is not
+  // stored usually return without reading a page. It is sized for twice
+  // the keys present and rebuilt from the leaves once the inserts fill it
+  // or the removes that took a pair out reach half of it. 0 turns it off.
+  void set_bloom_filter(size_t bits_per_key);
+
+  struct BloomStats {
+    long long probes;           // lookups that asked the filter
+    long long negatives;        // answered by the filter alone
+    long long false_positives;  // passed the filter but found nothing
+    size_t memory_bytes;
+    size_t capacity;            // keys the filter is sized for
+  };
+  // false positive rate: false_positives / (negatives + false_positives)
+  BloomStats bloom_stats();
+
+  // Hot pages: the tree records which pages its cache holds in
+  // <filename>.hot when it is closed, or whenever save_hot_pages() is
+  // called, e.g. at a checkpoint. warm_up() on a reopened tree reads those
+  // pages back, sorted by address and in long sequential reads, instead of
+  // letting the first operations miss on them one by one; with background
+  // it returns at once and the cache fills while the tree is in use. Both
+  // return false without a cache (see storage.hpp) or a usable manifest.
+  bool save_hot_pages();
+  bool warm_up(bool background = false);
+
+  // the page files, e.g. to read the counters of a CountingStorage
+  Storage &storage() { return storage_; }
 
  private:
+  std::string hotPagesFile() const { return filename_ + ".hot"; }
+
   std::string filename_;
-  MemoryRiver<Index<Key, Value>, 2> index_file_;
-  MemoryRiver<Block<Key, Value>, 2> block_file_;
-  int root_;
-  int height_;
-  sjtu::BPTCacheManager<Key, Value> cache_manager_;
+  Storage storage_;
+  typename Storage::IndexFile &index_file_;
+  typename Storage::BlockFile &block_file_;
+  std::atomic<int> root_;
+  std::atomic<int> height_;
+  bool counted_;
+  int key_tag_;
+  sjtu::BPTCacheManager<Key, Value, Storage> cache_manager_;
+
+  // root_latch_ covers root_ and height_, the tables cover the pages
+  sjtu::OptimisticLatch root_latch_;
+  sjtu::LatchTable<> index_latches_;
+  sjtu::LatchTable<> block_latches_;
+  // writers hold it shared, snapshot() exclusive so it never sees half of
+  // an insert or remove
+  std::shared_mutex snapshot_gate_;
+
+  struct PendingLeaf {
+    Key_Value<Key, Value> key;  // any pair routed to the leaf
+    int addr;
+  };
+  std::atomic<bool> relaxed_balance_;
+  std::mutex pending_mutex_;
+  sjtu::vector<PendingLeaf> pending_;
+
+  // The leaf the last insert went to. Any change to the leaf or its fence
+  // (split, borrow, merge) writes the leaf, so the fence is still right as
+  // long as the leaf latch is at the version recorded here.
+  struct Finger {
+    int addr = -1;
+    uint64_t version = 0;
+    leafFence<Key, Value> fence;
+  };
+  std::mutex finger_mutex_;
+  Finger finger_;
 
-  // search for target leafnode and record the search path
+  struct Message {
+    Key_Value<Key, Value> kv;
+    uint64_t seq;  // arrival order, messages on one pair apply in it
+    bool remove;
+    bool operator<(const Message &other) const {
+      return kv < other.kv || (kv == other.kv && seq < other.seq);
+    }
+  };
+  std::atomic<size_t> buffer_capacity_;
+  // writers take it exclusive, find shared; a flush holds it exclusive so
+  // find never sees a message applied to the tree and still buffered
+  std::shared_mutex buffer_mutex_;
+  sjtu::vector<Message> buffer_run_;   // sorted
+  sjtu::vector<Message> buffer_tail_;  // arrival order
+  uint64_t buffer_seq_;
+
+  // inserts hold bloom_mutex_ shared from adding the key to the filter
+  // until the pair is in the tree or the write buffer, a rebuild holds it
+  // exclusive; bloom_ is only replaced under the exclusive lock
+  std::shared_mutex bloom_mutex_;
+  std::unique_ptr<sjtu::BloomFilter> bloom_;
+  std::atomic<size_t> bloom_bits_;
+  std::atomic<long long> bloom_capacity_;
+  std::atomic<long long> bloom_keys_;    // keys at the last rebuild
+  std::atomic<long long> bloom_adds_;    // since the last rebuild
+  std::atomic<long long> bloom_removes_;
+  struct {
+    std::atomic<long long> probes;
+    std::atomic<long long> negatives;
+    std::atomic<long long> false_positives;
+  } bloom_stats_;
+
+  struct {
+    std::atomic<long long> splits;
+    std::atomic<long long> merges;
+    std::atomic<long long> borrows;
+    std::atomic<long long> deferred;
+    std::atomic<long long> merges_avoided;
+  } stats_;
+
+  static uint64_t keyHash(const Key &key) { return std::hash<Key>{}(key); }
+  // true if the filter rules key out; filtered tells whether it was asked
+  bool bloomRejects(const Key &key, bool &filtered);
+  // the same for writes, which bloom_stats leaves out
+  bool bloomRejects(const Key &key);
+  // find once the Bloom filter has let the key through
+  sjtu::vector<Value> findFiltered(const Key &key, bool filtered);
+  // bring the pages on the way to key's leaf (to kv's leaf if by_pair)
+  // into the cache, reading misses on the scheduler's I/O threads
+  sjtu::Task<void> prefetchPath(sjtu::Scheduler &scheduler,
+                                Key_Value<Key, Value> kv, bool by_pair);
+  void bloomAdd(const Key &key);
+  // the inserts since the last rebuild filled it or the removes left it
+  // with too many stale keys
+  bool bloomStale() const;
+  // rebuild if stale, or unconditionally with force
+  void rebuildBloom(bool force);
+  // one hash per distinct key, read off the leaf chain
+  bool tryCollectKeys(sjtu::vector<uint64_t> &hashes);
+
+  // insert and remove straight into the tree
+  void applyInsert(const Key &key, const Value &value);
+  void applyRemove(const Key &key, const Value &value);
+  // record a write, or apply it when buffering is off; returns false then
+  bool bufferWrite(const Key_Value<Key, Value> &kv, bool remove);
+  // buffer_mutex_ must be held exclusive
+  void mergeBufferTail();
+  void flushBufferLocked();
+  // replay the buffered messages on key over the values found in the tree
+  void mergeBuffered(const Key &key, sjtu::vector<Value> &values);
+
+  // one optimistic attempt of the public operation, false means restart
+  bool tryInsert(const Key &key, const Value &value, bool unique,
+                 bool &inserted);
+  // insert into the finger leaf without descending, when the pair is inside
+  // its fence and fits without a split; false means take the normal path
+  bool tryFingerInsert(const Key_Value<Key, Value> &kv, bool unique,
+                       bool &inserted);
+  void setFinger(int addr, uint64_t version,
+                 const leafFence<Key, Value> &fence);
+  bool tryReplace(const Key &key, const Value &old_value,
+                  const Value &new_value, bool &found, bool &in_place,
+                  bool leftmost = false);
+  // look for kv in the leaves from the leftmost one that can hold it up to
+  // (not including) stop, recording each leaf and the version it was read at
+  bool tryFindBefore(const Key_Value<Key, Value> &kv, int stop, bool &found,
+                     sjtu::vector<std::pair<int, uint64_t>> &seen);
+  bool tryContains(const Key &key, bool &found);
+  bool tryContains(const Key_Value<Key, Value> &kv, bool &found);
+  // removed tells whether a pair was taken out. leftmost: look for the pair
+  // in the leftmost leaf that can hold it; the first attempt goes where
+  // inserts go and moves left only if it must
+  bool tryRemove(const Key &key, const Value &value, bool &removed,
+                 bool leftmost = false);
+  bool tryFind(const Key &key, sjtu::vector<Value> &result);
+  // answer keys[done..] below the page at addr, where keys[begin, end) all
+  // route; done moves past every key whose values reached the sink
+  bool tryFindMany(const sjtu::vector<Key> &keys, int begin, int end,
+                   int addr, int level, int height,
+                   sjtu::OptimisticLatch *latch, uint64_t version,
+                   const std::function<void(const Key &, const Value &)> &sink,
+                   sjtu::vector<Value> &buffer, int &done);
+  bool tryCount(const Key &lo, const Key &hi, long long &result);
+  bool tryScan(const Key &lo, const Key &hi,
+               sjtu::vector<Key_Value<Key, Value>> &result);
+  // pairs with key < bound, or <= bound when inclusive
+  bool tryRank(const Key &key, bool inclusive, long long &rank);
+  bool trySelect(long long i, Key_Value<Key, Value> &kv, bool &found);
+  // rebalance the leaf `key` routes to if it is (still) underfull
+  bool tryRebalance(const Key_Value<Key, Value> &key, int addr);
+  // queue an underfull leaf, consolidating once the queue is full
+  void deferRebalance(const Key_Value<Key, Value> &key, int addr);
+  void consolidatePending();
+
+  // find through the pages as the snapshot taken at epoch saw them
+  sjtu::vector<Value> findAt(const Key &key, uint64_t epoch, int root,
+                             int height);
+
+  // lock coupling step: read the page at addr, validating both it and the
+  // page we came from; on success latch/version move to the new page
+  bool readIndexCoupled(sjtu::OptimisticLatch *&latch, uint64_t &version,
+                        int addr, Index<Key, Value> &index);
+  bool readBlockCoupled(sjtu::OptimisticLatch *&latch, uint64_t &version,
+                        int addr, Block<Key, Value> &block);
+
+  // search for target leafnode and record the search path; versions gets
+  // the root latch, every path node and the leaf, in that order.
+  // returns -1 for an empty tree and -2 if a writer got in the way.
+  // leftmost routes to the first leaf that can hold key instead of the
+  // one an insert of it goes to
   int findLeafNode(const Key_Value<Key, Value> &key,
-                   sjtu::vector<pathFrame<Key, Value>> &path);
+                   sjtu::vector<pathFrame<Key, Value>> &path,
+                   sjtu::vector<uint64_t> &versions, bool leftmost = false);
+
+  // latch path[top..] and the leaf at the versions seen while descending,
+  // top == -1 also takes the root latch
+  bool lockPath(sjtu::LatchGuard &guard,
+                const sjtu::vector<pathFrame<Key, Value>> &path,
+                const sjtu::vector<uint64_t> &versions, int leaf_addr,
+                int top);
+
+  // latch the children next to frame.pos that a borrow or merge may touch
+  bool lockSiblings(sjtu::LatchGuard &guard, const pathFrame<Key, Value> &frame,
+                    bool leaf_children);
+
+  // latch everything balanceAfterRemove may modify for an underfull leaf:
+  // the ancestors up to the first one that can lose a key, plus the
+  // siblings next to every node on the way
+  bool lockForRebalance(sjtu::LatchGuard &guard,
+                        const sjtu::vector<pathFrame<Key, Value>> &path,
+                        const sjtu::vector<uint64_t> &versions, int leaf_addr,
+                        bool leaf_empties);
+
+  // add delta to the subtree counts along path and write the nodes back
+  void adjustCounts(sjtu::vector<pathFrame<Key, Value>> &path, int delta);
 
   // insert key-value pair and return true if need split
   bool insertIntoLeaf(int leaf_addr, const Key &key, const Value &value,
-                      Key_Value<Key, Value> &split_key, int &new_leaf_addr);
+                      Key_Value<Key, Value> &split_key, int &new_leaf_addr,
+                      int &new_leaf_size);
 
-  // handle split logic
+  // handle split logic; an append split leaves most keys on the left
   bool splitLeaf(Block<Key, Value> &leaf, int leaf_addr,
-                 Key_Value<Key, Value> &split_key, int &new_leaf_addr);
+                 Key_Value<Key, Value> &split_key, int &new_leaf_addr,
+                 int &new_leaf_size, bool append);
 
-  // pass the split information to parent node
+  // pass the split information to parent node, with the pair counts of the
+  // two halves
   bool insertIntoParent(const sjtu::vector<pathFrame<Key, Value>> &path,
                         int level, const Key_Value<Key, Value> &key,
-                        int right_child);
+                        int right_child, int left_count, int right_count);
 
   // split index node
   bool splitInternal(Index<Key, Value> &node, int node_addr,
-                     Key_Value<Key, Value> &split_key, int &new_node_addr);
+                     Key_Value<Key, Value> &split_key, int &new_node_addr,
+                     bool append);
 
   // balance block by borrowing from siblings or merge
   void balanceAfterRemove(Block<Key, Value> &node, int node_addr,
@@ -6,7 +6,7 @@
 constexpr size_t MAX_BUCKETS = 1193;
 namespace sjtu {
 
-template <class Key, class Value>
+template <class Key, class Value, size_t BUCKETS = MAX_BUCKETS>
 class HashMap {
  private:
   struct Entry {
@@ -20,7 +20,7 @@ class HashMap {
   typedef sjtu::vector<Entry> Bucket;
 
   size_t hash_function(const Key& key) const {
-    return static_cast<size_t>(key) % MAX_BUCKETS;
+    return static_cast<size_t>(key) % BUCKETS;
   }
 
   int find_in_bucket(const Bucket& bucket, const Key& key) const {
@@ -31,7 +31,7 @@ class HashMap {
     }
     return -1;
   }
-  Bucket buckets[MAX_BUCKETS];
+  Bucket buckets[BUCKETS];
   size_t size_;
 
  public:
@@ -98,7 +98,7 @@ class HashMap {
   }
 
   void clear() {
-    for (size_t i = 0; i < MAX_BUCKETS; ++i) {
+    for (size_t i = 0; i < BUCKETS; ++i) {
       buckets[i].clear();
     }
     size_ = 0;
@@ -106,7 +106,7 @@ class HashMap {
 
   template <typename Func>
   void for_each(Func func) const {
-    for (size_t i = 0; i < MAX_BUCKETS; ++i) {
+    for (size_t i = 0; i < BUCKETS; ++i) {
       for (size_t j = 0; j < buckets[i].size(); ++j) {
         func(buckets[i][j].key, buckets[i][j].value);
       }
@@ -35,25 +35,97 @@ struct Key_Value {
   }
 };
 
+// Low bits of int 1 of the .block header. Bump it whenever the page layout
+// changes so that files in an older layout are refused rather than
+// misread; trees from before it was kept have 0 or the first leaf's
+// address there.
+// 1: index pages keep subtree counts (counts[ORDER + 1])
+constexpr int PAGE_FORMAT_VERSION = 1;
+// the bits above hold the key tag the tree was created with, see BPT
+constexpr int PAGE_FORMAT_BITS = 16;
+
+inline int page_format_word(int key_tag) {
+  return PAGE_FORMAT_VERSION | key_tag << PAGE_FORMAT_BITS;
+}
+inline int page_format_version(int word) {
+  return word & ((1 << PAGE_FORMAT_BITS) - 1);
+}
+inline int page_format_key_tag(int word) { return word >> PAGE_FORMAT_BITS; }
+
 constexpr size_t DEFAULT_ORDER = 55;
 constexpr size_t DEFAULT_LEAF_SIZE = 55;
 
+// Bytes of an index page: what DEFAULT_ORDER separators took when they were
+// stored as padded Key_Value<long long, int> pairs.
+constexpr size_t INDEX_PAGE_BYTES =
+    DEFAULT_ORDER * sizeof(Key_Value<long long, int>) +
+    (DEFAULT_ORDER + 1) * 2 * sizeof(int) + sizeof(size_t);
+
+// Separators as two parallel arrays, so a pair costs sizeof(Key) +
+// sizeof(Value) without padding and the binary search only walks keys.
+// keys[i] hands out a reference to both halves.
+template <class Key, class Value, size_t N>
+struct Separators {
+  Key key_[N];
+  Value value_[N];
+
+  struct Ref {
+    Key &key;
+    Value &value;
+
+    operator Key_Value<Key, Value>() const { return {key, value}; }
+    Ref &operator=(const Key_Value<Key, Value> &kv) {
+      key = kv.key;
+      value = kv.value;
+      return *this;
+    }
+    Ref &operator=(const Ref &other) {
+      key = other.key;
+      value = other.value;
+      return *this;
+    }
+  };
+
+  Ref operator[](size_t i) { return {key_[i], value_[i]}; }
+  Key_Value<Key, Value> operator[](size_t i) const {
+    return {key_[i], value_[i]};
+  }
+};
+
+// separators that fit in INDEX_PAGE_BYTES next to their children and counts
+template <class Key, class Value>
+constexpr size_t index_order() {
+  return (INDEX_PAGE_BYTES - sizeof(size_t) - 2 * sizeof(int)) /
+         (sizeof(Key) + sizeof(Value) + 2 * sizeof(int));
+}
+
 // Increment the size of keys to facilitate split
+// counts[i] is the number of pairs under children[i]; it is only kept up to
+// date in a counted tree
 template <class Key, class Value>
 struct Index {
-  int children[DEFAULT_ORDER + 1];
-  Key_Value<Key, Value> keys[DEFAULT_ORDER];
+  static constexpr size_t ORDER = index_order<Key, Value>();
+
+  int children[ORDER + 1];
+  int counts[ORDER + 1];
+  Separators<Key, Value, ORDER> keys;
   size_t size;
 
-  Index() : size(0) {}
+  Index() : size(0) {
+    for (size_t i = 0; i <= ORDER; ++i) {
+      counts[i] = 0;
+    }
+  }
 
   Index(const Index &other) {
     size = other.size;
     for (size_t i = 0; i < size; ++i) {
       keys[i] = other.keys[i];
       children[i] = other.children[i];
+      counts[i] = other.counts[i];
     }
     children[size] = other.children[size];
+    counts[size] = other.counts[size];
   }
   Index &operator=(const Index &other) {
     if (this != &other) {
@@ -61,8 +133,10 @@ struct Index {
       for (size_t i = 0; i < size; ++i) {
         keys[i] = other.keys[i];
         children[i] = other.children[i];
+        counts[i] = other.counts[i];
       }
       children[size] = other.children[size];
+      counts[size] = other.counts[size];
     }
     return *this;
   }
@@ -71,8 +145,10 @@ struct Index {
     for (size_t i = 0; i < size; ++i) {
       keys[i] = other.keys[i];
       children[i] = other.children[i];
+      counts[i] = other.counts[i];
     }
     children[size] = other.children[size];
+    counts[size] = other.counts[size];
   }
   Index &operator=(Index &&other) noexcept {
     if (this != &other) {
@@ -80,8 +156,10 @@ struct Index {
       for (size_t i = 0; i < size; ++i) {
         keys[i] = other.keys[i];
         children[i] = other.children[i];
+        counts[i] = other.counts[i];
       }
       children[size] = other.children[size];
+      counts[size] = other.counts[size];
     }
     return *this;
   }
@@ -2,7 +2,12 @@
 #ifndef BPT_MEMORYRIVER_HPP
 #define BPT_MEMORYRIVER_HPP
 
+#include <climits>
 #include <fstream>
+#include <mutex>
+
+#include "exceptions.hpp"
+#include "metrics.hpp"
 
 using std::fstream;
 using std::ifstream;
@@ -16,6 +21,8 @@ class MemoryRiver {
   fstream file;
   string file_name;
   int sizeofT = sizeof(T);
+  // file 是共享的流对象，并发读写时需要串行化
+  std::mutex mutex_;
 
  public:
   MemoryRiver() = default;
@@ -23,6 +30,7 @@ class MemoryRiver {
   MemoryRiver(const string &file_name) : file_name(file_name) {}
 
   void initialise(string FN = "") {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (FN != "") file_name = FN;
     file.open(file_name, std::ios::out);
     int tmp = 0;
@@ -35,6 +43,7 @@ class MemoryRiver {
 
   // 读出第n个int的值赋给tmp，1_base
   void get_info(int &tmp, int n) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (n > info_len) return;
     file.open(file_name, std::ios::in);
     file.seekg((n - 1) * sizeof(int), std::ios::beg);
@@ -45,6 +54,7 @@ class MemoryRiver {
 
   // 将tmp写入第n个int的位置，1_base
   void write_info(int tmp, int n) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (n > info_len) return;
     file.open(file_name, std::ios::in | std::ios::out);
     file.seekp((n - 1) * sizeof(int), std::ios::beg);
@@ -56,36 +66,64 @@ class MemoryRiver {
   // 在文件合适位置写入类对象t，并返回写入的位置索引index
   // 位置索引意味着当输入正确的位置索引index，在以下三个函数中都能顺利的找到目标对象进行操作
   // 位置索引index可以取为对象写入的起始位置
+  // 位置索引是int, 文件超过INT_MAX字节时抛出sjtu::runtime_error
   int write(T &t) {
+    std::lock_guard<std::mutex> lock(mutex_);
     file.open(file_name, std::ios::in | std::ios::out);
     file.seekp(0, std::ios::end);
-    int index = file.tellp();
+    std::streamoff end = file.tellp();
+    if (end < 0 || end > INT_MAX) {
+      file.close();
+      throw sjtu::runtime_error();
+    }
+    int index = static_cast<int>(end);
     file.write(reinterpret_cast<char *>(&t), sizeof(T));
     file.close();
+    sjtu::metrics::count(sjtu::metrics::PAGE_WRITES);
+    sjtu::metrics::count(sjtu::metrics::BYTES_WRITTEN, sizeof(T));
     return index;
     /* your code here */
   }
 
   // 用t的值更新位置索引index对应的对象，保证调用的index都是由write函数产生
   void update(T &t, const int index) {
+    std::lock_guard<std::mutex> lock(mutex_);
     file.open(file_name, std::ios::in | std::ios::out);
     file.seekp(index, std::ios::beg);
     file.write(reinterpret_cast<char *>(&t), sizeof(T));
     file.close();
+    sjtu::metrics::count(sjtu::metrics::PAGE_WRITES);
+    sjtu::metrics::count(sjtu::metrics::BYTES_WRITTEN, sizeof(T));
     /* your code here */
   }
 
   // 读出位置索引index对应的T对象的值并赋值给t，保证调用的index都是由write函数产生
+  // 读用自己的流，不占 mutex_，多个线程的读可以同时进行
   void read(T &t, const int index) {
-    file.open(file_name, std::ios::in | std::ios::out);
-    file.seekg(index, std::ios::beg);
-    file.read(reinterpret_cast<char *>(&t), sizeof(T));
-    file.close();
+    std::ifstream in(file_name, std::ios::in);
+    in.seekg(index, std::ios::beg);
+    in.read(reinterpret_cast<char *>(&t), sizeof(T));
+    sjtu::metrics::count(sjtu::metrics::PAGE_READS);
+    sjtu::metrics::count(sjtu::metrics::BYTES_READ, sizeof(T));
     /* your code here */
   }
 
+  // 从位置索引index起连续读出最多count个对象到pages，一次顺序读完；
+  // 返回完整读到的个数(到文件尾为止)，供缓存预热批量装页
+  int read_run(T *pages, const int index, const int count) {
+    std::ifstream in(file_name, std::ios::in);
+    in.seekg(index, std::ios::beg);
+    in.read(reinterpret_cast<char *>(pages),
+            static_cast<std::streamsize>(count) * sizeof(T));
+    int got = in.gcount() / sizeof(T);
+    sjtu::metrics::count(sjtu::metrics::PAGE_READS, got);
+    sjtu::metrics::count(sjtu::metrics::BYTES_READ, in.gcount());
+    return got;
+  }
+
   // 删除位置索引index对应的对象(不涉及空间回收时，可忽略此函数)，保证调用的index都是由write函数产生
   void Delete(int index) {
+    std::lock_guard<std::mutex> lock(mutex_);
     file.open(file_name, std::ios::in | std::ios::out);
     file.seekg(0, std::ios::end);
     std::streamsize size = file.tellg();
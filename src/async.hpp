@@ -0,0 +1,285 @@
+#ifndef BPT_ASYNC_HPP
+#define BPT_ASYNC_HPP
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+
+#include "vector.hpp"
+
+namespace sjtu {
+
+template <class T>
+class Task;
+
+namespace detail {
+
+// resumes whoever awaited the finished task, or returns to the scheduler
+struct FinalAwaiter {
+  bool await_ready() noexcept { return false; }
+  template <class Promise>
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<Promise> handle) noexcept {
+    std::coroutine_handle<> next = handle.promise().continuation;
+    return next ? next : std::noop_coroutine();
+  }
+  void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+};
+
+}  // namespace detail
+
+// Lazily started coroutine returning T. It runs when it is co_awaited, and
+// the awaiting coroutine continues as soon as it finishes; exceptions are
+// rethrown at the co_await.
+template <class T>
+class Task {
+ public:
+  struct promise_type : detail::PromiseBase {
+    alignas(T) unsigned char storage[sizeof(T)];
+    bool has_value = false;
+
+    ~promise_type() {
+      if (has_value) reinterpret_cast<T *>(storage)->~T();
+    }
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    template <class U>
+    void return_value(U &&value) {
+      new (storage) T(std::forward<U>(value));
+      has_value = true;
+    }
+  };
+
+  Task(Task &&other) noexcept : handle_(other.handle_) {
+    other.handle_ = nullptr;
+  }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+    handle_.promise().continuation = awaiting;
+    return handle_;
+  }
+  T await_resume() {
+    promise_type &promise = handle_.promise();
+    if (promise.error) std::rethrow_exception(promise.error);
+    return std::move(*reinterpret_cast<T *>(promise.storage));
+  }
+
+ private:
+  explicit Task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <>
+class Task<void> {
+ public:
+  struct promise_type : detail::PromiseBase {
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    void return_void() {}
+  };
+
+  Task(Task &&other) noexcept : handle_(other.handle_) {
+    other.handle_ = nullptr;
+  }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+    handle_.promise().continuation = awaiting;
+    return handle_;
+  }
+  void await_resume() {
+    if (handle_.promise().error) {
+      std::rethrow_exception(handle_.promise().error);
+    }
+  }
+
+ private:
+  explicit Task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Runs coroutines on the thread that calls run(), and blocking work they
+// hand to offload() on a pool of I/O threads: the coroutine is suspended
+// meanwhile and resumed on the run() thread once the work is done, so one
+// thread keeps many lookups in flight while their page reads wait.
+class Scheduler {
+ public:
+  explicit Scheduler(int io_threads = 8) : outstanding_(0), stop_(false) {
+    if (io_threads < 1) io_threads = 1;
+    for (int i = 0; i < io_threads; ++i) {
+      io_threads_.push_back(new std::thread([this] { serve(); }));
+    }
+  }
+
+  ~Scheduler() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    jobs_ready_.notify_all();
+    for (size_t i = 0; i < io_threads_.size(); ++i) {
+      io_threads_[i]->join();
+      delete io_threads_[i];
+    }
+  }
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  // queue a top-level task; it starts on the next run(). Exceptions that
+  // escape it are swallowed, handle them inside the task.
+  template <class T>
+  void spawn(Task<T> task) {
+    outstanding_++;
+    Detached detached = drive(std::move(task));
+    post(detached.handle);
+  }
+
+  // resume coroutines until every spawned task has finished
+  void run() {
+    std::deque<std::coroutine_handle<>> batch;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        resumable_.wait(lock,
+                        [this] { return !ready_.empty() || outstanding_ == 0; });
+        if (ready_.empty()) return;
+        batch.swap(ready_);
+      }
+      while (!batch.empty()) {
+        std::coroutine_handle<> handle = batch.front();
+        batch.pop_front();
+        handle.resume();
+      }
+    }
+  }
+
+  // awaitable: run `work` on an I/O thread, then continue on the run()
+  // thread
+  auto offload(std::function<void()> work) {
+    struct Awaiter {
+      Scheduler *scheduler;
+      std::function<void()> work;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> handle) {
+        scheduler->submit(std::move(work), handle);
+      }
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{this, std::move(work)};
+  }
+
+ private:
+  // owns the frame of a spawned task and reports when it is done
+  struct Detached {
+    struct promise_type {
+      Scheduler *scheduler;
+      template <class T>
+      promise_type(Scheduler &owner, Task<T> &) : scheduler(&owner) {}
+      Detached get_return_object() {
+        return {std::coroutine_handle<promise_type>::from_promise(*this)};
+      }
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept {
+        scheduler->finished();
+        return {};
+      }
+      void return_void() {}
+      void unhandled_exception() {}
+    };
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  struct Job {
+    std::function<void()> work;
+    std::coroutine_handle<> handle;
+  };
+
+  template <class T>
+  Detached drive(Task<T> task) {
+    try {
+      co_await task;
+    } catch (...) {
+    }
+  }
+
+  void finished() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--outstanding_ == 0) resumable_.notify_all();
+  }
+
+  void post(std::coroutine_handle<> handle) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ready_.push_back(handle);
+    }
+    resumable_.notify_one();
+  }
+
+  void submit(std::function<void()> work, std::coroutine_handle<> handle) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back({std::move(work), handle});
+    }
+    jobs_ready_.notify_one();
+  }
+
+  void serve() {
+    while (true) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        jobs_ready_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if (jobs_.empty()) return;
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      job.work();
+      post(job.handle);
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable resumable_;
+  std::condition_variable jobs_ready_;
+  std::deque<std::coroutine_handle<>> ready_;
+  std::deque<Job> jobs_;
+  size_t outstanding_;
+  bool stop_;
+  sjtu::vector<std::thread *> io_threads_;
+};
+
+}  // namespace sjtu
+
+#endif  // BPT_ASYNC_HPP
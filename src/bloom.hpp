@@ -0,0 +1,74 @@
+#ifndef BPT_BLOOM_HPP
+#define BPT_BLOOM_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace sjtu {
+
+// Bloom filter over 64-bit hashes. add and may_contain only touch atomic
+// words, so inserts can keep adding while finds probe.
+class BloomFilter {
+ private:
+  std::atomic<uint64_t> *words_;
+  size_t bits_;
+  int hashes_;
+
+  // splitmix64 finalizer, spreads integer-like hashes over all 64 bits
+  static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+ public:
+  // room for `expected` hashes at `bits_per_key` bits each
+  BloomFilter(size_t expected, size_t bits_per_key) {
+    bits_ = expected * bits_per_key;
+    if (bits_ < 64) bits_ = 64;
+    bits_ = (bits_ + 63) / 64 * 64;
+    // k = bits per key * ln 2 minimizes the false positive rate
+    hashes_ = static_cast<int>(bits_per_key * 69 / 100);
+    if (hashes_ < 1) hashes_ = 1;
+    if (hashes_ > 16) hashes_ = 16;
+    words_ = new std::atomic<uint64_t>[bits_ / 64];
+    for (size_t i = 0; i < bits_ / 64; ++i) {
+      words_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  ~BloomFilter() { delete[] words_; }
+
+  BloomFilter(const BloomFilter &) = delete;
+  BloomFilter &operator=(const BloomFilter &) = delete;
+
+  void add(uint64_t hash) {
+    uint64_t h1 = mix(hash);
+    uint64_t h2 = mix(h1) | 1;
+    for (int i = 0; i < hashes_; ++i) {
+      uint64_t bit = (h1 + i * h2) % bits_;
+      words_[bit / 64].fetch_or(1ull << (bit % 64), std::memory_order_relaxed);
+    }
+  }
+
+  bool may_contain(uint64_t hash) const {
+    uint64_t h1 = mix(hash);
+    uint64_t h2 = mix(h1) | 1;
+    for (int i = 0; i < hashes_; ++i) {
+      uint64_t bit = (h1 + i * h2) % bits_;
+      if (!(words_[bit / 64].load(std::memory_order_relaxed) &
+            (1ull << (bit % 64)))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  size_t memory_usage() const { return bits_ / 8; }
+};
+
+}  // namespace sjtu
+
+#endif  // BPT_BLOOM_HPP
@@ -0,0 +1,396 @@
+#ifndef BPT_BULK_HPP
+#define BPT_BULK_HPP
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "IndexBlock.hpp"
+#include "exceptions.hpp"
+
+// Bottom-up construction of the <filename>.index / <filename>.block files
+// that BPT<Key, Value> (with the default FileStorage) opens: the same
+// MemoryRiver<T, 2> layout, two header ints (root and height for the index
+// file, page_format_word and the counted flag for the block file)
+// followed by raw pages, page addresses being byte offsets. Leaves are
+// chained left to right and every index page carries subtree counts, so the
+// result can be opened as a counted tree as well. Nodes other than the root never fall below the
+// underflow thresholds BPT enforces, so later inserts and removes go on as
+// if the tree had been built by inserting.
+//
+// Page addresses are ints, as everywhere in BPT, so a .block file is capped
+// at 2 GiB; both builders throw sjtu::runtime_error beyond that.
+
+constexpr long long BULK_HEADER_BYTES = 2 * sizeof(int);
+
+// a finished node as seen from its parent: its smallest pair, its address
+// and the number of pairs under it
+template <class Key, class Value>
+struct BulkEntry {
+  Key_Value<Key, Value> low;
+  int addr;
+  int count;
+};
+
+// Pairs per leaf and children per index node for a fill factor. Inserting
+// splits a leaf at DEFAULT_LEAF_SIZE + 1 pairs and an index node at ORDER
+// + 1 children; a node is never filled below twice the underflow threshold
+// so that the last two nodes of a level can always be evened out.
+struct BulkShape {
+  int leaf_cap;
+  int leaf_min;
+  int index_cap;
+  int index_min;
+
+  template <class Key, class Value>
+  static BulkShape of(double fill) {
+    BulkShape shape;
+    shape.leaf_min = (DEFAULT_LEAF_SIZE + 1) / 3;
+    shape.index_min = Index<Key, Value>::ORDER / 3 + 1;
+    shape.leaf_cap = clamp(DEFAULT_LEAF_SIZE * fill, 2 * shape.leaf_min,
+                           DEFAULT_LEAF_SIZE);
+    shape.index_cap = clamp(Index<Key, Value>::ORDER * fill,
+                            2 * shape.index_min, Index<Key, Value>::ORDER);
+    return shape;
+  }
+
+ private:
+  static int clamp(double x, int lo, int hi) {
+    int n = static_cast<int>(x + 0.5);
+    return n < lo ? lo : (n > hi ? hi : n);
+  }
+};
+
+template <class T>
+int bulkPageAddress(long long page) {
+  long long addr = BULK_HEADER_BYTES + page * (long long)sizeof(T);
+  if (addr > INT_MAX) throw sjtu::runtime_error();
+  return static_cast<int>(addr);
+}
+
+template <class Key, class Value>
+void bulkLeaf(Block<Key, Value> &leaf, const Key_Value<Key, Value> *pairs,
+              int count, int next) {
+  std::memset(static_cast<void *>(&leaf), 0, sizeof(leaf));
+  for (int i = 0; i < count; ++i) {
+    leaf.data[i] = pairs[i];
+  }
+  leaf.size = count;
+  leaf.next = next;
+}
+
+template <class Key, class Value>
+void bulkIndex(Index<Key, Value> &node, const BulkEntry<Key, Value> *entries,
+               int count) {
+  std::memset(static_cast<void *>(&node), 0, sizeof(node));
+  for (int i = 0; i < count; ++i) {
+    node.children[i] = entries[i].addr;
+    node.counts[i] = entries[i].count;
+    if (i > 0) node.keys[i - 1] = entries[i].low;
+  }
+  node.size = count - 1;
+}
+
+inline void bulkHeader(const std::string &file, int first, int second) {
+  std::fstream out(file, std::ios::in | std::ios::out | std::ios::binary);
+  out.write(reinterpret_cast<const char *>(&first), sizeof(int));
+  out.write(reinterpret_cast<const char *>(&second), sizeof(int));
+}
+
+// Streaming builder: pairs arrive in (key, value) order and go to disk as
+// soon as their page is decided, so memory stays at a few pages per level
+// whatever the input size. Repeated pairs are kept, as insert keeps them;
+// a pair smaller than the one before throws sjtu::runtime_error. Existing
+// files are replaced.
+template <class Key, class Value>
+class BulkLoader {
+ public:
+  // fill: share of the page capacity used, 1.0 packs pages as full as
+  // inserts can leave them; key_tag is recorded as BPT's constructor does
+  explicit BulkLoader(const std::string &filename, bool counted = false,
+                      double fill = 1.0, int key_tag = 0)
+      : filename_(filename),
+        counted_(counted),
+        key_tag_(key_tag),
+        shape_(BulkShape::of<Key, Value>(fill)),
+        pairs_(0),
+        leaves_(0),
+        index_pages_(0),
+        finished_(false) {
+    // levels are only ever appended; reserving keeps references into them
+    // valid while a node written on one level is pushed to the next
+    levels_.reserve(64);
+    // the hot-page manifest of the replaced tree (see BPT::warm_up)
+    std::remove((filename_ + ".hot").c_str());
+    index_.open(filename_ + ".index",
+                std::ios::out | std::ios::trunc | std::ios::binary);
+    block_.open(filename_ + ".block",
+                std::ios::out | std::ios::trunc | std::ios::binary);
+    int zero = 0;
+    for (int i = 0; i < 2; ++i) {
+      index_.write(reinterpret_cast<const char *>(&zero), sizeof(int));
+      block_.write(reinterpret_cast<const char *>(&zero), sizeof(int));
+    }
+  }
+
+  ~BulkLoader() {
+    if (!finished_) finish();
+  }
+
+  BulkLoader(const BulkLoader &) = delete;
+  BulkLoader &operator=(const BulkLoader &) = delete;
+
+  void add(const Key &key, const Value &value) {
+    Key_Value<Key, Value> kv{key, value};
+    if (pairs_ > 0 && kv < last_) throw sjtu::runtime_error();
+    last_ = kv;
+    pairs_++;
+    pending_.push_back(kv);
+    // keep back enough pairs that the last two leaves can be evened out
+    if ((int)pending_.size() > shape_.leaf_cap + shape_.leaf_min) {
+      writeLeaf(pending_.data(), shape_.leaf_cap, true);
+      pending_.erase(pending_.begin(), pending_.begin() + shape_.leaf_cap);
+    }
+  }
+
+  // writes the rest of the tree and the headers; the files can be opened
+  // by BPT afterwards
+  void finish() {
+    if (finished_) return;
+    finished_ = true;
+    int root = -1, height = 0;
+    if (splitRest(pending_.size(), shape_.leaf_cap) == 1) {
+      if (!pending_.empty()) {
+        writeLeaf(pending_.data(), pending_.size(), false);
+      }
+    } else {
+      int left = pending_.size() / 2;
+      writeLeaf(pending_.data(), left, true);
+      writeLeaf(pending_.data() + left, pending_.size() - left, false);
+    }
+    if (leaves_ == 1) {
+      root = bulkPageAddress<Block<Key, Value>>(0);
+    }
+    // close the levels bottom-up until one of them has a single node
+    for (size_t level = 0; level < levels_.size(); ++level) {
+      std::vector<BulkEntry<Key, Value>> rest;
+      rest.swap(levels_[level].pending);
+      if (levels_[level].nodes == 0 && rest.size() == 1) break;
+      if (splitRest(rest.size(), shape_.index_cap) == 1) {
+        writeIndex(level, rest.data(), rest.size());
+      } else {
+        int left = rest.size() / 2;
+        writeIndex(level, rest.data(), left);
+        writeIndex(level, rest.data() + left, rest.size() - left);
+      }
+      if (levels_[level].nodes == 1) {
+        root = levels_[level].last_addr;
+        height = level + 1;
+        break;
+      }
+    }
+    index_.close();
+    block_.close();
+    bulkHeader(filename_ + ".index", root, height);
+    bulkHeader(filename_ + ".block", page_format_word(key_tag_), counted_);
+  }
+
+  // pairs stored so far
+  long long size() const { return pairs_; }
+
+ private:
+  struct Level {
+    std::vector<BulkEntry<Key, Value>> pending;
+    long long nodes = 0;  // nodes written on this level
+    int last_addr = -1;
+  };
+
+  // number of nodes the remaining n items make: one if they fit, else two
+  static int splitRest(size_t n, int cap) { return (int)n <= cap ? 1 : 2; }
+
+  void writeLeaf(const Key_Value<Key, Value> *pairs, int count,
+                 bool has_next) {
+    int addr = bulkPageAddress<Block<Key, Value>>(leaves_);
+    // leaves are written in key order, so the next one is the next page
+    int next =
+        has_next ? bulkPageAddress<Block<Key, Value>>(leaves_ + 1) : -1;
+    bulkLeaf(leaf_, pairs, count, next);
+    block_.write(reinterpret_cast<const char *>(&leaf_), sizeof(leaf_));
+    leaves_++;
+    push(0, {pairs[0], addr, count});
+  }
+
+  void writeIndex(size_t level, const BulkEntry<Key, Value> *entries,
+                  int count) {
+    int addr = bulkPageAddress<Index<Key, Value>>(index_pages_);
+    bulkIndex(node_, entries, count);
+    index_.write(reinterpret_cast<const char *>(&node_), sizeof(node_));
+    index_pages_++;
+    long long pairs = 0;
+    for (int i = 0; i < count; ++i) pairs += entries[i].count;
+    levels_[level].nodes++;
+    levels_[level].last_addr = addr;
+    push(level + 1, {entries[0].low, addr, static_cast<int>(pairs)});
+  }
+
+  void push(size_t level, const BulkEntry<Key, Value> &entry) {
+    if (level == levels_.size()) levels_.push_back(Level());
+    std::vector<BulkEntry<Key, Value>> &pending = levels_[level].pending;
+    pending.push_back(entry);
+    if ((int)pending.size() > shape_.index_cap + shape_.index_min) {
+      std::vector<BulkEntry<Key, Value>> full(
+          pending.begin(), pending.begin() + shape_.index_cap);
+      pending.erase(pending.begin(), pending.begin() + shape_.index_cap);
+      writeIndex(level, full.data(), full.size());
+    }
+  }
+
+  std::string filename_;
+  bool counted_;
+  int key_tag_;
+  BulkShape shape_;
+  std::ofstream index_;
+  std::ofstream block_;
+  long long pairs_;
+  long long leaves_;
+  long long index_pages_;
+  bool finished_;
+  Key_Value<Key, Value> last_;
+  std::vector<Key_Value<Key, Value>> pending_;
+  // levels_[i] collects the children of the index nodes at height i + 1
+  std::vector<Level> levels_;
+  Block<Key, Value> leaf_;
+  Index<Key, Value> node_;
+};
+
+// Sorts pairs[0, n) in place with `threads` threads: every thread sorts a
+// slice, then neighbouring slices are merged pairwise, also in parallel.
+template <class T>
+void parallel_sort(T *pairs, size_t n, int threads) {
+  if (threads < 1) threads = 1;
+  std::vector<size_t> bounds;
+  for (int i = 0; i <= threads; ++i) bounds.push_back(n * i / threads);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([&, i] {
+      std::sort(pairs + bounds[i], pairs + bounds[i + 1]);
+    });
+  }
+  for (auto &worker : workers) worker.join();
+  for (int width = 1; width < threads; width *= 2) {
+    workers.clear();
+    for (int i = 0; i + width < threads; i += 2 * width) {
+      size_t lo = bounds[i], mid = bounds[i + width];
+      size_t hi = bounds[std::min(i + 2 * width, threads)];
+      workers.emplace_back([=] {
+        std::inplace_merge(pairs + lo, pairs + mid, pairs + hi);
+      });
+    }
+    for (auto &worker : workers) worker.join();
+  }
+}
+
+// Page range of node i when n items are spread evenly over k nodes; any
+// two nodes differ by at most one item, so none drops below half a page.
+inline size_t bulkShare(size_t n, size_t k, size_t i) { return n * i / k; }
+
+// Builds the files from an unsorted array, using `threads` threads for
+// every phase: parallel_sort, then each thread formats a disjoint range of
+// leaves straight into its preassigned pages of the .block file, then the
+// index levels are built bottom-up the same way. pairs is sorted in place.
+template <class Key, class Value>
+void parallel_bulk_build(const std::string &filename,
+                           Key_Value<Key, Value> *pairs, size_t n,
+                           int threads, bool counted = false,
+                           double fill = 1.0, int key_tag = 0) {
+  if (threads < 1) threads = 1;
+  BulkShape shape = BulkShape::of<Key, Value>(fill);
+  parallel_sort(pairs, n, threads);
+
+  const std::string index_file = filename + ".index";
+  const std::string block_file = filename + ".block";
+  std::remove((filename + ".hot").c_str());
+  {
+    std::ofstream index(index_file, std::ios::trunc | std::ios::binary);
+    std::ofstream block(block_file, std::ios::trunc | std::ios::binary);
+    int zero[2] = {0, 0};
+    index.write(reinterpret_cast<const char *>(zero), sizeof(zero));
+    block.write(reinterpret_cast<const char *>(zero), sizeof(zero));
+  }
+  if (n == 0) {
+    bulkHeader(index_file, -1, 0);
+    bulkHeader(block_file, page_format_word(key_tag), counted);
+    return;
+  }
+
+  // runs body(first, last) for `count` items split over the threads
+  auto fan_out = [threads](size_t count, auto body) {
+    std::vector<std::thread> workers;
+    size_t parts = std::min<size_t>(threads, count);
+    for (size_t t = 0; t < parts; ++t) {
+      workers.emplace_back(
+          [&, t] { body(count * t / parts, count * (t + 1) / parts); });
+    }
+    for (auto &worker : workers) worker.join();
+  };
+
+  size_t leaves = (n + shape.leaf_cap - 1) / shape.leaf_cap;
+  bulkPageAddress<Block<Key, Value>>(leaves);
+  std::vector<BulkEntry<Key, Value>> entries(leaves);
+  fan_out(leaves, [&](size_t first, size_t last) {
+    std::fstream out(block_file,
+                     std::ios::in | std::ios::out | std::ios::binary);
+    out.seekp(bulkPageAddress<Block<Key, Value>>(first));
+    Block<Key, Value> leaf;
+    for (size_t i = first; i < last; ++i) {
+      size_t begin = bulkShare(n, leaves, i);
+      size_t end = bulkShare(n, leaves, i + 1);
+      int next = i + 1 < leaves ? bulkPageAddress<Block<Key, Value>>(i + 1)
+                                : -1;
+      bulkLeaf(leaf, pairs + begin, end - begin, next);
+      out.write(reinterpret_cast<const char *>(&leaf), sizeof(leaf));
+      entries[i] = {pairs[begin], bulkPageAddress<Block<Key, Value>>(i),
+                    static_cast<int>(end - begin)};
+    }
+  });
+
+  int root = entries[0].addr, height = 0;
+  long long index_pages = 0;
+  while (entries.size() > 1) {
+    size_t children = entries.size();
+    size_t nodes = (children + shape.index_cap - 1) / shape.index_cap;
+    long long base = index_pages;
+    bulkPageAddress<Index<Key, Value>>(base + nodes);
+    std::vector<BulkEntry<Key, Value>> parents(nodes);
+    fan_out(nodes, [&](size_t first, size_t last) {
+      std::fstream out(index_file,
+                       std::ios::in | std::ios::out | std::ios::binary);
+      out.seekp(bulkPageAddress<Index<Key, Value>>(base + first));
+      Index<Key, Value> node;
+      for (size_t i = first; i < last; ++i) {
+        size_t begin = bulkShare(children, nodes, i);
+        size_t end = bulkShare(children, nodes, i + 1);
+        bulkIndex(node, entries.data() + begin, end - begin);
+        out.write(reinterpret_cast<const char *>(&node), sizeof(node));
+        long long count = 0;
+        for (size_t j = begin; j < end; ++j) count += entries[j].count;
+        parents[i] = {entries[begin].low,
+                      bulkPageAddress<Index<Key, Value>>(base + i),
+                      static_cast<int>(count)};
+      }
+    });
+    index_pages += nodes;
+    entries.swap(parents);
+    root = entries[0].addr;
+    height++;
+  }
+  bulkHeader(index_file, root, height);
+  bulkHeader(block_file, page_format_word(key_tag), counted);
+}
+
+#endif  // BPT_BULK_HPP
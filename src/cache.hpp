@@ -2,16 +2,28 @@
 #ifndef BPT_CACHE_HPP
 #define BPT_CACHE_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
 
 #include "HashMap.hpp"
 #include "IndexBlock.hpp"
-#include "MemoryRiver.hpp"
 #include "list.hpp"
+#include "metrics.hpp"
+#include "storage.hpp"
 
 namespace sjtu {
 
-template <class Key, class Value>
+template <class Key, class Value, size_t BUCKETS = MAX_BUCKETS>
 class LRUCache {
  private:
   struct CacheItem {
@@ -32,8 +44,8 @@ class LRUCache {
 
   sjtu::list<Key> lru_list_;
 
-  HashMap<Key, CacheItem> cache_items_;
-  HashMap<Key, ItemPosition> positions_;
+  HashMap<Key, CacheItem, BUCKETS> cache_items_;
+  HashMap<Key, ItemPosition, BUCKETS> positions_;
 
   using EvictionCallback = std::function<void(const Key&, const Value&)>;
   EvictionCallback eviction_callback_ = nullptr;
@@ -41,6 +53,10 @@ class LRUCache {
  public:
   explicit LRUCache(size_t capacity = 1024) : capacity_(capacity) {}
 
+  void set_capacity(size_t capacity) { capacity_ = capacity; }
+
+  size_t capacity() const { return capacity_; }
+
   size_t size() const { return cache_items_.size(); }
 
   bool empty() const { return cache_items_.empty(); }
@@ -101,6 +117,15 @@ class LRUCache {
     return false;
   }
 
+  // cached keys, most recently used first
+  sjtu::vector<Key> get_keys() const {
+    sjtu::vector<Key> keys;
+    for (auto it = lru_list_.cbegin(); it != lru_list_.cend(); ++it) {
+      keys.push_back(*it);
+    }
+    return keys;
+  }
+
   sjtu::vector<Key> get_dirty_keys() const {
     sjtu::vector<Key> dirty_keys;
 
@@ -154,6 +179,7 @@ class LRUCache {
     if (lru_list_.empty()) return;
     Key lru_key = lru_list_.back();
     lru_list_.pop_back();
+    metrics::count(metrics::EVICTIONS);
     if (cache_items_.contains(lru_key) && cache_items_.get(lru_key).dirty) {
       if (eviction_callback_) {
         eviction_callback_(lru_key, cache_items_.get(lru_key).value);
@@ -164,94 +190,552 @@ class LRUCache {
   }
 };
 
-template <class Key, class Value>
+// LRU caches over the index and block files of a storage policy (see
+// storage.hpp); a policy that is not `cached` is read and written directly
+// and only the snapshot bookkeeping below applies. Both caches are split into
+// shards by page address, each behind its own mutex, so threads touching
+// different pages do not serialize on one lock. Pages are copied in and out,
+// which means callers never hold a reference into the cache.
+//
+// While snapshots are open, the first overwrite of a page in a new epoch
+// first saves the old content. A snapshot taken at epoch s reads the oldest
+// saved copy newer than s, or the live page if it was never overwritten.
+//
+// save_hot_pages() writes the addresses of the cached pages to a manifest,
+// warm_up() reads them back into a fresh cache: sorted by address and
+// fetched in long sequential runs instead of one miss at a time.
+template <class Key, class Value, class Storage = FileStorage<Key, Value>>
 class BPTCacheManager {
  private:
-  LRUCache<int, Index<Key, Value>> index_cache_;
-  LRUCache<int, Block<Key, Value>> block_cache_;
+  static constexpr size_t SHARD_COUNT = 8;
+  static constexpr size_t SHARD_BUCKETS = 151;
+  // warm-up reads at most this many bytes at once, and reads through gaps
+  // of up to WARM_GAP_PAGES pages rather than starting a new run
+  static constexpr size_t WARM_RUN_BYTES = 1 << 18;
+  static constexpr int WARM_GAP_PAGES = 4;
+  // pages start behind the two-int info header of the page files
+  static constexpr int PAGE_BASE = 2 * sizeof(int);
+  static constexpr char HOT_MAGIC[8] = {'B', 'P', 'T', 'H', 'O', 'T', '0',
+                                        '1'};
+
+  template <class T>
+  struct PageVersion {
+    uint64_t epoch;  // epoch of the write that replaced this content
+    T page;
+  };
+
+  template <class T>
+  struct Shard {
+    std::mutex mutex;
+    LRUCache<int, T, SHARD_BUCKETS> cache;
+    HashMap<int, sjtu::vector<PageVersion<T>>, SHARD_BUCKETS> versions;
+    // pages of this shard written to the file so far
+    uint64_t writebacks = 0;
+  };
 
-  MemoryRiver<Index<Key, Value>, 2>& index_file_;
-  MemoryRiver<Block<Key, Value>, 2>& block_file_;
+  struct SnapshotInfo {
+    uint64_t epoch;
+    // pages at or after these offsets did not exist when it was taken
+    int index_end;
+    int block_end;
+  };
 
- public:
-  BPTCacheManager(MemoryRiver<Index<Key, Value>, 2>& index_file,
-                  MemoryRiver<Block<Key, Value>, 2>& block_file,
-                  size_t index_cache_size = 1024, size_t block_cache_size = 2048)
-      : index_file_(index_file),
-        block_file_(block_file),
-        index_cache_(index_cache_size),
-        block_cache_(block_cache_size) {
-    index_cache_.set_eviction_callback(
-        [this](int addr, const Index<Key, Value>& index) {
-          if (index_cache_.is_dirty(addr)) {
-            index_file_.update(const_cast<Index<Key, Value>&>(index), addr);
-          }
+  Shard<Index<Key, Value>> index_shards_[SHARD_COUNT];
+  Shard<Block<Key, Value>> block_shards_[SHARD_COUNT];
+
+  typename Storage::IndexFile& index_file_;
+  typename Storage::BlockFile& block_file_;
+
+  std::mutex snapshot_mutex_;
+  sjtu::vector<SnapshotInfo> snapshots_;
+  std::atomic<uint64_t> epoch_;
+  std::atomic<int> snapshot_count_;
+  // one past the last page appended by this process, INT_MAX until then
+  std::atomic<int> index_end_;
+  std::atomic<int> block_end_;
+  // pages below these offsets may be visible to an open snapshot
+  std::atomic<int> index_preserve_end_;
+  std::atomic<int> block_preserve_end_;
+
+  std::thread warm_thread_;
+  std::atomic<bool> warm_stop_;
+
+  static size_t shard_of(int addr) {
+    return (static_cast<uint32_t>(addr) * 2654435761u >> 16) % SHARD_COUNT;
+  }
+
+  template <class T>
+  static constexpr bool is_leaf = std::is_same_v<T, Block<Key, Value>>;
+
+  static void advance_end(std::atomic<int>& end, int page_end) {
+    int current = end.load();
+    while ((current == INT_MAX || current < page_end) &&
+           !end.compare_exchange_weak(current, page_end)) {
+    }
+  }
+
+  // shard.mutex must be held
+  template <class T, class File>
+  void load(Shard<T>& shard, File& file, T& page, int addr) {
+    if constexpr (!Storage::cached) {
+      metrics::page_read(is_leaf<T>, false);
+      file.read(page, addr);
+      return;
+    }
+    if (shard.cache.contains(addr)) {
+      metrics::page_read(is_leaf<T>, true);
+      page = shard.cache.get(addr);
+      return;
+    }
+    metrics::page_read(is_leaf<T>, false);
+    file.read(page, addr);
+    shard.cache.put(addr, page, false);
+  }
+
+  // Like load, but the file is read without shard.mutex, so misses on
+  // different pages of a shard overlap. If a page of the shard was written
+  // back meanwhile, the read may have seen it half written and is redone.
+  template <class T, class File>
+  void load_unlocked(Shard<T>& shard, File& file, T& page, int addr) {
+    uint64_t writebacks;
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      if (shard.cache.contains(addr)) {
+        metrics::page_read(is_leaf<T>, true);
+        page = shard.cache.get(addr);
+        return;
+      }
+      writebacks = shard.writebacks;
+    }
+    metrics::page_read(is_leaf<T>, false);
+    file.read(page, addr);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.cache.contains(addr)) {
+      page = shard.cache.get(addr);
+      return;
+    }
+    if (shard.writebacks != writebacks) {
+      file.read(page, addr);
+    }
+    shard.cache.put(addr, page, false);
+  }
+
+  // shard.mutex must be held; called right before the page is overwritten
+  template <class T, class File>
+  void preserve(Shard<T>& shard, File& file, int addr,
+                int preserve_end) {
+    if (snapshot_count_.load() == 0 || addr >= preserve_end) return;
+    uint64_t epoch = epoch_.load();
+    sjtu::vector<PageVersion<T>>* chain = shard.versions.get_ptr(addr);
+    if (chain != nullptr && chain->back().epoch == epoch) return;
+    PageVersion<T> version;
+    version.epoch = epoch;
+    load(shard, file, version.page, addr);
+    if (chain == nullptr) {
+      shard.versions.put(addr, sjtu::vector<PageVersion<T>>());
+      chain = shard.versions.get_ptr(addr);
+    }
+    chain->push_back(version);
+  }
+
+  template <class T, class File>
+  void read_at(Shard<T>& shard, File& file, T& page, int addr,
+               uint64_t epoch) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    sjtu::vector<PageVersion<T>>* chain = shard.versions.get_ptr(addr);
+    if (chain != nullptr) {
+      for (size_t i = 0; i < chain->size(); ++i) {
+        if ((*chain)[i].epoch > epoch) {
+          page = (*chain)[i].page;
+          return;
+        }
+      }
+    }
+    load(shard, file, page, addr);
+  }
+
+  // addresses of the pages cached in shards, sorted
+  template <class T>
+  static sjtu::vector<int> cached_addrs(Shard<T>* shards) {
+    sjtu::vector<int> addrs;
+    for (size_t i = 0; i < SHARD_COUNT; ++i) {
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      sjtu::vector<int> keys = shards[i].cache.get_keys();
+      for (size_t j = 0; j < keys.size(); ++j) addrs.push_back(keys[j]);
+    }
+    if (!addrs.empty()) std::sort(&addrs[0], &addrs[0] + addrs.size());
+    return addrs;
+  }
+
+  // Caches the pages at addrs, which are sorted, reading each run of nearby
+  // pages with one read. Pages already cached are left alone, and so is a
+  // full shard: the pages the tree has used since opening are worth more.
+  // A page whose shard wrote something back during the read may have been
+  // read half written, or be older than what was written; it is skipped.
+  // So is an address that is not the start of a page, which no manifest
+  // of this database has: copying what it points at would trust garbage.
+  template <class T, class File>
+  void warm(Shard<T>* shards, File& file, const sjtu::vector<int>& addrs) {
+    const int page_size = sizeof(T);
+    const int run_pages =
+        WARM_RUN_BYTES / sizeof(T) > 0 ? WARM_RUN_BYTES / sizeof(T) : 1;
+    std::unique_ptr<T[]> run(new T[run_pages]);
+    size_t i = 0;
+    while (i < addrs.size() && !warm_stop_) {
+      int first = addrs[i];
+      if (first < PAGE_BASE || (first - PAGE_BASE) % page_size != 0) {
+        ++i;
+        continue;
+      }
+      size_t j = i + 1;
+      while (j < addrs.size() &&
+             (addrs[j] - PAGE_BASE) % page_size == 0 &&
+             (addrs[j] - first) / page_size < run_pages &&
+             addrs[j] - addrs[j - 1] <= (WARM_GAP_PAGES + 1) * page_size) {
+        ++j;
+      }
+      uint64_t writebacks[SHARD_COUNT];
+      for (size_t s = 0; s < SHARD_COUNT; ++s) {
+        std::lock_guard<std::mutex> lock(shards[s].mutex);
+        writebacks[s] = shards[s].writebacks;
+      }
+      int got = file.read_run(run.get(), first,
+                              (addrs[j - 1] - first) / page_size + 1);
+      for (; i < j; ++i) {
+        int n = (addrs[i] - first) / page_size;
+        if (n >= got) continue;
+        size_t s = shard_of(addrs[i]);
+        std::lock_guard<std::mutex> lock(shards[s].mutex);
+        if (shards[s].writebacks != writebacks[s] ||
+            shards[s].cache.contains(addrs[i]) ||
+            shards[s].cache.size() >= shards[s].cache.capacity()) {
+          continue;
+        }
+        shards[s].cache.put(addrs[i], run[n], false);
+      }
+    }
+  }
+
+  // drop saved pages no open snapshot can read any more;
+  // snapshot_mutex_ must be held
+  template <class T>
+  void collect(Shard<T>& shard) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    sjtu::vector<int> addrs;
+    shard.versions.for_each(
+        [&addrs](int addr, const sjtu::vector<PageVersion<T>>&) {
+          addrs.push_back(addr);
         });
+    for (size_t i = 0; i < addrs.size(); ++i) {
+      sjtu::vector<PageVersion<T>>* chain = shard.versions.get_ptr(addrs[i]);
+      sjtu::vector<PageVersion<T>> kept;
+      uint64_t from = 0;
+      for (size_t j = 0; j < chain->size(); ++j) {
+        // the copy serves snapshots taken in [from, epoch)
+        for (size_t k = 0; k < snapshots_.size(); ++k) {
+          if (snapshots_[k].epoch >= from &&
+              snapshots_[k].epoch < (*chain)[j].epoch) {
+            kept.push_back((*chain)[j]);
+            break;
+          }
+        }
+        from = (*chain)[j].epoch;
+      }
+      if (kept.empty()) {
+        shard.versions.remove(addrs[i]);
+      } else {
+        *chain = kept;
+      }
+    }
+  }
 
-    block_cache_.set_eviction_callback(
-        [this](int addr, const Block<Key, Value>& block) {
-          if (block_cache_.is_dirty(addr)) {
+ public:
+  BPTCacheManager(Storage& storage, size_t index_cache_size = 1024,
+                  size_t block_cache_size = 2048)
+      : index_file_(storage.index),
+        block_file_(storage.block),
+        epoch_(1),
+        snapshot_count_(0),
+        index_end_(INT_MAX),
+        block_end_(INT_MAX),
+        index_preserve_end_(0),
+        block_preserve_end_(0),
+        warm_stop_(false) {
+    for (size_t i = 0; i < SHARD_COUNT; ++i) {
+      index_shards_[i].cache.set_capacity(
+          (index_cache_size + SHARD_COUNT - 1) / SHARD_COUNT);
+      block_shards_[i].cache.set_capacity(
+          (block_cache_size + SHARD_COUNT - 1) / SHARD_COUNT);
+      index_shards_[i].cache.set_eviction_callback(
+          [this, i](int addr, const Index<Key, Value>& index) {
+            index_shards_[i].writebacks++;
+            metrics::count(metrics::WRITEBACKS);
+            index_file_.update(const_cast<Index<Key, Value>&>(index), addr);
+          });
+      block_shards_[i].cache.set_eviction_callback(
+          [this, i](int addr, const Block<Key, Value>& block) {
+            block_shards_[i].writebacks++;
+            metrics::count(metrics::WRITEBACKS);
             block_file_.update(const_cast<Block<Key, Value>&>(block), addr);
-          }
-        });
+          });
+    }
   }
 
+  ~BPTCacheManager() { stop_warm_up(); }
+
   void read_index(Index<Key, Value>& index, int index_addr) {
-    if (index_cache_.contains(index_addr)) {
-      index = index_cache_.get(index_addr);
+    if constexpr (!Storage::cached) {
+      metrics::page_read(false, false);
+      index_file_.read(index, index_addr);
       return;
     }
-    index_file_.read(index, index_addr);
-    index_cache_.put(index_addr, index, false);
+    load_unlocked(index_shards_[shard_of(index_addr)], index_file_, index,
+                  index_addr);
   }
 
   void read_block(Block<Key, Value>& block, int block_addr) {
-    if (block_cache_.contains(block_addr)) {
-      block = block_cache_.get(block_addr);
+    if constexpr (!Storage::cached) {
+      metrics::page_read(true, false);
+      block_file_.read(block, block_addr);
       return;
     }
-    block_file_.read(block, block_addr);
-    block_cache_.put(block_addr, block, false);
+    load_unlocked(block_shards_[shard_of(block_addr)], block_file_, block,
+                  block_addr);
+  }
+
+  // read the page only if that needs no file access; false on a cache miss
+  bool try_read_index(Index<Key, Value>& index, int index_addr) {
+    if constexpr (!Storage::cached) {
+      metrics::page_read(false, false);
+      index_file_.read(index, index_addr);
+      return true;
+    }
+    auto& shard = index_shards_[shard_of(index_addr)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (!shard.cache.contains(index_addr)) return false;
+    metrics::page_read(false, true);
+    index = shard.cache.get(index_addr);
+    return true;
+  }
+
+  bool try_read_block(Block<Key, Value>& block, int block_addr) {
+    if constexpr (!Storage::cached) {
+      metrics::page_read(true, false);
+      block_file_.read(block, block_addr);
+      return true;
+    }
+    auto& shard = block_shards_[shard_of(block_addr)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (!shard.cache.contains(block_addr)) return false;
+    metrics::page_read(true, true);
+    block = shard.cache.get(block_addr);
+    return true;
+  }
+
+  // read the page as the snapshot taken at `epoch` sees it
+  void read_index_at(Index<Key, Value>& index, int index_addr,
+                     uint64_t epoch) {
+    read_at(index_shards_[shard_of(index_addr)], index_file_, index,
+            index_addr, epoch);
+  }
+
+  void read_block_at(Block<Key, Value>& block, int block_addr,
+                     uint64_t epoch) {
+    read_at(block_shards_[shard_of(block_addr)], block_file_, block,
+            block_addr, epoch);
   }
 
   int write_index(const Index<Key, Value>& index) {
     int index_addr = index_file_.write(const_cast<Index<Key, Value>&>(index));
-    index_cache_.put(index_addr, index, false);
+    advance_end(index_end_, index_addr + sizeof(Index<Key, Value>));
+    if constexpr (Storage::cached) {
+      auto& shard = index_shards_[shard_of(index_addr)];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.cache.put(index_addr, index, false);
+    }
     return index_addr;
   }
 
   int write_block(const Block<Key, Value>& block) {
     int block_addr = block_file_.write(const_cast<Block<Key, Value>&>(block));
-    block_cache_.put(block_addr, block, false);
+    advance_end(block_end_, block_addr + sizeof(Block<Key, Value>));
+    if constexpr (Storage::cached) {
+      auto& shard = block_shards_[shard_of(block_addr)];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.cache.put(block_addr, block, false);
+    }
     return block_addr;
   }
 
   void update_index(const Index<Key, Value>& index, int index_addr) {
-    index_cache_.put(index_addr, index, true);
+    auto& shard = index_shards_[shard_of(index_addr)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    preserve(shard, index_file_, index_addr, index_preserve_end_);
+    if constexpr (Storage::cached) {
+      shard.cache.put(index_addr, index, true);
+    } else {
+      index_file_.update(const_cast<Index<Key, Value>&>(index), index_addr);
+    }
   }
 
   void update_block(const Block<Key, Value>& block, int block_addr) {
-    block_cache_.put(block_addr, block, true);
+    auto& shard = block_shards_[shard_of(block_addr)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    preserve(shard, block_file_, block_addr, block_preserve_end_);
+    if constexpr (Storage::cached) {
+      shard.cache.put(block_addr, block, true);
+    } else {
+      block_file_.update(const_cast<Block<Key, Value>&>(block), block_addr);
+    }
+  }
+
+  // open a snapshot of the current content and return its epoch; the caller
+  // must make sure no write is in flight
+  uint64_t begin_snapshot() {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    SnapshotInfo info;
+    info.epoch = epoch_.fetch_add(1);
+    info.index_end = index_end_;
+    info.block_end = block_end_;
+    snapshots_.push_back(info);
+    if (info.index_end > index_preserve_end_) {
+      index_preserve_end_ = info.index_end;
+    }
+    if (info.block_end > block_preserve_end_) {
+      block_preserve_end_ = info.block_end;
+    }
+    snapshot_count_++;
+    return info.epoch;
+  }
+
+  void end_snapshot(uint64_t epoch) {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    sjtu::vector<SnapshotInfo> open;
+    int index_end = 0, block_end = 0;
+    for (size_t i = 0; i < snapshots_.size(); ++i) {
+      if (snapshots_[i].epoch == epoch) continue;
+      open.push_back(snapshots_[i]);
+      if (snapshots_[i].index_end > index_end) {
+        index_end = snapshots_[i].index_end;
+      }
+      if (snapshots_[i].block_end > block_end) {
+        block_end = snapshots_[i].block_end;
+      }
+    }
+    snapshots_ = open;
+    index_preserve_end_ = index_end;
+    block_preserve_end_ = block_end;
+    snapshot_count_--;
+    for (size_t i = 0; i < SHARD_COUNT; ++i) {
+      collect(index_shards_[i]);
+      collect(block_shards_[i]);
+    }
   }
 
   void flush_cache() {
-    index_cache_.for_each_dirty(
-        [this](int addr, const Index<Key, Value>& index) {
-          index_file_.update(const_cast<Index<Key, Value>&>(index), addr);
-          index_cache_.mark_dirty(addr, false);
-        });
+    for (size_t i = 0; i < SHARD_COUNT; ++i) {
+      auto& index_shard = index_shards_[i];
+      std::lock_guard<std::mutex> index_lock(index_shard.mutex);
+      index_shard.cache.for_each_dirty(
+          [this, &index_shard](int addr, const Index<Key, Value>& index) {
+            index_shard.writebacks++;
+            metrics::count(metrics::WRITEBACKS);
+            index_file_.update(const_cast<Index<Key, Value>&>(index), addr);
+            index_shard.cache.mark_dirty(addr, false);
+          });
+
+      auto& block_shard = block_shards_[i];
+      std::lock_guard<std::mutex> block_lock(block_shard.mutex);
+      block_shard.cache.for_each_dirty(
+          [this, &block_shard](int addr, const Block<Key, Value>& block) {
+            block_shard.writebacks++;
+            metrics::count(metrics::WRITEBACKS);
+            block_file_.update(const_cast<Block<Key, Value>&>(block), addr);
+            block_shard.cache.mark_dirty(addr, false);
+          });
+    }
+  }
 
-    block_cache_.for_each_dirty(
-        [this](int addr, const Block<Key, Value>& block) {
-          block_file_.update(const_cast<Block<Key, Value>&>(block), addr);
-          block_cache_.mark_dirty(addr, false);
-        });
+  // Writes the addresses of the cached index and block pages to path:
+  // HOT_MAGIC, the two counts as ints, then the sorted addresses. False if
+  // there is no cache or the file cannot be written.
+  bool save_hot_pages(const std::string& path) {
+    if constexpr (!Storage::cached) return false;
+    sjtu::vector<int> index_addrs = cached_addrs(index_shards_);
+    sjtu::vector<int> block_addrs = cached_addrs(block_shards_);
+    std::FILE* out = std::fopen(path.c_str(), "wb");
+    if (out == nullptr) return false;
+    int counts[2] = {static_cast<int>(index_addrs.size()),
+                     static_cast<int>(block_addrs.size())};
+    bool ok = std::fwrite(HOT_MAGIC, 1, sizeof(HOT_MAGIC), out) ==
+                  sizeof(HOT_MAGIC) &&
+              std::fwrite(counts, sizeof(int), 2, out) == 2;
+    for (size_t i = 0; ok && i < index_addrs.size(); ++i) {
+      ok = std::fwrite(&index_addrs[i], sizeof(int), 1, out) == 1;
+    }
+    for (size_t i = 0; ok && i < block_addrs.size(); ++i) {
+      ok = std::fwrite(&block_addrs[i], sizeof(int), 1, out) == 1;
+    }
+    return std::fclose(out) == 0 && ok;
+  }
+
+  // Loads the pages listed in a manifest of save_hot_pages, index pages
+  // first; in the background if asked, while the tree is already in use.
+  // False if there is no cache or no readable manifest.
+  bool warm_up(const std::string& path, bool background) {
+    if constexpr (!Storage::cached) return false;
+    stop_warm_up();
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    if (in == nullptr) return false;
+    char magic[sizeof(HOT_MAGIC)];
+    int counts[2];
+    bool ok = std::fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+              std::memcmp(magic, HOT_MAGIC, sizeof(magic)) == 0 &&
+              std::fread(counts, sizeof(int), 2, in) == 2 && counts[0] >= 0 &&
+              counts[1] >= 0;
+    sjtu::vector<int> index_addrs, block_addrs;
+    long long total = static_cast<long long>(counts[0]) + counts[1];
+    for (long long i = 0; ok && i < total; ++i) {
+      int addr;
+      ok = std::fread(&addr, sizeof(int), 1, in) == 1;
+      if (ok) (i < counts[0] ? index_addrs : block_addrs).push_back(addr);
+    }
+    std::fclose(in);
+    if (!ok) return false;
+    // sorted when saved, but warm relies on it
+    if (!index_addrs.empty()) {
+      std::sort(&index_addrs[0], &index_addrs[0] + index_addrs.size());
+    }
+    if (!block_addrs.empty()) {
+      std::sort(&block_addrs[0], &block_addrs[0] + block_addrs.size());
+    }
+    auto work = [this, index_addrs, block_addrs] {
+      warm(index_shards_, index_file_, index_addrs);
+      warm(block_shards_, block_file_, block_addrs);
+    };
+    if (background) {
+      warm_thread_ = std::thread(work);
+    } else {
+      work();
+    }
+    return true;
+  }
+
+  // cuts a background warm-up short and waits for it
+  void stop_warm_up() {
+    warm_stop_ = true;
+    if (warm_thread_.joinable()) warm_thread_.join();
+    warm_stop_ = false;
   }
 
   void clear() {
     flush_cache();
-    index_cache_.clear();
-    block_cache_.clear();
+    for (size_t i = 0; i < SHARD_COUNT; ++i) {
+      std::lock_guard<std::mutex> index_lock(index_shards_[i].mutex);
+      index_shards_[i].cache.clear();
+      std::lock_guard<std::mutex> block_lock(block_shards_[i].mutex);
+      block_shards_[i].cache.clear();
+    }
   }
 };
 
@@ -0,0 +1,244 @@
+#ifndef BPT_COMMAND_HPP
+#define BPT_COMMAND_HPP
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include "keys.hpp"
+#include "vector.hpp"
+
+// one command of the code.cpp format, with its key already hashed; an
+// insert the key table refused comes back as UNKNOWN
+struct Command {
+  enum Kind : char { INSERT, FIND, REMOVE, UNKNOWN };
+  Kind kind;
+  long long key;
+  int value;
+};
+
+namespace sjtu {
+
+// Commands of the code.cpp format parsed in place from a file descriptor or
+// a buffer. A regular file is mapped whole, anything else (a pipe, a
+// terminal) is read in chunks of READ_CHUNK bytes; either way tokens are
+// never copied and nothing is allocated per command. Keys go through the
+// given KeyHasher.
+class CommandReader {
+ public:
+  static constexpr size_t READ_CHUNK = 1 << 20;
+
+  explicit CommandReader(int fd, KeyHasher hasher = KeyHasher())
+      : fd_(fd), owned_(nullptr), mapped_(0), hasher_(hasher) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        mapped_ = st.st_size;
+        pos_ = static_cast<const char *>(map);
+        end_ = pos_ + mapped_;
+        fd_ = -1;
+        return;
+      }
+    }
+    // a token longer than a chunk still fits, see refill()
+    owned_ = static_cast<char *>(std::malloc(2 * READ_CHUNK));
+    pos_ = end_ = owned_;
+  }
+
+  // parses a buffer the caller keeps alive
+  CommandReader(const char *data, size_t size,
+                KeyHasher hasher = KeyHasher())
+      : fd_(-1),
+        owned_(nullptr),
+        mapped_(0),
+        hasher_(hasher),
+        pos_(data),
+        end_(data + size) {}
+
+  ~CommandReader() {
+    if (mapped_ != 0) {
+      munmap(const_cast<char *>(end_ - mapped_), mapped_);
+    }
+    std::free(owned_);
+  }
+
+  CommandReader(const CommandReader &) = delete;
+  CommandReader &operator=(const CommandReader &) = delete;
+
+  // the count line in front of the commands
+  bool count(long long &n) {
+    const char *token;
+    size_t len;
+    if (!next_token(token, len)) return false;
+    return std::from_chars(token, token + len, n).ec == std::errc();
+  }
+
+  // false at the end of the input. An unknown word comes back as UNKNOWN
+  // without arguments, the way the iostream driver skipped it.
+  bool next(Command &command) {
+    const char *token;
+    size_t len;
+    if (!next_token(token, len)) return false;
+    command.key = 0;
+    command.value = 0;
+    if (len == 6 && std::memcmp(token, "insert", 6) == 0) {
+      command.kind = Command::INSERT;
+    } else if (len == 4 && std::memcmp(token, "find", 4) == 0) {
+      command.kind = Command::FIND;
+    } else if (len == 6 && std::memcmp(token, "delete", 6) == 0) {
+      command.kind = Command::REMOVE;
+    } else {
+      command.kind = Command::UNKNOWN;
+      return true;
+    }
+    if (!next_token(token, len)) return false;
+    bool accepted =
+        hasher_(token, len, command.kind == Command::INSERT, command.key);
+    if (command.kind == Command::FIND) return true;
+    if (!next_token(token, len)) return false;
+    std::from_chars(token, token + len, command.value);
+    if (!accepted) command.kind = Command::UNKNOWN;
+    return true;
+  }
+
+ private:
+  static bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
+           c == '\f';
+  }
+
+  // the token stays valid until the next call
+  bool next_token(const char *&token, size_t &len) {
+    while (true) {
+      while (pos_ != end_ && is_space(*pos_)) ++pos_;
+      if (pos_ != end_) break;
+      if (!refill()) return false;
+    }
+    const char *p = pos_;
+    while (true) {
+      while (p != end_ && !is_space(*p)) ++p;
+      if (p != end_) break;
+      // the token runs into the end of the chunk; refill moves it to the
+      // front of the buffer
+      size_t done = p - pos_;
+      if (!refill()) break;
+      p = pos_ + done;
+    }
+    token = pos_;
+    len = p - pos_;
+    pos_ = p;
+    return true;
+  }
+
+  // keeps [pos_, end_) and appends what the descriptor has
+  bool refill() {
+    if (fd_ < 0) return false;
+    size_t kept = end_ - pos_;
+    if (kept > READ_CHUNK) return false;  // no token is that long
+    std::memmove(owned_, pos_, kept);
+    pos_ = owned_;
+    end_ = owned_ + kept;
+    ssize_t got;
+    do {
+      got = read(fd_, owned_ + kept, READ_CHUNK);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+      fd_ = -1;
+      return false;
+    }
+    end_ += got;
+    return true;
+  }
+
+  int fd_;  // -1 once there is nothing more to read
+  char *owned_;
+  size_t mapped_;
+  KeyHasher hasher_;
+  const char *pos_;
+  const char *end_;
+};
+
+// Output collected in a large buffer and written with one write(2) per
+// CAPACITY bytes instead of one stream insertion per value.
+class OutputBuffer {
+ public:
+  static constexpr size_t CAPACITY = 1 << 20;
+
+  explicit OutputBuffer(int fd) : fd_(fd), len_(0) {
+    buf_ = static_cast<char *>(std::malloc(CAPACITY));
+  }
+  ~OutputBuffer() {
+    flush();
+    std::free(buf_);
+  }
+
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  void put(char c) {
+    if (len_ == CAPACITY) flush();
+    buf_[len_++] = c;
+  }
+
+  void put(const char *s, size_t n) {
+    if (CAPACITY - len_ < n) flush();
+    if (n > CAPACITY) {
+      write_all(s, n);
+      return;
+    }
+    std::memcpy(buf_ + len_, s, n);
+    len_ += n;
+  }
+
+  void put(int value) {
+    if (CAPACITY - len_ < 12) flush();
+    len_ = std::to_chars(buf_ + len_, buf_ + CAPACITY, value).ptr - buf_;
+  }
+
+  // the answer to a find: "null", or every value followed by a space
+  void put_values(const sjtu::vector<int> &values) {
+    if (values.size() == 0) {
+      put("null\n", 5);
+      return;
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+      put(values[i]);
+      put(' ');
+    }
+    put('\n');
+  }
+
+  void flush() {
+    write_all(buf_, len_);
+    len_ = 0;
+  }
+
+ private:
+  void write_all(const char *s, size_t n) {
+    while (n > 0) {
+      ssize_t done = write(fd_, s, n);
+      if (done < 0) {
+        if (errno == EINTR) continue;
+        return;
+      }
+      s += done;
+      n -= done;
+    }
+  }
+
+  int fd_;
+  char *buf_;
+  size_t len_;
+};
+
+}  // namespace sjtu
+
+#endif  // BPT_COMMAND_HPP
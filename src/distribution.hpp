@@ -0,0 +1,139 @@
+#ifndef BPT_DISTRIBUTION_HPP
+#define BPT_DISTRIBUTION_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+// Keys in [0, items) drawn the way benchmarks and workloads want them;
+// the same seed always gives the same sequence.
+//   UNIFORM     every key equally likely
+//   ZIPFIAN     key popularity follows Zipf's law with exponent theta, the
+//               popular keys scattered over the key space (YCSB's
+//               scrambled zipfian)
+//   SEQUENTIAL  0, 1, 2, ... wrapping around at items
+//   LATEST      zipfian over recency: items - 1 is the most popular key,
+//               items - 2 the next, and so on (YCSB's latest)
+// grow() extends the key space as records are added, continuing the zeta
+// sum instead of recomputing it.
+class KeyDistribution {
+ public:
+  enum Kind { UNIFORM, ZIPFIAN, SEQUENTIAL, LATEST };
+
+  static constexpr double DEFAULT_THETA = 0.99;
+
+  KeyDistribution(Kind kind, uint64_t items, uint64_t seed,
+                  double theta = DEFAULT_THETA)
+      : kind_(kind), items_(items == 0 ? 1 : items), rng_(seed), next_(0) {
+    if (kind_ == ZIPFIAN || kind_ == LATEST) {
+      theta_ = theta;
+      zeta2_ = zeta(0, 2, 0);
+      zetan_ = zeta(0, items_, 0);
+      prepare();
+    }
+  }
+
+  // "uniform", "zipfian", "sequential" or "latest"; false for anything
+  // else
+  static bool parse(const char *name, Kind &kind) {
+    if (std::strcmp(name, "uniform") == 0) {
+      kind = UNIFORM;
+    } else if (std::strcmp(name, "zipfian") == 0) {
+      kind = ZIPFIAN;
+    } else if (std::strcmp(name, "sequential") == 0) {
+      kind = SEQUENTIAL;
+    } else if (std::strcmp(name, "latest") == 0) {
+      kind = LATEST;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  static const char *name(Kind kind) {
+    switch (kind) {
+      case UNIFORM:
+        return "uniform";
+      case ZIPFIAN:
+        return "zipfian";
+      case LATEST:
+        return "latest";
+      default:
+        return "sequential";
+    }
+  }
+
+  uint64_t next() {
+    switch (kind_) {
+      case UNIFORM:
+        return rng_() % items_;
+      case ZIPFIAN:
+        return scramble(rank()) % items_;
+      case LATEST:
+        return items_ - 1 - rank();
+      default:
+        return next_++ % items_;
+    }
+  }
+
+  uint64_t items() const { return items_; }
+
+  // the key space is now [0, items); shrinking is ignored
+  void grow(uint64_t items) {
+    if (items <= items_) return;
+    if (kind_ == ZIPFIAN || kind_ == LATEST) {
+      zetan_ = zeta(items_, items, zetan_);
+      items_ = items;
+      prepare();
+    } else {
+      items_ = items;
+    }
+  }
+
+ private:
+  // 0 is the most popular rank, Gray et al., "Quickly generating
+  // billion-record synthetic databases"
+  uint64_t rank() {
+    double u = std::uniform_real_distribution<double>(0, 1)(rng_);
+    double uz = u * zetan_;
+    if (uz < 1) return 0;
+    if (uz < 1 + std::pow(0.5, theta_)) return 1;
+    uint64_t r = static_cast<uint64_t>(
+        items_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+    return r < items_ ? r : items_ - 1;
+  }
+
+  // zeta(n) = sum 1 / i^theta over i = 1..n, continued from zeta(from)
+  double zeta(uint64_t from, uint64_t n, double partial) const {
+    for (uint64_t i = from; i < n; ++i) {
+      partial += 1 / std::pow(static_cast<double>(i + 1), theta_);
+    }
+    return partial;
+  }
+
+  void prepare() {
+    alpha_ = 1 / (1 - theta_);
+    eta_ = (1 - std::pow(2.0 / items_, 1 - theta_)) / (1 - zeta2_ / zetan_);
+  }
+
+  // FNV-1a over the bytes of x, spreads neighbouring ranks apart
+  static uint64_t scramble(uint64_t x) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < 8; ++i) {
+      hash ^= x & 0xff;
+      hash *= 0x100000001b3ull;
+      x >>= 8;
+    }
+    return hash;
+  }
+
+  Kind kind_;
+  uint64_t items_;
+  std::mt19937_64 rng_;
+  uint64_t next_;
+  double theta_ = DEFAULT_THETA;
+  double alpha_ = 0, eta_ = 0, zeta2_ = 0, zetan_ = 0;
+};
+
+#endif  // BPT_DISTRIBUTION_HPP
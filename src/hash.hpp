@@ -0,0 +1,113 @@
+#ifndef BPT_HASH_HPP
+#define BPT_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// string keys of the command format are stored as a 64-bit hash; every
+// program that reads or writes a database must agree on which one
+enum class HashKind : char { FAST, LEGACY };
+
+// the original polynomial hash, kept for databases written with it
+constexpr long long PR = 998244353;
+constexpr long long MOD = 99234523452349217;
+
+inline long long Hash(const char *s, size_t len) {
+  __int128_t hash = 0;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash * PR + s[i] + 1) % MOD;
+  }
+  return hash;
+}
+
+inline long long Hash(const std::string &s) { return Hash(s.data(), s.size()); }
+
+namespace detail {
+
+constexpr uint64_t HASH_P0 = 0xa0761d6478bd642full;
+constexpr uint64_t HASH_P1 = 0xe7037ed1a0b428dbull;
+constexpr uint64_t HASH_P2 = 0x8ebc6af09c88c6e3ull;
+constexpr uint64_t HASH_P3 = 0x589965cc75374cc3ull;
+
+// 64x64 -> 128 multiply folded back to 64 bits
+inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+  __uint128_t r = static_cast<__uint128_t>(a) * b;
+  return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t hash_read64(const char *p) {
+  uint64_t v;
+  std::memcpy(&v, p, 8);
+  return v;
+}
+
+inline uint64_t hash_read32(const char *p) {
+  uint32_t v;
+  std::memcpy(&v, p, 4);
+  return v;
+}
+
+}  // namespace detail
+
+// wyhash-style hash: a few 64-bit multiplies per 16 bytes instead of a
+// 128-bit modulo per byte. Keys up to 16 bytes are read with at most four
+// overlapping loads and no loop; past 48 bytes three independent lanes
+// consume 48 bytes per round so their multiplies overlap in the pipeline.
+// seed picks an unrelated hash of the same key, see KeyTable.
+inline uint64_t FastHash(const char *p, size_t len, uint64_t seed = 0) {
+  using namespace detail;
+  seed ^= hash_mix(seed ^ HASH_P0, HASH_P1);
+  uint64_t a, b;
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t step = (len >> 3) << 2;
+      a = (hash_read32(p) << 32) | hash_read32(p + step);
+      b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - step);
+    } else if (len > 0) {
+      a = (static_cast<uint64_t>(static_cast<unsigned char>(p[0])) << 16) |
+          (static_cast<uint64_t>(static_cast<unsigned char>(p[len >> 1]))
+           << 8) |
+          static_cast<unsigned char>(p[len - 1]);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t lane1 = seed, lane2 = seed;
+      do {
+        seed = hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ seed);
+        lane1 = hash_mix(hash_read64(p + 16) ^ HASH_P2,
+                         hash_read64(p + 24) ^ lane1);
+        lane2 = hash_mix(hash_read64(p + 32) ^ HASH_P3,
+                         hash_read64(p + 40) ^ lane2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= lane1 ^ lane2;
+    }
+    while (i > 16) {
+      seed = hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    // the last 16 bytes, overlapping what was already mixed
+    a = hash_read64(p + i - 16);
+    b = hash_read64(p + i - 8);
+  }
+  a ^= HASH_P1;
+  b ^= seed;
+  __uint128_t r = static_cast<__uint128_t>(a) * b;
+  return hash_mix(static_cast<uint64_t>(r) ^ HASH_P0 ^ len,
+                  static_cast<uint64_t>(r >> 64) ^ HASH_P1);
+}
+
+inline long long HashKey(HashKind kind, const char *s, size_t len) {
+  if (kind == HashKind::LEGACY) return Hash(s, len);
+  return static_cast<long long>(FastHash(s, len));
+}
+
+#endif  // BPT_HASH_HPP
@@ -0,0 +1,107 @@
+#ifndef BPT_HISTOGRAM_HPP
+#define BPT_HISTOGRAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Log-linear latency histogram in the HDR style: values below 2 * SUB are
+// counted exactly, above that every power of two is split into SUB equal
+// buckets, so any recorded value is reported within 1 / SUB (1.6%) of
+// itself and the whole uint64_t range fits in a fixed array. record() is a
+// few instructions and never allocates; histograms of the same kind merge
+// by adding counts.
+class LatencyHistogram {
+ public:
+  static constexpr int SUB_BITS = 6;
+  static constexpr uint64_t SUB = uint64_t(1) << SUB_BITS;
+  static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+  LatencyHistogram() { clear(); }
+
+  void clear() {
+    std::memset(counts_, 0, sizeof(counts_));
+    count_ = sum_ = max_ = 0;
+  }
+
+  void record(uint64_t value) {
+    counts_[bucket(value)]++;
+    count_++;
+    sum_ += value;
+    if (value > max_) max_ = value;
+  }
+
+  void merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < BUCKETS; ++i) counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    if (other.max_ > max_) max_ = other.max_;
+  }
+
+  // the value below which a fraction q of the records fall, q in [0, 1]
+  uint64_t percentile(double q) const {
+    if (count_ == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * count_);
+    if (rank >= count_) rank = count_ - 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      seen += counts_[i];
+      if (seen > rank) {
+        uint64_t value = middle(i);
+        return value < max_ ? value : max_;
+      }
+    }
+    return max_;
+  }
+
+  // the bucket value is counted in, for counts kept outside the class
+  static size_t bucket(uint64_t value) {
+    if (value < 2 * SUB) return value;
+    int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+    return (shift + 1) * SUB + ((value >> shift) - SUB);
+  }
+
+  // adds counts kept outside, see bucket(); their sum and maximum come
+  // separately through add_totals
+  void add_bucket(size_t index, uint64_t count) {
+    counts_[index] += count;
+    count_ += count;
+  }
+
+  void add_totals(uint64_t sum, uint64_t max) {
+    sum_ += sum;
+    if (max > max_) max_ = max;
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+  double mean() const { return count_ == 0 ? 0 : double(sum_) / count_; }
+
+  // non-empty buckets as (lowest value, count), for dumping the shape
+  template <class F>
+  void for_each_bucket(F f) const {
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      if (counts_[i] != 0) f(lowest(i), counts_[i]);
+    }
+  }
+
+ private:
+  static uint64_t lowest(size_t index) {
+    if (index < 2 * SUB) return index;
+    int shift = index / SUB - 1;
+    return (index % SUB + SUB) << shift;
+  }
+
+  static uint64_t middle(size_t index) {
+    if (index < 2 * SUB) return index;
+    int shift = index / SUB - 1;
+    return lowest(index) + (uint64_t(1) << shift) / 2;
+  }
+
+  uint64_t counts_[BUCKETS];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+};
+
+#endif  // BPT_HISTOGRAM_HPP
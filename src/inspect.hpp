@@ -0,0 +1,326 @@
+#ifndef BPT_INSPECT_HPP
+#define BPT_INSPECT_HPP
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "IndexBlock.hpp"
+#include "exceptions.hpp"
+
+// Health check of a closed database, read straight from <name>.index and
+// <name>.block: one depth-first pass that holds a page per level and a bit
+// per page, never the tree. It reports per level the node count and a fill
+// histogram, the leaf chain's physical locality (how far on disk each leaf
+// is from the next one in key order, and whether the chain really links
+// them in that order), pages no node points to (left behind by merges and
+// page rewrites, since pages are never freed) and the lengths of runs of
+// one key.
+//
+// Optionally the same pass streams the structure as the JSON that
+// script/visualize_cpp_bptree.py draws: nodes with their keys (and, for
+// leaves, the values of each key) and parent-child / leaf-link links. With
+// sample = k only every k-th child of each node is exported, so a big
+// tree still gives a drawable outline; statistics always cover all of it.
+//
+// The files are read as the tree left them on close; a database another
+// process has open may not have its cached pages and root on disk yet.
+template <class Key, class Value>
+class TreeInspector {
+ public:
+  // fill histograms split [0, 100%] into FILL_BUCKETS tenths
+  static constexpr int FILL_BUCKETS = 10;
+  // duplicate runs are counted in power-of-two buckets: 1, 2-3, 4-7, ...
+  static constexpr int RUN_BUCKETS = 32;
+
+  struct Level {
+    uint64_t nodes = 0;
+    uint64_t entries = 0;  // separators, or pairs on the leaf level
+    uint64_t capacity = 0;
+    uint64_t fill[FILL_BUCKETS] = {};
+  };
+
+  struct Report {
+    int root = -1;
+    int height = 0;
+    // levels[0] is the root, levels[height] the leaves
+    std::vector<Level> levels;
+    uint64_t index_pages = 0;  // pages in the files
+    uint64_t leaf_pages = 0;
+    uint64_t orphan_index_pages = 0;
+    uint64_t orphan_leaf_pages = 0;
+    uint64_t pairs = 0;
+    uint64_t distinct_keys = 0;
+    uint64_t runs[RUN_BUCKETS] = {};
+    uint64_t longest_run = 0;
+    // between consecutive leaves in key order
+    uint64_t chain_adjacent = 0;   // the next page in the file
+    uint64_t chain_forward = 0;    // further ahead in the file
+    uint64_t chain_backward = 0;   // behind in the file
+    double chain_mean_distance = 0;  // in pages
+    uint64_t chain_broken = 0;  // next pointers that skip or reorder leaves
+    uint64_t unsorted = 0;      // pairs out of order within the walk
+  };
+
+  explicit TreeInspector(const std::string &filename)
+      : index_fd_(open((filename + ".index").c_str(), O_RDONLY)),
+        block_fd_(open((filename + ".block").c_str(), O_RDONLY)) {
+    if (index_fd_ < 0 || block_fd_ < 0) {
+      if (index_fd_ >= 0) close(index_fd_);
+      if (block_fd_ >= 0) close(block_fd_);
+      throw sjtu::runtime_error();
+    }
+    int format = 0;
+    if (pread(block_fd_, &format, sizeof(format), 0) != sizeof(format) ||
+        page_format_version(format) != PAGE_FORMAT_VERSION) {
+      close(index_fd_);
+      close(block_fd_);
+      throw sjtu::runtime_error();
+    }
+  }
+
+  ~TreeInspector() {
+    close(index_fd_);
+    close(block_fd_);
+  }
+
+  TreeInspector(const TreeInspector &) = delete;
+  TreeInspector &operator=(const TreeInspector &) = delete;
+
+  // walks the tree; export_to, if given, receives the visualizer JSON
+  Report run(std::FILE *export_to = nullptr, int sample = 1) {
+    report_ = Report();
+    out_ = export_to;
+    sample_ = sample < 1 ? 1 : sample;
+    next_id_ = 0;
+    last_exported_leaf_ = -1;
+    first_node_ = true;
+    have_prev_leaf_ = false;
+    have_last_key_ = false;
+    run_ = 0;
+    distance_sum_ = 0;
+
+    int header[2] = {-1, 0};
+    if (pread(index_fd_, header, sizeof(header), 0) != sizeof(header)) {
+      header[0] = -1;
+    }
+    report_.root = header[0];
+    report_.height = header[0] < 0 ? 0 : header[1];
+    report_.index_pages = pages(index_fd_, sizeof(Index<Key, Value>));
+    report_.leaf_pages = pages(block_fd_, sizeof(Block<Key, Value>));
+    index_seen_.assign(report_.index_pages, false);
+    leaf_seen_.assign(report_.leaf_pages, false);
+    report_.levels.assign(report_.height + 1, Level());
+    if (out_ != nullptr) {
+      links_ = std::tmpfile();
+      if (links_ == nullptr) throw sjtu::runtime_error();
+      std::fprintf(out_, "{\"sample\":%d,\"nodes\":[", sample_);
+    }
+
+    if (report_.root >= 0) {
+      if (report_.height == 0) {
+        visitLeaf(report_.root, -1, true);
+      } else {
+        visitIndex(report_.root, 0, -1, true);
+      }
+    }
+    endRun();
+    if (have_prev_leaf_ && prev_next_ != -1) report_.chain_broken++;
+
+    uint64_t moves =
+        report_.chain_adjacent + report_.chain_forward + report_.chain_backward;
+    if (moves > 0) report_.chain_mean_distance = distance_sum_ / moves;
+    for (uint64_t i = 0; i < report_.index_pages; ++i) {
+      if (!index_seen_[i]) report_.orphan_index_pages++;
+    }
+    for (uint64_t i = 0; i < report_.leaf_pages; ++i) {
+      if (!leaf_seen_[i]) report_.orphan_leaf_pages++;
+    }
+
+    if (out_ != nullptr) {
+      std::fprintf(out_, "],\"links\":[");
+      std::rewind(links_);
+      char buffer[1 << 16];
+      size_t n;
+      while ((n = std::fread(buffer, 1, sizeof(buffer), links_)) > 0) {
+        std::fwrite(buffer, 1, n, out_);
+      }
+      std::fclose(links_);
+      std::fprintf(out_, "]}\n");
+    }
+    return report_;
+  }
+
+ private:
+  static constexpr int HEADER = 2 * sizeof(int);
+
+  static uint64_t pages(int fd, size_t page_size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < HEADER) return 0;
+    return (st.st_size - HEADER) / page_size;
+  }
+
+  template <class T>
+  bool read(int fd, T &page, int addr) {
+    return pread(fd, static_cast<void *>(&page), sizeof(T), addr) ==
+           static_cast<ssize_t>(sizeof(T));
+  }
+
+  // marks the page seen; false if it is outside the file or seen before,
+  // which a sound tree never does
+  static bool mark(std::vector<bool> &seen, int addr, size_t page_size) {
+    if (addr < HEADER) return false;
+    uint64_t page = (addr - HEADER) / page_size;
+    if (page >= seen.size() || seen[page]) return false;
+    seen[page] = true;
+    return true;
+  }
+
+  void count(Level &level, uint64_t entries, uint64_t capacity) {
+    level.nodes++;
+    level.entries += entries;
+    level.capacity += capacity;
+    int bucket = entries * FILL_BUCKETS / capacity;
+    level.fill[bucket < FILL_BUCKETS ? bucket : FILL_BUCKETS - 1]++;
+  }
+
+  // exported nodes are numbered in pre-order, so ids grow from left to
+  // right on every level, which is how the visualizer lays them out
+  int beginNode(int parent, bool leaf) {
+    int id = next_id_++;
+    std::fprintf(out_, "%s{\"id\":%d,\"is_leaf\":%s,\"keys\":[",
+                 first_node_ ? "" : ",", id, leaf ? "true" : "false");
+    first_node_ = false;
+    if (parent >= 0) link(parent, id, "parent-child");
+    return id;
+  }
+
+  void link(int source, int target, const char *type) {
+    std::fprintf(links_, "%s{\"source\":%d,\"target\":%d,\"type\":\"%s\"}",
+                 std::ftell(links_) == 0 ? "" : ",", source, target, type);
+  }
+
+  void visitIndex(int addr, int depth, int parent, bool exported) {
+    Index<Key, Value> index;
+    if (!mark(index_seen_, addr, sizeof(index)) ||
+        !read(index_fd_, index, addr) || index.size >= Index<Key, Value>::ORDER) {
+      return;
+    }
+    count(report_.levels[depth], index.size, Index<Key, Value>::ORDER - 1);
+    int id = -1;
+    if (exported && out_ != nullptr) {
+      id = beginNode(parent, false);
+      for (size_t i = 0; i < index.size; ++i) {
+        std::fprintf(out_, "%s%s", i == 0 ? "" : ",",
+                     std::to_string(index.keys.key_[i]).c_str());
+      }
+      std::fprintf(out_, "]}");
+    }
+    for (size_t i = 0; i <= index.size; ++i) {
+      bool child_exported = exported && i % sample_ == 0;
+      if (depth + 1 == report_.height) {
+        visitLeaf(index.children[i], id, child_exported);
+      } else {
+        visitIndex(index.children[i], depth + 1, id, child_exported);
+      }
+    }
+  }
+
+  void visitLeaf(int addr, int parent, bool exported) {
+    Block<Key, Value> leaf;
+    if (!mark(leaf_seen_, addr, sizeof(leaf)) || !read(block_fd_, leaf, addr) ||
+        leaf.size > DEFAULT_LEAF_SIZE + 1) {
+      return;
+    }
+    count(report_.levels[report_.height], leaf.size, DEFAULT_LEAF_SIZE);
+    if (have_prev_leaf_) {
+      if (prev_next_ != addr) report_.chain_broken++;
+      long long distance =
+          (static_cast<long long>(addr) - prev_addr_) /
+          static_cast<long long>(sizeof(leaf));
+      if (distance == 1) {
+        report_.chain_adjacent++;
+      } else if (distance > 1) {
+        report_.chain_forward++;
+      } else {
+        report_.chain_backward++;
+      }
+      distance_sum_ += distance < 0 ? -distance : distance;
+    }
+    have_prev_leaf_ = true;
+    prev_addr_ = addr;
+    prev_next_ = leaf.next;
+
+    for (size_t i = 0; i < leaf.size; ++i) {
+      const Key_Value<Key, Value> &kv = leaf.data[i];
+      report_.pairs++;
+      if (have_last_key_ && kv < last_) report_.unsorted++;
+      if (have_last_key_ && kv.key == last_.key) {
+        run_++;
+      } else {
+        endRun();
+        run_ = 1;
+      }
+      last_ = kv;
+      have_last_key_ = true;
+    }
+
+    if (!exported || out_ == nullptr) return;
+    int id = beginNode(parent, true);
+    if (last_exported_leaf_ >= 0) link(last_exported_leaf_, id, "leaf-link");
+    last_exported_leaf_ = id;
+    // one entry per distinct key, its values alongside
+    for (size_t i = 0; i < leaf.size; ++i) {
+      if (i > 0 && leaf.data[i].key == leaf.data[i - 1].key) continue;
+      std::fprintf(out_, "%s%s", i == 0 ? "" : ",",
+                   std::to_string(leaf.data[i].key).c_str());
+    }
+    std::fprintf(out_, "],\"values\":[");
+    for (size_t i = 0; i < leaf.size; ++i) {
+      bool first = i == 0 || leaf.data[i].key != leaf.data[i - 1].key;
+      bool last = i + 1 == leaf.size || leaf.data[i].key != leaf.data[i + 1].key;
+      std::fprintf(out_, "%s%s%s%s", first && i > 0 ? "," : "",
+                   first ? "[" : ",",
+                   std::to_string(leaf.data[i].value).c_str(), last ? "]" : "");
+    }
+    std::fprintf(out_, "]}");
+  }
+
+  void endRun() {
+    if (run_ == 0) return;
+    report_.distinct_keys++;
+    int bucket = 63 - __builtin_clzll(run_);
+    report_.runs[bucket < RUN_BUCKETS ? bucket : RUN_BUCKETS - 1]++;
+    if (run_ > report_.longest_run) report_.longest_run = run_;
+    run_ = 0;
+  }
+
+  int index_fd_;
+  int block_fd_;
+  Report report_;
+  std::vector<bool> index_seen_;
+  std::vector<bool> leaf_seen_;
+
+  std::FILE *out_ = nullptr;
+  std::FILE *links_ = nullptr;
+  int sample_ = 1;
+  int next_id_ = 0;
+  int last_exported_leaf_ = -1;
+  bool first_node_ = true;
+
+  bool have_prev_leaf_ = false;
+  int prev_addr_ = 0;
+  int prev_next_ = -1;
+  double distance_sum_ = 0;
+
+  bool have_last_key_ = false;
+  Key_Value<Key, Value> last_;
+  uint64_t run_ = 0;
+};
+
+#endif  // BPT_INSPECT_HPP
@@ -0,0 +1,202 @@
+#ifndef BPT_KEYS_HPP
+#define BPT_KEYS_HPP
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "exceptions.hpp"
+#include "hash.hpp"
+
+// Side table from each stored 64-bit key hash back to the key string, so
+// two strings with the same hash are told apart instead of silently
+// sharing a key. It lives in <name>.keys next to the tree: a header with
+// the hash kind, then one (hash, length, bytes) record per distinct key,
+// appended as keys are first inserted and loaded whole on open. A new
+// file is only created with the first key, so a table opened with the
+// wrong hash and never used leaves nothing behind. sjtu::runtime_error is
+// thrown by the constructor if an existing file holds the other hash or
+// its directory is not writable, and by the first insert if the file
+// still cannot be created.
+//
+// On a collision CHAIN tries the key's seeded FastHash values 1, 2, ...
+// until it finds its own record or a hash nobody owns, so every string
+// gets a distinct tree key; REJECT refuses the insert instead. Lookups of
+// a string that was never inserted land on a hash nobody owns either way,
+// so they can never read another key's values.
+class KeyTable {
+ public:
+  enum Policy : char { CHAIN, REJECT };
+
+  KeyTable(const std::string &filename, HashKind kind, Policy policy)
+      : kind_(kind),
+        policy_(policy),
+        name_(filename + ".keys"),
+        log_(nullptr),
+        used_(0),
+        collisions_(0) {
+    slots_.resize(1024);
+    std::FILE *in = std::fopen(name_.c_str(), "rb");
+    if (in != nullptr) {
+      long valid = load(in);
+      std::fclose(in);
+      // a record cut short by a crash is dropped before appending
+      if (truncate(name_.c_str(), valid) != 0) throw sjtu::runtime_error();
+      log_ = std::fopen(name_.c_str(), "ab");
+      if (log_ == nullptr) throw sjtu::runtime_error();
+    } else {
+      size_t slash = name_.find_last_of('/');
+      std::string dir =
+          slash == std::string::npos ? "." : name_.substr(0, slash + 1);
+      if (access(dir.c_str(), W_OK) != 0) throw sjtu::runtime_error();
+    }
+  }
+
+  ~KeyTable() {
+    if (log_ != nullptr) std::fclose(log_);
+  }
+
+  KeyTable(const KeyTable &) = delete;
+  KeyTable &operator=(const KeyTable &) = delete;
+
+  // the tree key of s; an insert registers s if it is new. false only
+  // when REJECT refuses an insert.
+  bool resolve(const char *s, size_t len, bool inserting, long long &key) {
+    for (uint64_t seed = 0;; ++seed) {
+      uint64_t hash = seed == 0 ? HashKey(kind_, s, len)
+                                : FastHash(s, len, seed);
+      Slot *slot = find(hash);
+      if (slot->length == EMPTY) {
+        if (inserting) add(slot, hash, s, len);
+        key = static_cast<long long>(hash);
+        return true;
+      }
+      if (slot->length == len &&
+          std::memcmp(arena_.data() + slot->offset, s, len) == 0) {
+        key = static_cast<long long>(hash);
+        return true;
+      }
+      if (inserting && policy_ == REJECT) {
+        collisions_++;
+        return false;
+      }
+      if (inserting && seed == 0) collisions_++;
+    }
+  }
+
+  size_t size() const { return used_; }
+  // inserts of new strings whose first hash was already taken
+  size_t collisions() const { return collisions_; }
+
+  void flush() {
+    if (log_ != nullptr) std::fflush(log_);
+  }
+
+ private:
+  static constexpr char MAGIC[8] = {'B', 'P', 'T', 'K', 'E', 'Y', 'S', '1'};
+  static constexpr uint32_t EMPTY = UINT32_MAX;
+
+  struct Slot {
+    uint64_t hash = 0;
+    uint64_t offset = 0;
+    uint32_t length = EMPTY;
+  };
+
+  // the slot holding hash, or the empty slot where it would go
+  Slot *find(uint64_t hash) {
+    size_t mask = slots_.size() - 1;
+    // hashes are uniform, the low bits are as good as any
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      if (slots_[i].length == EMPTY || slots_[i].hash == hash) {
+        return &slots_[i];
+      }
+    }
+  }
+
+  void add(Slot *slot, uint64_t hash, const char *s, size_t len) {
+    if (log_ == nullptr) create();
+    slot->hash = hash;
+    slot->offset = arena_.size();
+    slot->length = len;
+    arena_.append(s, len);
+    uint32_t length = len;
+    std::fwrite(&hash, sizeof(hash), 1, log_);
+    std::fwrite(&length, sizeof(length), 1, log_);
+    std::fwrite(s, 1, len, log_);
+    if (++used_ * 2 > slots_.size()) grow();
+  }
+
+  void create() {
+    log_ = std::fopen(name_.c_str(), "wb");
+    if (log_ == nullptr) throw sjtu::runtime_error();
+    std::fwrite(MAGIC, 1, sizeof(MAGIC), log_);
+    std::fputc(static_cast<char>(kind_), log_);
+  }
+
+  void grow() {
+    std::vector<Slot> old;
+    old.swap(slots_);
+    slots_.resize(old.size() * 2);
+    for (const Slot &slot : old) {
+      if (slot.length != EMPTY) *find(slot.hash) = slot;
+    }
+  }
+
+  // returns the length of the file up to the last complete record
+  long load(std::FILE *in) {
+    char magic[sizeof(MAGIC)];
+    if (std::fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+        std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        std::fgetc(in) != static_cast<char>(kind_)) {
+      // not a key table, or one written with the other hash
+      throw sjtu::runtime_error();
+    }
+    long valid = std::ftell(in);
+    uint64_t hash;
+    uint32_t length;
+    std::string bytes;
+    while (std::fread(&hash, sizeof(hash), 1, in) == 1 &&
+           std::fread(&length, sizeof(length), 1, in) == 1) {
+      bytes.resize(length);
+      if (std::fread(bytes.data(), 1, length, in) != length) break;
+      Slot *slot = find(hash);
+      slot->hash = hash;
+      slot->offset = arena_.size();
+      slot->length = length;
+      arena_.append(bytes);
+      if (++used_ * 2 > slots_.size()) grow();
+      valid = std::ftell(in);
+    }
+    return valid;
+  }
+
+  HashKind kind_;
+  Policy policy_;
+  std::string name_;
+  std::vector<Slot> slots_;
+  std::string arena_;
+  std::FILE *log_;
+  size_t used_;
+  size_t collisions_;
+};
+
+// what the command readers use to turn a key string into a tree key
+struct KeyHasher {
+  HashKind kind = HashKind::FAST;
+  KeyTable *table = nullptr;
+
+  // false if the table refused an insert
+  bool operator()(const char *s, size_t len, bool inserting,
+                  long long &key) const {
+    if (table != nullptr) return table->resolve(s, len, inserting, key);
+    key = HashKey(kind, s, len);
+    return true;
+  }
+};
+
+#endif  // BPT_KEYS_HPP
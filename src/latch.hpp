@@ -0,0 +1,126 @@
+#ifndef BPT_LATCH_HPP
+#define BPT_LATCH_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#include "vector.hpp"
+
+namespace sjtu {
+
+// Versioned latch for optimistic lock coupling. Bit 0 is the write bit, the
+// rest of the word counts finished writes, so a reader can remember the
+// version, copy the node and afterwards check that nobody touched it.
+class OptimisticLatch {
+ private:
+  alignas(64) std::atomic<uint64_t> version_;
+
+ public:
+  OptimisticLatch() : version_(0) {}
+
+  // wait until no writer holds the latch and return the current version
+  uint64_t read_version() const {
+    uint64_t version = version_.load(std::memory_order_acquire);
+    while (version & 1) {
+      std::this_thread::yield();
+      version = version_.load(std::memory_order_acquire);
+    }
+    return version;
+  }
+
+  // true if nothing was written since read_version returned `version`
+  bool validate(uint64_t version) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version_.load(std::memory_order_relaxed) == version;
+  }
+
+  // lock only if the latch is still at `version`
+  bool try_upgrade(uint64_t version) {
+    return version_.compare_exchange_strong(version, version + 1,
+                                            std::memory_order_acquire);
+  }
+
+  // lock at whatever version the latch currently has, never waits
+  bool try_lock(uint64_t &version) {
+    version = version_.load(std::memory_order_relaxed);
+    if (version & 1) return false;
+    return try_upgrade(version);
+  }
+
+  void unlock() { version_.fetch_add(1, std::memory_order_release); }
+};
+
+// Fixed table of latches indexed by page address. Pages are never freed, so
+// striping is enough: two pages sharing a slot only cost a spurious restart.
+template <size_t SLOTS = 1024>
+class LatchTable {
+ private:
+  OptimisticLatch latches_[SLOTS];
+
+ public:
+  OptimisticLatch &operator[](int addr) {
+    uint32_t hash = static_cast<uint32_t>(addr) * 2654435761u;
+    return latches_[(hash >> 8) % SLOTS];
+  }
+};
+
+// The latches one writer holds. Every acquisition is a try, so a writer that
+// cannot get a latch releases everything and restarts instead of waiting,
+// which keeps the protocol free of deadlocks. A latch that is already held
+// (because two pages share a slot) is not taken twice.
+class LatchGuard {
+ private:
+  struct Held {
+    OptimisticLatch *latch;
+    uint64_t version;  // version the latch had when we locked it
+  };
+  sjtu::vector<Held> held_;
+
+  int find(OptimisticLatch *latch) const {
+    for (size_t i = 0; i < held_.size(); ++i) {
+      if (held_[i].latch == latch) return i;
+    }
+    return -1;
+  }
+
+ public:
+  LatchGuard() = default;
+  LatchGuard(const LatchGuard &) = delete;
+  LatchGuard &operator=(const LatchGuard &) = delete;
+  ~LatchGuard() { release(); }
+
+  // lock a latch that was read at `version` during the descent
+  bool upgrade(OptimisticLatch &latch, uint64_t version) {
+    int idx = find(&latch);
+    if (idx != -1) return held_[idx].version == version;
+    if (!latch.try_upgrade(version)) return false;
+    held_.push_back({&latch, version});
+    return true;
+  }
+
+  // lock a latch whose version was never observed (e.g. a sibling)
+  bool lock(OptimisticLatch &latch) {
+    if (find(&latch) != -1) return true;
+    uint64_t version;
+    for (int spin = 0; spin < 64; ++spin) {
+      if (latch.try_lock(version)) {
+        held_.push_back({&latch, version});
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void release() {
+    for (size_t i = 0; i < held_.size(); ++i) {
+      held_[i].latch->unlock();
+    }
+    held_.clear();
+  }
+};
+
+}  // namespace sjtu
+
+#endif  // BPT_LATCH_HPP
@@ -0,0 +1,324 @@
+#ifndef BPT_METRICS_HPP
+#define BPT_METRICS_HPP
+
+#include <signal.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include "histogram.hpp"
+#include "vector.hpp"
+
+// Process-wide instrumentation of the tree, the cache and the page files,
+// compiled in with -DBPT_ENABLE_METRICS=ON (which defines BPT_METRICS).
+// Without it every recording function below is an empty inline function
+// and OpTimer an empty object, so the instrumented code is the code that
+// was there before.
+//
+// What is kept:
+//   per operation  a LatencyHistogram of insert, find and remove
+//   per level      page reads served by the cache (hits) and by the file
+//                  (misses); index pages by depth, the root being level 1,
+//                  leaves on their own
+//   counters       splits, merges, borrows, cache evictions, dirty pages
+//                  written back, and the pages and bytes MemoryRiver read
+//                  and wrote
+// Each thread records into its own shard, so recording takes no lock and
+// shares no cache line; snapshot() adds the shards up. dump_json() writes a
+// snapshot, either when called or, after watch_dump_signal(), whenever
+// SIGUSR1 arrives and the owner next calls dump_if_requested().
+namespace sjtu {
+namespace metrics {
+
+#ifdef BPT_METRICS
+inline constexpr bool ENABLED = true;
+#else
+inline constexpr bool ENABLED = false;
+#endif
+
+enum Op { INSERT, FIND, REMOVE, OP_COUNT };
+
+enum Counter {
+  SPLITS,
+  MERGES,
+  BORROWS,
+  EVICTIONS,
+  WRITEBACKS,
+  PAGE_READS,
+  PAGE_WRITES,
+  BYTES_READ,
+  BYTES_WRITTEN,
+  COUNTER_COUNT
+};
+
+// index levels 1 .. LEVELS - 1; deeper pages and index reads nobody set a
+// level for are counted at 0
+constexpr int LEVELS = 16;
+
+struct Snapshot {
+  LatencyHistogram latency[OP_COUNT];
+  uint64_t index_hits[LEVELS] = {};
+  uint64_t index_misses[LEVELS] = {};
+  uint64_t leaf_hits = 0;
+  uint64_t leaf_misses = 0;
+  uint64_t counters[COUNTER_COUNT] = {};
+};
+
+namespace detail {
+
+// written only by its thread, with relaxed loads and stores, so recording
+// is a plain add; snapshots read it concurrently
+struct Shard {
+  std::atomic<uint64_t> latency[OP_COUNT][LatencyHistogram::BUCKETS] = {};
+  std::atomic<uint64_t> latency_sum[OP_COUNT] = {};
+  std::atomic<uint64_t> latency_max[OP_COUNT] = {};
+  std::atomic<uint64_t> index_hits[LEVELS] = {};
+  std::atomic<uint64_t> index_misses[LEVELS] = {};
+  std::atomic<uint64_t> leaf_hits{0};
+  std::atomic<uint64_t> leaf_misses{0};
+  std::atomic<uint64_t> counters[COUNTER_COUNT] = {};
+  // level of the next index page read, see set_level
+  int level = 0;
+};
+
+inline void bump(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+}
+
+inline void add_shard(Snapshot &snap, const Shard &shard) {
+  for (int op = 0; op < OP_COUNT; ++op) {
+    for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+      uint64_t count = shard.latency[op][i].load(std::memory_order_relaxed);
+      if (count != 0) snap.latency[op].add_bucket(i, count);
+    }
+    snap.latency[op].add_totals(
+        shard.latency_sum[op].load(std::memory_order_relaxed),
+        shard.latency_max[op].load(std::memory_order_relaxed));
+  }
+  for (int level = 0; level < LEVELS; ++level) {
+    snap.index_hits[level] += shard.index_hits[level];
+    snap.index_misses[level] += shard.index_misses[level];
+  }
+  snap.leaf_hits += shard.leaf_hits;
+  snap.leaf_misses += shard.leaf_misses;
+  for (int c = 0; c < COUNTER_COUNT; ++c) snap.counters[c] += shard.counters[c];
+}
+
+// the shards of live threads, and what exited threads left behind
+class Registry {
+ public:
+  void enroll(Shard *shard) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shards_.push_back(shard);
+  }
+
+  void retire(Shard *shard) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    add_shard(retired_, *shard);
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      if (shards_[i] == shard) {
+        shards_[i] = shards_.back();
+        shards_.pop_back();
+        break;
+      }
+    }
+    delete shard;
+  }
+
+  Snapshot snapshot() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Snapshot snap = retired_;
+    for (size_t i = 0; i < shards_.size(); ++i) add_shard(snap, *shards_[i]);
+    return snap;
+  }
+
+ private:
+  std::mutex mutex_;
+  sjtu::vector<Shard *> shards_;
+  Snapshot retired_;
+};
+
+inline Registry &registry() {
+  static Registry *registry = new Registry();  // outlives thread exits
+  return *registry;
+}
+
+struct ShardHandle {
+  Shard *shard;
+  ShardHandle() : shard(new Shard()) { registry().enroll(shard); }
+  ~ShardHandle() { registry().retire(shard); }
+};
+
+inline Shard &shard() {
+  static thread_local ShardHandle handle;
+  return *handle.shard;
+}
+
+inline std::atomic<bool> &dump_requested() {
+  static std::atomic<bool> requested{false};
+  return requested;
+}
+
+inline std::string &dump_path() {
+  static std::string path;
+  return path;
+}
+
+inline void on_dump_signal(int) { dump_requested() = true; }
+
+}  // namespace detail
+
+inline void count(Counter counter, uint64_t n = 1) {
+  if constexpr (ENABLED) detail::bump(detail::shard().counters[counter], n);
+}
+
+// the depth of the index page this thread reads next; used up by the read
+inline void set_level(int level) {
+  if constexpr (ENABLED) detail::shard().level = level < LEVELS ? level : 0;
+}
+
+// a page read through the cache; hit if no file access was needed
+inline void page_read(bool leaf, bool hit) {
+  if constexpr (ENABLED) {
+    detail::Shard &shard = detail::shard();
+    if (leaf) {
+      detail::bump(hit ? shard.leaf_hits : shard.leaf_misses);
+    } else {
+      detail::bump(hit ? shard.index_hits[shard.level]
+                       : shard.index_misses[shard.level]);
+      shard.level = 0;
+    }
+  }
+}
+
+inline void record_latency(Op op, uint64_t ns) {
+  if constexpr (ENABLED) {
+    detail::Shard &shard = detail::shard();
+    detail::bump(shard.latency[op][LatencyHistogram::bucket(ns)]);
+    detail::bump(shard.latency_sum[op], ns);
+    if (ns > shard.latency_max[op].load(std::memory_order_relaxed)) {
+      shard.latency_max[op].store(ns, std::memory_order_relaxed);
+    }
+  }
+}
+
+// times the scope it lives in as one op
+class OpTimer {
+ public:
+  explicit OpTimer(Op op) {
+    if constexpr (ENABLED) {
+      op_ = op;
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~OpTimer() {
+    if constexpr (ENABLED) {
+      record_latency(op_, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - start_)
+                              .count());
+    }
+  }
+
+  OpTimer(const OpTimer &) = delete;
+  OpTimer &operator=(const OpTimer &) = delete;
+
+ private:
+  Op op_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+inline Snapshot snapshot() {
+  if constexpr (ENABLED) return detail::registry().snapshot();
+  return Snapshot();
+}
+
+inline void dump_json(std::FILE *out) {
+  if constexpr (!ENABLED) {
+    std::fprintf(out, "{\"enabled\":false}\n");
+    return;
+  }
+  static const char *op_names[] = {"insert", "find", "remove"};
+  static const char *counter_names[] = {
+      "splits",     "merges",      "borrows",    "evictions",
+      "writebacks", "page_reads",  "page_writes", "bytes_read",
+      "bytes_written"};
+  Snapshot snap = snapshot();
+  std::fprintf(out, "{\"enabled\":true,\"ops\":{");
+  for (int op = 0; op < OP_COUNT; ++op) {
+    const LatencyHistogram &h = snap.latency[op];
+    std::fprintf(out,
+                 "%s\"%s\":{\"count\":%llu,\"mean_ns\":%.1f,\"p50_ns\":%llu,"
+                 "\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+                 "\"max_ns\":%llu,\"buckets\":[",
+                 op == 0 ? "" : ",", op_names[op],
+                 static_cast<unsigned long long>(h.count()), h.mean(),
+                 static_cast<unsigned long long>(h.percentile(0.5)),
+                 static_cast<unsigned long long>(h.percentile(0.9)),
+                 static_cast<unsigned long long>(h.percentile(0.99)),
+                 static_cast<unsigned long long>(h.percentile(0.999)),
+                 static_cast<unsigned long long>(h.max()));
+    bool first = true;
+    h.for_each_bucket([&](uint64_t lowest, uint64_t count) {
+      std::fprintf(out, "%s[%llu,%llu]", first ? "" : ",",
+                   static_cast<unsigned long long>(lowest),
+                   static_cast<unsigned long long>(count));
+      first = false;
+    });
+    std::fprintf(out, "]}");
+  }
+  std::fprintf(out, "},\"levels\":[");
+  bool first = true;
+  for (int level = 0; level < LEVELS; ++level) {
+    if (snap.index_hits[level] == 0 && snap.index_misses[level] == 0) continue;
+    std::fprintf(out, "%s{\"level\":%d,\"hits\":%llu,\"misses\":%llu}",
+                 first ? "" : ",", level,
+                 static_cast<unsigned long long>(snap.index_hits[level]),
+                 static_cast<unsigned long long>(snap.index_misses[level]));
+    first = false;
+  }
+  std::fprintf(out, "],\"leaves\":{\"hits\":%llu,\"misses\":%llu}",
+               static_cast<unsigned long long>(snap.leaf_hits),
+               static_cast<unsigned long long>(snap.leaf_misses));
+  for (int c = 0; c < COUNTER_COUNT; ++c) {
+    std::fprintf(out, ",\"%s\":%llu", counter_names[c],
+                 static_cast<unsigned long long>(snap.counters[c]));
+  }
+  std::fprintf(out, "}\n");
+}
+
+// writes a snapshot to path, replacing it; false if it cannot be written
+inline bool dump_json(const std::string &path) {
+  std::FILE *out = std::fopen(path.c_str(), "w");
+  if (out == nullptr) return false;
+  dump_json(out);
+  std::fclose(out);
+  return true;
+}
+
+// SIGUSR1 asks for a dump to path at the next dump_if_requested()
+inline void watch_dump_signal(const std::string &path) {
+  detail::dump_path() = path;
+  struct sigaction action {};
+  action.sa_handler = detail::on_dump_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, nullptr);
+}
+
+// cheap enough to call once per command
+inline void dump_if_requested() {
+  if (detail::dump_requested().load(std::memory_order_relaxed) &&
+      detail::dump_requested().exchange(false)) {
+    dump_json(detail::dump_path());
+  }
+}
+
+}  // namespace metrics
+}  // namespace sjtu
+
+#endif  // BPT_METRICS_HPP
@@ -0,0 +1,131 @@
+#ifndef BPT_PIPELINE_HPP
+#define BPT_PIPELINE_HPP
+
+#include <cstddef>
+#include <thread>
+
+#include "command.hpp"
+#include "metrics.hpp"
+#include "spsc.hpp"
+#include "trace.hpp"
+#include "vector.hpp"
+
+// commands handed from one pipeline stage to the next at a time
+constexpr size_t PIPELINE_BATCH = 4096;
+// batches in circulation; bounds how far parsing runs ahead of output
+constexpr size_t PIPELINE_DEPTH = 16;
+
+// A batch of parsed commands and, once executed, the answers of its finds:
+// the values of all finds one after another, and where each find's values
+// end.
+struct CommandBatch {
+  Command commands[PIPELINE_BATCH];
+  size_t size = 0;
+  bool last = false;
+  sjtu::vector<int> values;
+  sjtu::vector<size_t> ends;
+};
+
+// Runs n commands as three stages on three threads: parsing and hashing,
+// the tree operations (on the calling thread), and formatting the answers.
+// Batches go around a ring of SPSC queues, parse -> execute -> output ->
+// parse, so each stage only waits when the one behind it is full or the
+// one ahead of it is empty, and since every queue is FIFO the output
+// comes out in command order. With a trace, the execute stage also
+// appends every command to it as it runs it, and a SIGUSR1 metrics dump
+// is taken between batches.
+template <class Tree>
+void run_pipelined(sjtu::CommandReader &in, long long n, Tree &tree,
+                   sjtu::OutputBuffer &out, TraceWriter *trace = nullptr) {
+  sjtu::SpscQueue<CommandBatch *> free_batches(PIPELINE_DEPTH);
+  sjtu::SpscQueue<CommandBatch *> parsed(PIPELINE_DEPTH);
+  sjtu::SpscQueue<CommandBatch *> executed(PIPELINE_DEPTH);
+  CommandBatch *batches = new CommandBatch[PIPELINE_DEPTH];
+  for (size_t i = 0; i < PIPELINE_DEPTH; ++i) {
+    free_batches.try_push(&batches[i]);
+  }
+
+  auto take = [](sjtu::SpscQueue<CommandBatch *> &queue) {
+    CommandBatch *batch;
+    int spins = 0;
+    while (!queue.try_pop(batch)) sjtu::backoff(spins);
+    return batch;
+  };
+  auto give = [](sjtu::SpscQueue<CommandBatch *> &queue,
+                 CommandBatch *batch) {
+    int spins = 0;
+    while (!queue.try_push(batch)) sjtu::backoff(spins);
+  };
+
+  std::thread parser([&] {
+    long long left = n;
+    while (true) {
+      CommandBatch *batch = take(free_batches);
+      batch->size = 0;
+      while (left > 0 && batch->size < PIPELINE_BATCH &&
+             in.next(batch->commands[batch->size])) {
+        batch->size++;
+        left--;
+      }
+      batch->last = batch->size < PIPELINE_BATCH;
+      if (batch->last) left = 0;
+      give(parsed, batch);
+      if (batch->last) return;
+    }
+  });
+
+  std::thread printer([&] {
+    while (true) {
+      CommandBatch *batch = take(executed);
+      size_t begin = 0;
+      for (size_t i = 0; i < batch->ends.size(); ++i) {
+        size_t end = batch->ends[i];
+        if (begin == end) {
+          out.put("null\n", 5);
+        } else {
+          for (size_t j = begin; j < end; ++j) {
+            out.put(batch->values[j]);
+            out.put(' ');
+          }
+          out.put('\n');
+        }
+        begin = end;
+      }
+      bool last = batch->last;
+      give(free_batches, batch);
+      if (last) return;
+    }
+  });
+
+  while (true) {
+    CommandBatch *batch = take(parsed);
+    batch->values.clear();
+    batch->ends.clear();
+    for (size_t i = 0; i < batch->size; ++i) {
+      const Command &command = batch->commands[i];
+      if (trace != nullptr && command.kind != Command::UNKNOWN) {
+        trace->record(command.kind, command.key, command.value);
+      }
+      if (command.kind == Command::INSERT) {
+        tree.insert(command.key, command.value);
+      } else if (command.kind == Command::FIND) {
+        sjtu::vector<int> found = tree.find(command.key);
+        for (size_t j = 0; j < found.size(); ++j) {
+          batch->values.push_back(found[j]);
+        }
+        batch->ends.push_back(batch->values.size());
+      } else if (command.kind == Command::REMOVE) {
+        tree.remove(command.key, command.value);
+      }
+    }
+    bool last = batch->last;
+    give(executed, batch);
+    sjtu::metrics::dump_if_requested();
+    if (last) break;
+  }
+  parser.join();
+  printer.join();
+  delete[] batches;
+}
+
+#endif  // BPT_PIPELINE_HPP
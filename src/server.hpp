@@ -0,0 +1,376 @@
+#ifndef BPT_SERVER_HPP
+#define BPT_SERVER_HPP
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "command.hpp"
+#include "keys.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "vector.hpp"
+
+// first byte of a connection that speaks the binary framing instead of
+// text; no text command starts with it
+constexpr unsigned char BINARY_HELLO = 0xB7;
+// a connection is not read while this much of its output is unsent
+constexpr size_t SERVER_OUTPUT_LIMIT = 16 << 20;
+// bytes read from one connection per wakeup, so a busy client cannot
+// starve the others
+constexpr size_t SERVER_READ_BUDGET = 1 << 20;
+// a text line longer than this closes the connection
+constexpr size_t SERVER_LINE_LIMIT = 1 << 16;
+
+// Serves one tree to many clients over a Unix-domain socket ("unix:PATH")
+// or a loopback TCP port ("tcp:PORT") from a single-threaded epoll loop,
+// so the tree and its cache stay open and warm between clients.
+//
+// A connection speaks the text protocol of code.cpp without the count
+// line: one insert/find/delete per line, and one answer line per find.
+// Every complete line that has arrived is executed as soon as it is read
+// and answers are sent in command order, so a client may write many
+// commands before reading any answer.
+//
+// A connection whose first byte is BINARY_HELLO uses frames instead, in
+// host byte order:
+//   request  u8 kind (Command::Kind), u8 key length, i32 value, key bytes
+//   answer   u32 count, count x i32, for each FIND only
+//
+// run() returns on SIGINT or SIGTERM; the tree is closed by its owner.
+// With record() every executed command is also appended to a trace, in
+// the order the server ran them.
+template <class Tree>
+class CommandServer {
+ public:
+  CommandServer(Tree &tree, KeyHasher hasher)
+      : tree_(tree),
+        hasher_(hasher),
+        trace_(nullptr),
+        listen_fd_(-1),
+        epoll_fd_(-1) {}
+
+  ~CommandServer() {
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+    if (listen_fd_ >= 0) close(listen_fd_);
+    if (!unix_path_.empty()) unlink(unix_path_.c_str());
+  }
+
+  CommandServer(const CommandServer &) = delete;
+  CommandServer &operator=(const CommandServer &) = delete;
+
+  // appends every executed command to trace from now on; nullptr stops
+  void record(TraceWriter *trace) { trace_ = trace; }
+
+  // false, with a message on stderr, if the address cannot be served
+  bool listen(const std::string &address) {
+    if (address.rfind("unix:", 0) == 0) {
+      std::string path = address.substr(5);
+      sockaddr_un addr{};
+      if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        return fail("bad unix socket path", false);
+      }
+      addr.sun_family = AF_UNIX;
+      std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+      listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if (listen_fd_ < 0) return fail("socket");
+      unlink(path.c_str());
+      if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr),
+               sizeof(addr)) != 0) {
+        return fail("bind");
+      }
+      unix_path_ = path;
+    } else if (address.rfind("tcp:", 0) == 0) {
+      int port = std::atoi(address.c_str() + 4);
+      if (port <= 0 || port > 65535) return fail("bad tcp port", false);
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(port);
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if (listen_fd_ < 0) return fail("socket");
+      int one = 1;
+      setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr),
+               sizeof(addr)) != 0) {
+        return fail("bind");
+      }
+    } else {
+      return fail("address must be unix:PATH or tcp:PORT", false);
+    }
+    if (::listen(listen_fd_, 128) != 0) return fail("listen");
+    epoll_fd_ = epoll_create1(0);
+    if (epoll_fd_ < 0) return fail("epoll_create1");
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;  // the listening socket
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+    return true;
+  }
+
+  void run() {
+    stopping() = 0;
+    struct sigaction action{};
+    action.sa_handler = [](int) { stopping() = 1; };
+    // no SA_RESTART, so epoll_wait returns with EINTR
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    epoll_event events[64];
+    while (!stopping()) {
+      // SIGUSR1 interrupts the wait, see metrics.hpp
+      sjtu::metrics::dump_if_requested();
+      int n = epoll_wait(epoll_fd_, events, 64, -1);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        std::perror("epoll_wait");
+        break;
+      }
+      for (int i = 0; i < n; ++i) {
+        if (events[i].data.ptr == nullptr) {
+          accept_all();
+          continue;
+        }
+        Connection *conn = static_cast<Connection *>(events[i].data.ptr);
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+          receive(conn);
+        }
+        if (!conn->closed) send_pending(conn);
+        update(conn);
+      }
+    }
+    for (size_t i = 0; i < connections_.size(); ++i) {
+      close(connections_[i]->fd);
+      delete connections_[i];
+    }
+    connections_.clear();
+  }
+
+ private:
+  struct Connection {
+    int fd;
+    std::string in;
+    std::string out;
+    size_t sent = 0;
+    bool binary = false;
+    bool started = false;
+    bool eof = false;
+    bool closed = false;
+    uint32_t events = 0;
+  };
+
+  static volatile sig_atomic_t &stopping() {
+    static volatile sig_atomic_t flag = 0;
+    return flag;
+  }
+
+  // system is false when errno has nothing to do with it
+  bool fail(const char *what, bool system = true) {
+    if (system) {
+      std::fprintf(stderr, "%s: %s\n", what, std::strerror(errno));
+    } else {
+      std::fprintf(stderr, "%s\n", what);
+    }
+    return false;
+  }
+
+  void accept_all() {
+    while (true) {
+      int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK);
+      if (fd < 0) return;
+      int one = 1;
+      // answers are written in bursts already; don't hold them back
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      Connection *conn = new Connection;
+      conn->fd = fd;
+      conn->events = EPOLLIN;
+      epoll_event event{};
+      event.events = conn->events;
+      event.data.ptr = conn;
+      epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+      connections_.push_back(conn);
+    }
+  }
+
+  void receive(Connection *conn) {
+    char buf[1 << 16];
+    size_t budget = SERVER_READ_BUDGET;
+    while (budget > 0 && conn->out.size() - conn->sent < SERVER_OUTPUT_LIMIT) {
+      ssize_t got = read(conn->fd, buf, sizeof(buf));
+      if (got > 0) {
+        conn->in.append(buf, got);
+        budget -= got < static_cast<ssize_t>(budget) ? got : budget;
+        continue;
+      }
+      if (got == 0 || (errno != EAGAIN && errno != EINTR)) conn->eof = true;
+      if (got == 0 || errno != EINTR) break;
+    }
+    if (!conn->started && !conn->in.empty()) {
+      conn->started = true;
+      if (static_cast<unsigned char>(conn->in[0]) == BINARY_HELLO) {
+        conn->binary = true;
+        conn->in.erase(0, 1);
+      }
+    }
+    // a last line without its newline still counts once the client is done
+    if (conn->eof && !conn->binary && !conn->in.empty()) {
+      conn->in.push_back('\n');
+    }
+    if (!(conn->binary ? execute_binary(conn) : execute_text(conn))) {
+      conn->eof = true;  // malformed input
+      conn->in.clear();
+    }
+  }
+
+  // every complete line; false if a line is too long
+  bool execute_text(Connection *conn) {
+    size_t end = conn->in.rfind('\n');
+    if (end == std::string::npos) {
+      return conn->in.size() <= SERVER_LINE_LIMIT;
+    }
+    sjtu::CommandReader reader(conn->in.data(), end + 1, hasher_);
+    Command command;
+    while (reader.next(command)) {
+      if (trace_ != nullptr && command.kind != Command::UNKNOWN) {
+        trace_->record(command.kind, command.key, command.value);
+      }
+      if (command.kind == Command::INSERT) {
+        tree_.insert(command.key, command.value);
+      } else if (command.kind == Command::REMOVE) {
+        tree_.remove(command.key, command.value);
+      } else if (command.kind == Command::FIND) {
+        put_text(conn->out, tree_.find(command.key));
+      }
+    }
+    conn->in.erase(0, end + 1);
+    return conn->in.size() <= SERVER_LINE_LIMIT;
+  }
+
+  // every complete frame; false on an unknown kind
+  bool execute_binary(Connection *conn) {
+    size_t pos = 0;
+    const std::string &in = conn->in;
+    while (in.size() - pos >= 6) {
+      unsigned char kind = in[pos];
+      size_t len = static_cast<unsigned char>(in[pos + 1]);
+      if (in.size() - pos < 6 + len) break;
+      int32_t value;
+      std::memcpy(&value, in.data() + pos + 2, 4);
+      const char *key = in.data() + pos + 6;
+      pos += 6 + len;
+      long long hash;
+      if (kind >= Command::UNKNOWN) return false;
+      if (!hasher_(key, len, kind == Command::INSERT, hash)) continue;
+      if (trace_ != nullptr) {
+        trace_->record(static_cast<Command::Kind>(kind), hash, value);
+      }
+      if (kind == Command::INSERT) {
+        tree_.insert(hash, value);
+      } else if (kind == Command::REMOVE) {
+        tree_.remove(hash, value);
+      } else {
+        put_binary(conn->out, tree_.find(hash));
+      }
+    }
+    conn->in.erase(0, pos);
+    return true;
+  }
+
+  static void put_text(std::string &out, const sjtu::vector<int> &values) {
+    if (values.size() == 0) {
+      out.append("null\n", 5);
+      return;
+    }
+    char buf[16];
+    for (size_t i = 0; i < values.size(); ++i) {
+      char *end = std::to_chars(buf, buf + sizeof(buf), values[i]).ptr;
+      *end++ = ' ';
+      out.append(buf, end - buf);
+    }
+    out.push_back('\n');
+  }
+
+  static void put_binary(std::string &out, const sjtu::vector<int> &values) {
+    uint32_t count = values.size();
+    out.append(reinterpret_cast<const char *>(&count), 4);
+    for (size_t i = 0; i < values.size(); ++i) {
+      int32_t value = values[i];
+      out.append(reinterpret_cast<const char *>(&value), 4);
+    }
+  }
+
+  void send_pending(Connection *conn) {
+    while (conn->sent < conn->out.size()) {
+      ssize_t done = send(conn->fd, conn->out.data() + conn->sent,
+                          conn->out.size() - conn->sent, MSG_NOSIGNAL);
+      if (done > 0) {
+        conn->sent += done;
+        continue;
+      }
+      if (done < 0 && errno == EINTR) continue;
+      if (done < 0 && errno != EAGAIN) conn->closed = true;
+      break;
+    }
+    if (conn->sent == conn->out.size()) {
+      conn->out.clear();
+      conn->sent = 0;
+    } else if (conn->sent > (1 << 20)) {
+      conn->out.erase(0, conn->sent);
+      conn->sent = 0;
+    }
+  }
+
+  // close a finished connection, or watch it for what it waits on
+  void update(Connection *conn) {
+    bool pending = conn->sent < conn->out.size();
+    if (conn->closed || (conn->eof && !pending)) {
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+      close(conn->fd);
+      for (size_t i = 0; i < connections_.size(); ++i) {
+        if (connections_[i] == conn) {
+          connections_[i] = connections_.back();
+          connections_.pop_back();
+          break;
+        }
+      }
+      delete conn;
+      return;
+    }
+    uint32_t events = 0;
+    if (!conn->eof && conn->out.size() - conn->sent < SERVER_OUTPUT_LIMIT) {
+      events |= EPOLLIN;
+    }
+    if (pending) events |= EPOLLOUT;
+    if (events != conn->events) {
+      conn->events = events;
+      epoll_event event{};
+      event.events = events;
+      event.data.ptr = conn;
+      epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn->fd, &event);
+    }
+  }
+
+  Tree &tree_;
+  KeyHasher hasher_;
+  TraceWriter *trace_;
+  int listen_fd_;
+  int epoll_fd_;
+  std::string unix_path_;
+  sjtu::vector<Connection *> connections_;
+};
+
+#endif  // BPT_SERVER_HPP
@@ -0,0 +1,378 @@
+#ifndef BPT_SHARDED_HPP
+#define BPT_SHARDED_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "BPT.hpp"
+#include "exceptions.hpp"
+#include "spsc.hpp"
+#include "vector.hpp"
+
+// requests a session can have queued per shard before its pushes wait
+constexpr size_t SHARD_QUEUE_CAPACITY = 1024;
+
+// N independent BPTs (files <filename>_shard<i>), each owned by one worker
+// thread. A key always lives in the shard its hash picks, so a shard's tree
+// is only ever touched by its worker and its latches never contend.
+//
+// Clients talk to the workers through sessions: a session has one SPSC
+// queue per shard and must be used by one thread at a time. Writes are
+// queued and return at once; reads wait for their answer, and since a
+// queue is FIFO they see every earlier write of the same session. find_many
+// and scan are sent to every shard involved and the answers merged in key
+// order. The plain member functions go through a shared session under a
+// mutex, which is convenient but serializes the callers.
+template <class Key, class Value, class Storage = FileStorage<Key, Value>>
+class ShardedBPT {
+ public:
+  using Tree = BPT<Key, Value, Storage>;
+  using Sink = std::function<void(const Key &, const Value &)>;
+
+ private:
+  struct Request {
+    enum Kind : char { INSERT, REMOVE, FIND, FIND_MANY, SCAN };
+    Kind kind;
+    Key key;  // lo for SCAN
+    Key hi;
+    Value value;
+    const sjtu::vector<Key> *keys;  // FIND_MANY
+    sjtu::vector<Value> *values;  // FIND
+    sjtu::vector<Key_Value<Key, Value>> *pairs;  // FIND_MANY, SCAN
+    std::atomic<int> *pending;  // reads only
+  };
+
+  struct Slot {
+    std::atomic<bool> used{false};
+    // one queue per shard, allocated the first time the slot is taken
+    sjtu::vector<sjtu::SpscQueue<Request> *> queues;
+    // writes of this slot applied so far, by all shards together
+    std::atomic<long long> applied{0};
+  };
+
+ public:
+  class Session {
+   public:
+    Session(Session &&other) noexcept
+        : owner_(other.owner_), slot_(other.slot_),
+          submitted_(other.submitted_) {
+      other.owner_ = nullptr;
+    }
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+    ~Session() {
+      if (owner_ == nullptr) return;
+      sync();
+      owner_->releaseSlot(slot_);
+    }
+
+    void insert(const Key &key, const Value &value) {
+      write(Request::INSERT, key, value);
+    }
+    void remove(const Key &key, const Value &value) {
+      write(Request::REMOVE, key, value);
+    }
+
+    sjtu::vector<Value> find(const Key &key) {
+      sjtu::vector<Value> result;
+      std::atomic<int> pending(1);
+      Request request{};
+      request.kind = Request::FIND;
+      request.key = key;
+      request.values = &result;
+      request.pending = &pending;
+      push(owner_->shard_of(key), request);
+      wait(pending);
+      return result;
+    }
+
+    // keys are split by shard, each shard runs BPT::find_many on its part
+    void find_many(const sjtu::vector<Key> &keys, const Sink &sink) {
+      int shards = owner_->shards();
+      sjtu::vector<sjtu::vector<Key>> parts;
+      sjtu::vector<sjtu::vector<Key_Value<Key, Value>>> answers;
+      for (int shard = 0; shard < shards; ++shard) {
+        parts.push_back(sjtu::vector<Key>());
+        answers.push_back(sjtu::vector<Key_Value<Key, Value>>());
+      }
+      for (size_t i = 0; i < keys.size(); ++i) {
+        parts[owner_->shard_of(keys[i])].push_back(keys[i]);
+      }
+      std::atomic<int> pending(0);
+      for (int shard = 0; shard < shards; ++shard) {
+        if (!parts[shard].empty()) pending++;
+      }
+      for (int shard = 0; shard < shards; ++shard) {
+        if (parts[shard].empty()) continue;
+        Request request{};
+        request.kind = Request::FIND_MANY;
+        request.keys = &parts[shard];
+        request.pairs = &answers[shard];
+        request.pending = &pending;
+        push(shard, request);
+      }
+      wait(pending);
+      merge(answers, sink);
+    }
+
+    // every pair with lo <= key <= hi, in key order
+    void scan(const Key &lo, const Key &hi, const Sink &sink) {
+      int shards = owner_->shards();
+      sjtu::vector<sjtu::vector<Key_Value<Key, Value>>> answers;
+      for (int shard = 0; shard < shards; ++shard) {
+        answers.push_back(sjtu::vector<Key_Value<Key, Value>>());
+      }
+      std::atomic<int> pending(shards);
+      for (int shard = 0; shard < shards; ++shard) {
+        Request request{};
+        request.kind = Request::SCAN;
+        request.key = lo;
+        request.hi = hi;
+        request.pairs = &answers[shard];
+        request.pending = &pending;
+        push(shard, request);
+      }
+      wait(pending);
+      merge(answers, sink);
+    }
+
+    // wait until every write queued by this session has been applied
+    void sync() {
+      Slot &slot = owner_->slots_[slot_];
+      int spins = 0;
+      while (slot.applied.load(std::memory_order_acquire) != submitted_) {
+        sjtu::backoff(spins);
+      }
+    }
+
+   private:
+    friend class ShardedBPT;
+    Session(ShardedBPT *owner, int slot)
+        : owner_(owner), slot_(slot), submitted_(0) {}
+
+    void write(typename Request::Kind kind, const Key &key,
+               const Value &value) {
+      Request request{};
+      request.kind = kind;
+      request.key = key;
+      request.value = value;
+      submitted_++;
+      push(owner_->shard_of(key), request);
+    }
+
+    void push(int shard, const Request &request) {
+      sjtu::SpscQueue<Request> *queue = owner_->slots_[slot_].queues[shard];
+      int spins = 0;
+      while (!queue->try_push(request)) {
+        sjtu::backoff(spins);
+      }
+    }
+
+    static void wait(std::atomic<int> &pending) {
+      int spins = 0;
+      while (pending.load(std::memory_order_acquire) != 0) {
+        sjtu::backoff(spins);
+      }
+    }
+
+    // k-way merge of per-shard answers that are each in key order; a key
+    // lives in one shard, so ties between shards cannot happen
+    static void merge(
+        const sjtu::vector<sjtu::vector<Key_Value<Key, Value>>> &answers,
+        const Sink &sink) {
+      sjtu::vector<size_t> next;
+      for (size_t i = 0; i < answers.size(); ++i) next.push_back(0);
+      while (true) {
+        int best = -1;
+        for (size_t i = 0; i < answers.size(); ++i) {
+          if (next[i] == answers[i].size()) continue;
+          if (best == -1 ||
+              answers[i][next[i]].key < answers[best][next[best]].key) {
+            best = i;
+          }
+        }
+        if (best == -1) return;
+        const Key_Value<Key, Value> &kv = answers[best][next[best]++];
+        sink(kv.key, kv.value);
+      }
+    }
+
+    ShardedBPT *owner_;
+    int slot_;
+    long long submitted_;
+  };
+
+  // at most max_sessions sessions (the shared one included) may be open at
+  // the same time
+  ShardedBPT(const std::string &filename, int shards, int max_sessions = 64)
+      : shards_(shards),
+        max_sessions_(max_sessions),
+        slots_(new Slot[max_sessions]),
+        slots_used_(0),
+        stop_(false) {
+    for (int i = 0; i < shards_; ++i) {
+      trees_.push_back(new Tree(filename + "_shard" + std::to_string(i)));
+    }
+    for (int i = 0; i < shards_; ++i) {
+      workers_.push_back(new std::thread([this, i] { work(i); }));
+    }
+    shared_.reset(new Session(session()));
+  }
+
+  ~ShardedBPT() {
+    shared_.reset();
+    stop_ = true;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      workers_[i]->join();
+      delete workers_[i];
+    }
+    for (size_t i = 0; i < trees_.size(); ++i) {
+      delete trees_[i];
+    }
+    for (int i = 0; i < slots_used_; ++i) {
+      for (size_t j = 0; j < slots_[i].queues.size(); ++j) {
+        delete slots_[i].queues[j];
+      }
+    }
+    delete[] slots_;
+  }
+
+  ShardedBPT(const ShardedBPT &) = delete;
+  ShardedBPT &operator=(const ShardedBPT &) = delete;
+
+  // throws sjtu::runtime_error when max_sessions are open
+  Session session() {
+    std::lock_guard<std::mutex> lock(slot_mutex_);
+    for (int i = 0; i < max_sessions_; ++i) {
+      if (slots_[i].used) continue;
+      if (i == slots_used_) {
+        for (int shard = 0; shard < shards_; ++shard) {
+          slots_[i].queues.push_back(
+              new sjtu::SpscQueue<Request>(SHARD_QUEUE_CAPACITY));
+        }
+        // workers only poll slots below slots_used_
+        slots_used_.store(i + 1, std::memory_order_release);
+      }
+      slots_[i].used = true;
+      slots_[i].applied = 0;
+      return Session(this, i);
+    }
+    throw sjtu::runtime_error();
+  }
+
+  void insert(const Key &key, const Value &value) {
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    shared_->insert(key, value);
+  }
+  void remove(const Key &key, const Value &value) {
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    shared_->remove(key, value);
+  }
+  sjtu::vector<Value> find(const Key &key) {
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    return shared_->find(key);
+  }
+  void find_many(const sjtu::vector<Key> &keys, const Sink &sink) {
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    shared_->find_many(keys, sink);
+  }
+  void scan(const Key &lo, const Key &hi, const Sink &sink) {
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    shared_->scan(lo, hi, sink);
+  }
+  void sync() {
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    shared_->sync();
+  }
+
+  int shards() const { return shards_; }
+
+  int shard_of(const Key &key) const {
+    uint64_t hash = static_cast<uint64_t>(std::hash<Key>()(key));
+    return ((hash * 0x9e3779b97f4a7c15ull) >> 32) % shards_;
+  }
+
+  // the tree behind one shard, for statistics; BPT is thread-safe, but
+  // writing to it directly bypasses the sessions' ordering
+  Tree &shard(int i) { return *trees_[i]; }
+
+ private:
+  void releaseSlot(int slot) {
+    std::lock_guard<std::mutex> lock(slot_mutex_);
+    slots_[slot].used = false;
+  }
+
+  // the only thread that touches trees_[shard]
+  void work(int shard) {
+    Tree &tree = *trees_[shard];
+    int spins = 0;
+    while (true) {
+      bool idle = true;
+      int used = slots_used_.load(std::memory_order_acquire);
+      for (int i = 0; i < used; ++i) {
+        Request request;
+        // a bounded batch per slot keeps one busy session from starving
+        // the others
+        for (int n = 0; n < 64 && slots_[i].queues[shard]->try_pop(request);
+             ++n) {
+          apply(tree, slots_[i], request);
+          idle = false;
+        }
+      }
+      if (!idle) {
+        spins = 0;
+        continue;
+      }
+      // sessions are closed, and so synced, before stop_ is set
+      if (stop_) return;
+      sjtu::backoff(spins);
+    }
+  }
+
+  static void apply(Tree &tree, Slot &slot, const Request &request) {
+    switch (request.kind) {
+      case Request::INSERT:
+        tree.insert(request.key, request.value);
+        slot.applied.fetch_add(1, std::memory_order_release);
+        return;
+      case Request::REMOVE:
+        tree.remove(request.key, request.value);
+        slot.applied.fetch_add(1, std::memory_order_release);
+        return;
+      case Request::FIND:
+        *request.values = tree.find(request.key);
+        break;
+      case Request::FIND_MANY:
+        tree.find_many(*request.keys, [&](const Key &key, const Value &value) {
+          request.pairs->push_back({key, value});
+        });
+        break;
+      case Request::SCAN:
+        tree.scan(request.key, request.hi,
+                  [&](const Key &key, const Value &value) {
+                    request.pairs->push_back({key, value});
+                  });
+        break;
+    }
+    request.pending->fetch_sub(1, std::memory_order_release);
+  }
+
+  int shards_;
+  int max_sessions_;
+  sjtu::vector<Tree *> trees_;
+  sjtu::vector<std::thread *> workers_;
+  Slot *slots_;
+  std::atomic<int> slots_used_;
+  std::mutex slot_mutex_;
+  std::atomic<bool> stop_;
+  std::unique_ptr<Session> shared_;
+  std::mutex shared_mutex_;
+};
+
+#endif  // BPT_SHARDED_HPP
@@ -0,0 +1,86 @@
+#ifndef BPT_SPSC_HPP
+#define BPT_SPSC_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+
+namespace sjtu {
+
+// waiting for the other side of a queue: spin a little, then yield, then
+// sleep; reset spins once there was progress
+inline void backoff(int &spins) {
+  if (++spins < 64) return;
+  if (spins < 4096) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Each side keeps a stale copy of the other side's index and only reloads it
+// when the queue looks full (or empty), so in the common case a push or pop
+// touches no cache line the other thread writes.
+template <class T>
+class SpscQueue {
+ private:
+  T *slots_;
+  size_t mask_;
+  alignas(64) std::atomic<size_t> head_;  // next slot to pop
+  alignas(64) size_t cached_tail_;        // consumer's view of tail_
+  alignas(64) std::atomic<size_t> tail_;  // next slot to push
+  alignas(64) size_t cached_head_;        // producer's view of head_
+
+ public:
+  // capacity is rounded up to a power of two
+  explicit SpscQueue(size_t capacity)
+      : head_(0), cached_tail_(0), tail_(0), cached_head_(0) {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    slots_ = new T[size];
+    mask_ = size - 1;
+  }
+
+  ~SpscQueue() { delete[] slots_; }
+
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  // producer only; false if the queue is full
+  bool try_push(const T &value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_) return false;
+    }
+    slots_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only; false if the queue is empty
+  bool try_pop(T &value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) return false;
+    }
+    value = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // exact only when called by the consumer
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+};
+
+}  // namespace sjtu
+
+#endif  // BPT_SPSC_HPP
@@ -0,0 +1,281 @@
+#ifndef BPT_STORAGE_HPP
+#define BPT_STORAGE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "IndexBlock.hpp"
+#include "MemoryRiver.hpp"
+#include "exceptions.hpp"
+
+// Storage policies for BPT. A policy owns two page files, `index` and
+// `block`, with the MemoryRiver interface (exist, initialise, get_info,
+// write_info, write, update, read, read_run); addresses are byte offsets behind the
+// info header, as in MemoryRiver. `cached` tells BPTCacheManager whether
+// an LRU cache in front of the files pays off.
+template <class IndexFile_, class BlockFile_, bool CACHED>
+struct PagedStorage {
+  using IndexFile = IndexFile_;
+  using BlockFile = BlockFile_;
+  static constexpr bool cached = CACHED;
+
+  IndexFile index;
+  BlockFile block;
+
+  explicit PagedStorage(const std::string &filename)
+      : index(filename + ".index"), block(filename + ".block") {}
+};
+
+// Pages kept in process memory, in chunks that are allocated once and never
+// move, so a page can be copied without holding the allocation lock.
+// write throws sjtu::runtime_error once the chunks are used up or the new
+// page's address would not fit in an int.
+template <class T, int info_len = 2>
+class MemoryArena {
+ private:
+  static constexpr int CHUNK_PAGES = 256;
+  static constexpr int MAX_CHUNKS = 1 << 14;
+  static constexpr int STRIPES = 64;
+
+  std::atomic<T *> chunks_[MAX_CHUNKS];
+  std::atomic<int> pages_;
+  bool exist_;
+  int info_[info_len];
+  std::mutex append_mutex_;
+  // pages are copied under the stripe of their number
+  std::mutex stripes_[STRIPES];
+
+  static int page_of(int index) {
+    return (index - info_len * (int)sizeof(int)) / (int)sizeof(T);
+  }
+
+  T &page(int n) { return chunks_[n / CHUNK_PAGES].load()[n % CHUNK_PAGES]; }
+
+ public:
+  explicit MemoryArena(const std::string & = "") : pages_(0), exist_(false) {
+    for (int i = 0; i < MAX_CHUNKS; ++i) {
+      chunks_[i] = nullptr;
+    }
+    for (int i = 0; i < info_len; ++i) {
+      info_[i] = 0;
+    }
+  }
+
+  ~MemoryArena() {
+    for (int i = 0; i < MAX_CHUNKS && chunks_[i] != nullptr; ++i) {
+      delete[] chunks_[i].load();
+    }
+  }
+
+  MemoryArena(const MemoryArena &) = delete;
+  MemoryArena &operator=(const MemoryArena &) = delete;
+
+  void initialise(std::string = "") {
+    exist_ = true;
+    for (int i = 0; i < info_len; ++i) {
+      info_[i] = 0;
+    }
+  }
+
+  bool exist() const { return exist_; }
+
+  void get_info(int &tmp, int n) {
+    if (n > info_len) return;
+    tmp = info_[n - 1];
+  }
+
+  void write_info(int tmp, int n) {
+    if (n > info_len) return;
+    info_[n - 1] = tmp;
+  }
+
+  int write(T &t) {
+    int n;
+    {
+      std::lock_guard<std::mutex> lock(append_mutex_);
+      n = pages_;
+      if (n >= MAX_CHUNKS * CHUNK_PAGES ||
+          info_len * (long long)sizeof(int) + n * (long long)sizeof(T) >
+              INT_MAX) {
+        throw sjtu::runtime_error();
+      }
+      if (n % CHUNK_PAGES == 0) {
+        chunks_[n / CHUNK_PAGES] = new T[CHUNK_PAGES];
+      }
+      pages_ = n + 1;
+    }
+    std::lock_guard<std::mutex> lock(stripes_[n % STRIPES]);
+    std::memcpy(static_cast<void *>(&page(n)), &t, sizeof(T));
+    return info_len * sizeof(int) + n * sizeof(T);
+  }
+
+  void update(T &t, const int index) {
+    int n = page_of(index);
+    std::lock_guard<std::mutex> lock(stripes_[n % STRIPES]);
+    std::memcpy(static_cast<void *>(&page(n)), &t, sizeof(T));
+  }
+
+  void read(T &t, const int index) {
+    int n = page_of(index);
+    std::lock_guard<std::mutex> lock(stripes_[n % STRIPES]);
+    std::memcpy(static_cast<void *>(&t), &page(n), sizeof(T));
+  }
+
+  int read_run(T *pages, const int index, const int count) {
+    int first = page_of(index);
+    int got = 0;
+    while (first >= 0 && got < count && first + got < pages_) {
+      read(pages[got], index + got * (int)sizeof(T));
+      got++;
+    }
+    return got;
+  }
+
+  // bytes held by the allocated chunks
+  size_t memory_usage() const {
+    size_t chunks = (pages_ + CHUNK_PAGES - 1) / CHUNK_PAGES;
+    return chunks * CHUNK_PAGES * sizeof(T);
+  }
+};
+
+struct IOStats {
+  long long reads;
+  long long writes;   // appends of new pages
+  long long updates;  // overwrites of existing pages
+  long long bytes_read;
+  long long bytes_written;
+};
+
+// Forwards to another page file and counts the traffic that reaches it.
+template <class File>
+class CountingFile {
+ private:
+  File file_;
+  std::atomic<long long> reads_{0};
+  std::atomic<long long> writes_{0};
+  std::atomic<long long> updates_{0};
+  std::atomic<long long> bytes_read_{0};
+  std::atomic<long long> bytes_written_{0};
+
+ public:
+  explicit CountingFile(const std::string &file_name) : file_(file_name) {}
+
+  void initialise(std::string FN = "") { file_.initialise(FN); }
+  bool exist() const { return file_.exist(); }
+  void get_info(int &tmp, int n) { file_.get_info(tmp, n); }
+  void write_info(int tmp, int n) { file_.write_info(tmp, n); }
+
+  template <class T>
+  int write(T &t) {
+    writes_++;
+    bytes_written_ += sizeof(T);
+    return file_.write(t);
+  }
+
+  template <class T>
+  void update(T &t, const int index) {
+    updates_++;
+    bytes_written_ += sizeof(T);
+    file_.update(t, index);
+  }
+
+  template <class T>
+  void read(T &t, const int index) {
+    reads_++;
+    bytes_read_ += sizeof(T);
+    file_.read(t, index);
+  }
+
+  template <class T>
+  int read_run(T *pages, const int index, const int count) {
+    int got = file_.read_run(pages, index, count);
+    reads_ += got;
+    bytes_read_ += got * sizeof(T);
+    return got;
+  }
+
+  IOStats stats() const {
+    return {reads_, writes_, updates_, bytes_read_, bytes_written_};
+  }
+
+  void reset_stats() {
+    reads_ = writes_ = updates_ = bytes_read_ = bytes_written_ = 0;
+  }
+};
+
+// Forwards to another page file and makes every read take delay_us
+// microseconds longer, to stand in for a slow device when measuring how
+// much read latency the tree manages to hide.
+template <class File>
+class DelayedFile {
+ private:
+  File file_;
+
+ public:
+  static inline std::atomic<int> delay_us{0};
+
+  explicit DelayedFile(const std::string &file_name) : file_(file_name) {}
+
+  void initialise(std::string FN = "") { file_.initialise(FN); }
+  bool exist() const { return file_.exist(); }
+  void get_info(int &tmp, int n) { file_.get_info(tmp, n); }
+  void write_info(int tmp, int n) { file_.write_info(tmp, n); }
+
+  template <class T>
+  int write(T &t) {
+    return file_.write(t);
+  }
+
+  template <class T>
+  void update(T &t, const int index) {
+    file_.update(t, index);
+  }
+
+  template <class T>
+  void read(T &t, const int index) {
+    if (delay_us > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+    }
+    file_.read(t, index);
+  }
+
+  // one device access, however many pages it brings in
+  template <class T>
+  int read_run(T *pages, const int index, const int count) {
+    if (delay_us > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+    }
+    return file_.read_run(pages, index, count);
+  }
+};
+
+// the default: pages in <filename>.index / <filename>.block behind the cache
+template <class Key, class Value>
+using FileStorage = PagedStorage<MemoryRiver<Index<Key, Value>, 2>,
+                                 MemoryRiver<Block<Key, Value>, 2>, true>;
+
+// no file I/O at all; the filename is ignored and nothing outlives the tree
+template <class Key, class Value>
+using MemoryStorage = PagedStorage<MemoryArena<Index<Key, Value>, 2>,
+                                   MemoryArena<Block<Key, Value>, 2>, false>;
+
+// Inner with every page read and write counted, for I/O analysis; only
+// traffic that misses the cache is seen
+template <class Inner>
+using CountingStorage =
+    PagedStorage<CountingFile<typename Inner::IndexFile>,
+                 CountingFile<typename Inner::BlockFile>, Inner::cached>;
+
+// Inner with every page read slowed down, see DelayedFile
+template <class Inner>
+using DelayedStorage =
+    PagedStorage<DelayedFile<typename Inner::IndexFile>,
+                 DelayedFile<typename Inner::BlockFile>, Inner::cached>;
+
+#endif  // BPT_STORAGE_HPP
@@ -0,0 +1,13 @@
+#ifndef BPT_TIMING_HPP
+#define BPT_TIMING_HPP
+
+#include <chrono>
+
+// wall time since start, for the benchmarks and tools that report rates
+inline double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+#endif  // BPT_TIMING_HPP
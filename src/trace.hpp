@@ -0,0 +1,95 @@
+#ifndef BPT_TRACE_HPP
+#define BPT_TRACE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "command.hpp"
+#include "exceptions.hpp"
+
+// One operation of a trace: when it arrived, in nanoseconds from the start
+// of the trace, and what it was, with the key already hashed. A trace file
+// is MAGIC followed by the records as they are laid out here, in arrival
+// order; bpt_main --record writes them and bpt_workload generates and
+// replays them.
+struct TraceRecord {
+  uint64_t at;
+  long long key;
+  int value;
+  Command::Kind kind;
+};
+
+static_assert(sizeof(TraceRecord) == 24, "trace files are 24-byte records");
+
+constexpr char TRACE_MAGIC[8] = {'B', 'P', 'T', 'T', 'R', 'C', 'E', '1'};
+
+class TraceWriter {
+ public:
+  explicit TraceWriter(const char *name)
+      : file_(std::fopen(name, "wb")),
+        start_(std::chrono::steady_clock::now()) {
+    if (file_ == nullptr) throw sjtu::runtime_error();
+    std::setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+    std::fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), file_);
+  }
+
+  ~TraceWriter() { std::fclose(file_); }
+
+  TraceWriter(const TraceWriter &) = delete;
+  TraceWriter &operator=(const TraceWriter &) = delete;
+
+  // stamps the command with the time since the writer was opened
+  void record(Command::Kind kind, long long key, int value) {
+    TraceRecord rec;
+    std::memset(&rec, 0, sizeof(rec));
+    rec.at = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now() - start_)
+                 .count();
+    rec.key = key;
+    rec.value = value;
+    rec.kind = kind;
+    append(rec);
+  }
+
+  void append(const TraceRecord &rec) {
+    std::fwrite(&rec, sizeof(rec), 1, file_);
+  }
+
+  void flush() { std::fflush(file_); }
+
+ private:
+  std::FILE *file_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Streams a trace file back record by record.
+class TraceReader {
+ public:
+  explicit TraceReader(const char *name) : file_(std::fopen(name, "rb")) {
+    char magic[sizeof(TRACE_MAGIC)];
+    if (file_ == nullptr) throw sjtu::runtime_error();
+    std::setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+    if (std::fread(magic, 1, sizeof(magic), file_) != sizeof(magic) ||
+        std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+      std::fclose(file_);
+      throw sjtu::runtime_error();
+    }
+  }
+
+  ~TraceReader() { std::fclose(file_); }
+
+  TraceReader(const TraceReader &) = delete;
+  TraceReader &operator=(const TraceReader &) = delete;
+
+  // false at the end; a record cut short by a crash counts as the end
+  bool next(TraceRecord &rec) {
+    return std::fread(&rec, sizeof(rec), 1, file_) == 1;
+  }
+
+ private:
+  std::FILE *file_;
+};
+
+#endif  // BPT_TRACE_HPP
@@ -0,0 +1,145 @@
+#ifndef BPT_WINDOW_HPP
+#define BPT_WINDOW_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "command.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "vector.hpp"
+
+// Runs n commands a window of `window` commands at a time, reordered by
+// key so the tree is swept from left to right instead of hit at random.
+// Commands on different keys do not see each other, so only the order
+// within one key matters, and that is kept:
+//  1. the keys that are looked up in the window are read in one find_many,
+//     which descends once for neighbouring keys and reads each leaf once
+//  2. each key's commands are replayed in arrival order on that starting
+//     state, which answers its finds, and its writes are applied to the
+//     tree; in key order, consecutive inserts land on the finger leaf
+//  3. the answers are printed in the original command order
+// A trace gets the commands in arrival order, as each window is read, and
+// a SIGUSR1 metrics dump is taken between windows.
+template <class Tree>
+void run_windowed(sjtu::CommandReader &in, long long n, Tree &tree,
+                  sjtu::OutputBuffer &out, size_t window,
+                  TraceWriter *trace = nullptr) {
+  if (window == 0) window = 1;
+  std::vector<Command> commands;
+  std::vector<size_t> order;
+  // the answer to the i-th command of the window is values[begins[i],
+  // ends[i])
+  std::vector<size_t> begins, ends;
+  std::vector<int> values;
+  std::vector<int> state;
+  // keys read in step 1, and where each one's values end in found
+  sjtu::vector<long long> lookups;
+  std::vector<int> found;
+  std::vector<size_t> found_ends;
+  commands.reserve(window);
+  long long left = n;
+  while (left > 0) {
+    commands.clear();
+    Command command;
+    while (left > 0 && commands.size() < window && in.next(command)) {
+      if (trace != nullptr && command.kind != Command::UNKNOWN) {
+        trace->record(command.kind, command.key, command.value);
+      }
+      commands.push_back(command);
+      left--;
+    }
+    if (commands.size() < window) left = 0;
+    if (commands.empty()) break;
+
+    order.resize(commands.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      if (commands[a].key != commands[b].key) {
+        return commands[a].key < commands[b].key;
+      }
+      return a < b;
+    });
+
+    // 1. starting values of every key with a find, in key order
+    lookups.clear();
+    for (size_t i = 0; i < order.size(); ++i) {
+      const Command &c = commands[order[i]];
+      if (c.kind != Command::FIND) continue;
+      if (lookups.empty() || lookups.back() != c.key) lookups.push_back(c.key);
+    }
+    found.clear();
+    found_ends.clear();
+    size_t next_lookup = 0;
+    tree.find_many(lookups, [&](const long long &key, const int &value) {
+      // keys without values are not reported, close them empty
+      while (lookups[next_lookup] != key) {
+        found_ends.push_back(found.size());
+        next_lookup++;
+      }
+      found.push_back(value);
+    });
+    while (found_ends.size() < lookups.size()) {
+      found_ends.push_back(found.size());
+    }
+
+    // 2. replay each key in arrival order
+    begins.assign(commands.size(), 0);
+    ends.assign(commands.size(), 0);
+    values.clear();
+    size_t lookup = 0;
+    for (size_t i = 0; i < order.size();) {
+      long long key = commands[order[i]].key;
+      size_t j = i;
+      bool reads = false;
+      while (j < order.size() && commands[order[j]].key == key) {
+        reads |= commands[order[j]].kind == Command::FIND;
+        ++j;
+      }
+      if (reads) {
+        size_t from = lookup == 0 ? 0 : found_ends[lookup - 1];
+        state.assign(found.begin() + from, found.begin() + found_ends[lookup]);
+        lookup++;
+      }
+      for (size_t k = i; k < j; ++k) {
+        const Command &c = commands[order[k]];
+        if (c.kind == Command::INSERT) {
+          tree.insert(c.key, c.value);
+          if (reads) {
+            state.insert(std::upper_bound(state.begin(), state.end(), c.value),
+                         c.value);
+          }
+        } else if (c.kind == Command::REMOVE) {
+          tree.remove(c.key, c.value);
+          if (reads) {
+            auto it = std::lower_bound(state.begin(), state.end(), c.value);
+            if (it != state.end() && *it == c.value) state.erase(it);
+          }
+        } else if (c.kind == Command::FIND) {
+          begins[order[k]] = values.size();
+          values.insert(values.end(), state.begin(), state.end());
+          ends[order[k]] = values.size();
+        }
+      }
+      i = j;
+    }
+
+    // 3. answers in arrival order
+    for (size_t i = 0; i < commands.size(); ++i) {
+      if (commands[i].kind != Command::FIND) continue;
+      if (begins[i] == ends[i]) {
+        out.put("null\n", 5);
+        continue;
+      }
+      for (size_t k = begins[i]; k < ends[i]; ++k) {
+        out.put(values[k]);
+        out.put(' ');
+      }
+      out.put('\n');
+    }
+    sjtu::metrics::dump_if_requested();
+  }
+}
+
+#endif  // BPT_WINDOW_HPP
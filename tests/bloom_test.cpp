@@ -0,0 +1,102 @@
+// The Bloom filter's accounting: lookups of absent keys end up as either
+// negatives or false positives, and lookups of stored keys as neither.
+// Only removes that take a pair out count towards the rebuild that drops
+// stale keys; removes of absent pairs are not counted, and neither are
+// removes the filter answers alone.
+#include "BPT.hpp"
+#include "check.hpp"
+
+namespace {
+
+using Tree = BPT<long long, int>;
+
+// stored keys are even, one pair each
+constexpr long long KEYS = 4000;
+
+long long key_of(long long i) { return 2 * i; }
+int value_of(long long key) { return key % 7; }
+
+}  // namespace
+
+int main() {
+  const char *name = "test_bloom";
+  check::remove_db(name);
+  check::Model model;
+  {
+    Tree tree(name);
+    for (long long i = 0; i < KEYS; ++i) {
+      tree.insert(key_of(i), value_of(key_of(i)));
+      model.insert({key_of(i), value_of(key_of(i))});
+    }
+    tree.set_bloom_filter(10);
+    Tree::BloomStats before = tree.bloom_stats();
+    CHECK(before.capacity == 2 * KEYS);
+    CHECK(before.probes == 0);
+
+    for (long long i = 0; i < KEYS; ++i) {
+      CHECK(tree.find(key_of(i)).size() == 1);
+      CHECK(tree.contains(key_of(i)));
+    }
+    Tree::BloomStats after = tree.bloom_stats();
+    CHECK(after.probes == 2 * KEYS);
+    CHECK(after.negatives == 0);
+    CHECK(after.false_positives == 0);
+
+    for (long long i = 0; i < KEYS; ++i) {
+      CHECK(tree.find(key_of(i) + 1).empty());
+      CHECK(!tree.contains(key_of(i) + 1));
+    }
+    before = after;
+    after = tree.bloom_stats();
+    CHECK(after.probes - before.probes == 2 * KEYS);
+    long long negatives = after.negatives - before.negatives;
+    long long false_positives = after.false_positives - before.false_positives;
+    CHECK(negatives + false_positives == 2 * KEYS);
+    // about 1% at 10 bits per key
+    CHECK(false_positives < 2 * KEYS / 20);
+
+    // real removes, below the quarter of the capacity that forces a rebuild
+    const long long first = KEYS * 3 / 8;
+    for (long long i = 0; i < first; ++i) {
+      tree.remove(key_of(i), value_of(key_of(i)));
+      model.erase({key_of(i), value_of(key_of(i))});
+    }
+    CHECK(tree.bloom_stats().capacity == 2 * KEYS);
+    // removes of pairs that are not there: absent keys, which the filter
+    // mostly answers, and stored keys with another value. They neither
+    // count as lookups nor bring the rebuild closer.
+    before = tree.bloom_stats();
+    for (long long i = 0; i < KEYS / 4; ++i) {
+      tree.remove(key_of(i) + 1, 0);
+      tree.remove(key_of(KEYS - 1 - i), value_of(key_of(KEYS - 1 - i)) + 1);
+    }
+    after = tree.bloom_stats();
+    CHECK(after.probes == before.probes);
+    CHECK(after.capacity == 2 * KEYS);
+
+    // the removed keys are still in the filter: found nothing after passing
+    for (long long i = 0; i < first; ++i) {
+      CHECK(tree.find(key_of(i)).empty());
+    }
+    before = after;
+    after = tree.bloom_stats();
+    CHECK(after.false_positives - before.false_positives == first);
+    CHECK(after.negatives == before.negatives);
+
+    // one past a quarter of the capacity, the filter is rebuilt from the
+    // keys that are left
+    const long long second = KEYS / 2 - first + 1;
+    for (long long i = first; i < first + second; ++i) {
+      tree.remove(key_of(i), value_of(key_of(i)));
+      model.erase({key_of(i), value_of(key_of(i))});
+    }
+    after = tree.bloom_stats();
+    CHECK(after.capacity == 2 * (KEYS - first - second));
+
+    for (long long key = -1; key <= key_of(KEYS); ++key) {
+      CHECK(check::to_std(tree.find(key)) == check::values(model, key));
+    }
+  }
+  check::remove_db(name);
+  return check::finish("bloom_test");
+}
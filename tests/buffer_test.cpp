@@ -0,0 +1,57 @@
+// find with a write buffer in front of the tree: inserts and removes that
+// are still buffered must show in find before any flush, over pairs that
+// are in the tree and pairs that only exist in the buffer, and the tree
+// must match the model once the buffer is flushed and the files reopened.
+#include "BPT.hpp"
+#include "check.hpp"
+
+namespace {
+
+using Tree = BPT<long long, int>;
+
+constexpr long long KEYS = 400;
+
+// find merges the buffered messages into what the tree holds, so it is
+// checked after every step
+constexpr check::Mix MIX = {
+    .keys = KEYS, .values = 10, .check_steps = true, .check_every = 1000};
+
+}  // namespace
+
+int main() {
+  const char *name = "test_buffer";
+  check::remove_db(name);
+  check::Model model;
+  {
+    Tree tree(name);
+    check::churn(tree, model, MIX, 5000, 1);
+
+    // large enough that nothing is applied before the explicit flush
+    tree.set_write_buffer(1 << 20);
+    tree.insert(7, 1);
+    tree.insert(7, 1);
+    tree.insert(7, 2);
+    tree.remove(7, 1);
+    model.insert({7, 1});
+    model.insert({7, 1});
+    model.insert({7, 2});
+    model.erase(model.find({7, 1}));
+    CHECK(check::to_std(tree.find(7)) == check::values(model, 7));
+    // a buffered remove of a pair that was never there changes nothing
+    tree.remove(7, 9);
+    CHECK(check::to_std(tree.find(7)) == check::values(model, 7));
+    check::churn(tree, model, MIX, 20000, 2);
+    tree.flush_write_buffer();
+    check::every_key(tree, model, KEYS);
+
+    // small enough that the buffer is applied many times along the way
+    tree.set_write_buffer(300);
+    check::churn(tree, model, MIX, 20000, 3);
+  }
+  {
+    Tree tree(name);
+    check::every_key(tree, model, KEYS);
+  }
+  check::remove_db(name);
+  return check::finish("buffer_test");
+}
@@ -0,0 +1,92 @@
+// The bulk builders against the multiset model: BulkLoader and
+// parallel_bulk_build from 0 to 200k pairs at several fill factors, the
+// result opened as a tree, changed by random inserts and removes, and
+// opened again; at every stage the tree must hold what the model holds.
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "BPT.hpp"
+#include "bulk.hpp"
+#include "check.hpp"
+
+namespace {
+
+using Tree = BPT<long long, int>;
+using Pair = Key_Value<long long, int>;
+
+// every pair in order, through one scan
+void check_scan(Tree &tree, const check::Model &model) {
+  std::vector<std::pair<long long, int>> pairs;
+  tree.scan(LLONG_MIN, LLONG_MAX, [&](const long long &key, const int &value) {
+    pairs.push_back({key, value});
+  });
+  std::vector<std::pair<long long, int>> expected(model.begin(), model.end());
+  CHECK(pairs == expected);
+}
+
+void check_counts(Tree &tree, const check::Model &model, std::mt19937_64 &rng) {
+  CHECK(tree.count(LLONG_MIN, LLONG_MAX) == (long long)model.size());
+  if (model.empty()) return;
+  std::vector<std::pair<long long, int>> pairs(model.begin(), model.end());
+  for (int i = 0; i < 50; ++i) {
+    size_t at = rng() % pairs.size();
+    Pair kv = tree.select(at);
+    CHECK(kv.key == pairs[at].first && kv.value == pairs[at].second);
+  }
+}
+
+void run(const char *name, bool parallel, long long n, double fill) {
+  std::mt19937_64 rng(n * 10 + static_cast<long long>(fill * 10) + parallel);
+  // keys from a space twice the pair count, so some repeat
+  const long long keys = 2 * n + 1;
+  std::vector<Pair> pairs(n);
+  check::Model model;
+  for (Pair &p : pairs) {
+    p = {static_cast<long long>(rng() % keys), static_cast<int>(rng() % 1000)};
+    model.insert({p.key, p.value});
+  }
+  // the parallel builder also checks the counts it writes
+  const bool counted = parallel;
+  check::remove_db(name);
+  if (parallel) {
+    parallel_bulk_build(name, pairs.data(), pairs.size(), 4, counted, fill);
+  } else {
+    std::sort(pairs.begin(), pairs.end());
+    BulkLoader<long long, int> loader(name, counted, fill);
+    for (const Pair &p : pairs) loader.add(p.key, p.value);
+    loader.finish();
+    CHECK(loader.size() == n);
+  }
+  {
+    Tree tree(name);
+    CHECK(tree.counted() == counted);
+    check_scan(tree, model);
+    if (counted) check_counts(tree, model, rng);
+    check::Mix mix = {.keys = keys,
+                      .values = 1000,
+                      .stored_removes = true,
+                      .check_steps = true};
+    check::churn(tree, model, mix, 5000, rng);
+    check_scan(tree, model);
+  }
+  {
+    Tree tree(name);
+    check_scan(tree, model);
+    if (counted) check_counts(tree, model, rng);
+  }
+  check::remove_db(name);
+}
+
+}  // namespace
+
+int main() {
+  for (bool parallel : {false, true}) {
+    for (long long n : {0LL, 1LL, 2LL, 56LL, 5000LL, 200000LL}) {
+      for (double fill : {0.5, 0.7, 1.0}) {
+        run("test_bulk", parallel, n, fill);
+      }
+    }
+  }
+  return check::finish("bulk_test");
+}
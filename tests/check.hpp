@@ -0,0 +1,139 @@
+#ifndef BPT_TESTS_CHECK_HPP
+#define BPT_TESTS_CHECK_HPP
+
+#include <climits>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "vector.hpp"
+
+// Minimal checks for the tests under tests/: CHECK reports the failing
+// condition and where and keeps going, finish() turns the count into the
+// exit status ctest looks at. Trees are checked against a std::multiset of
+// (key, value) pairs, the model script/bptree_standard.py implements:
+// repeated pairs are kept.
+namespace check {
+
+using Model = std::multiset<std::pair<long long, int>>;
+
+inline int &failures() {
+  static int count = 0;
+  return count;
+}
+
+inline void fail(const char *what, const char *file, int line) {
+  // the first few are enough to start from
+  if (failures()++ < 20) std::fprintf(stderr, "%s:%d: %s\n", file, line, what);
+}
+
+#define CHECK(cond)                                                 \
+  do {                                                              \
+    if (!(cond)) ::check::fail("CHECK(" #cond ")", __FILE__, __LINE__); \
+  } while (0)
+
+inline int finish(const char *name) {
+  if (failures() == 0) {
+    std::printf("%s: ok\n", name);
+    return 0;
+  }
+  std::printf("%s: %d checks failed\n", name, failures());
+  return 1;
+}
+
+// the values the model holds under key, in order
+inline std::vector<int> values(const Model &model, long long key) {
+  std::vector<int> result;
+  for (auto it = model.lower_bound({key, INT_MIN});
+       it != model.end() && it->first == key; ++it) {
+    result.push_back(it->second);
+  }
+  return result;
+}
+
+inline std::vector<int> to_std(const sjtu::vector<int> &v) {
+  std::vector<int> result;
+  for (size_t i = 0; i < v.size(); ++i) result.push_back(v[i]);
+  return result;
+}
+
+// an insert or a remove of (key, value), as the tree takes it: a remove
+// takes out one copy of the pair and ignores a pair that is not there
+inline void apply(Model &model, bool insert, long long key, int value) {
+  if (insert) {
+    model.insert({key, value});
+  } else {
+    auto it = model.find({key, value});
+    if (it != model.end()) model.erase(it);
+  }
+}
+
+// find of every key in [0, keys), tree (or snapshot) against the model
+template <class Tree>
+void every_key(Tree &tree, const Model &model, long long keys) {
+  for (long long key = 0; key < keys; ++key) {
+    CHECK(to_std(tree.find(key)) == values(model, key));
+  }
+}
+
+// What churn() draws: keys from [0, keys), values from [0, values), and
+// inserts `inserts` percent of the time, removes otherwise.
+struct Mix {
+  long long keys;
+  int values;
+  int inserts = 50;
+  // removes mostly take a pair that is stored instead of a random one
+  bool stored_removes = false;
+  // find of the key after every step, and every_key() every so many steps
+  bool check_steps = false;
+  int check_every = 0;
+};
+
+// steps random inserts and removes, on the tree and the model alike
+template <class Tree>
+void churn(Tree &tree, Model &model, const Mix &mix, int steps,
+           std::mt19937_64 &rng) {
+  for (int step = 0; step < steps; ++step) {
+    long long key = rng() % mix.keys;
+    int value = rng() % mix.values;
+    bool insert = (long long)(rng() % 100) < mix.inserts || model.empty();
+    if (!insert && mix.stored_removes && rng() % 4 != 0) {
+      auto it = model.lower_bound({key, value});
+      if (it != model.end()) {
+        key = it->first;
+        value = it->second;
+      }
+    }
+    if (insert) {
+      tree.insert(key, value);
+    } else {
+      tree.remove(key, value);
+    }
+    apply(model, insert, key, value);
+    if (mix.check_steps) CHECK(to_std(tree.find(key)) == values(model, key));
+    if (mix.check_every > 0 && step % mix.check_every == 0) {
+      every_key(tree, model, mix.keys);
+    }
+  }
+}
+
+template <class Tree>
+void churn(Tree &tree, Model &model, const Mix &mix, int steps,
+           unsigned seed) {
+  std::mt19937_64 rng(seed);
+  churn(tree, model, mix, steps, rng);
+}
+
+// removes the files a tree called name leaves behind
+inline void remove_db(const std::string &name) {
+  std::remove((name + ".index").c_str());
+  std::remove((name + ".block").c_str());
+  std::remove((name + ".hot").c_str());
+}
+
+}  // namespace check
+
+#endif  // BPT_TESTS_CHECK_HPP
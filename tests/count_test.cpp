@@ -0,0 +1,172 @@
+// count, rank and select against the multiset model, for a counted tree
+// (subtree counts in the index pages) and an uncounted one (leaf walks),
+// before and after the files are closed and opened again. A tree whose
+// .block header carries another page format must be refused, and the key
+// tag stored next to the format must come back when the files are opened.
+// A key table opened with the wrong hash and refused before any insert
+// must not leave a .keys file that blocks the right hash afterwards.
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BPT.hpp"
+#include "check.hpp"
+#include "keys.hpp"
+
+namespace {
+
+using Tree = BPT<long long, int>;
+
+constexpr long long KEYS = 2000;
+
+long long model_count(const check::Model &model, long long lo, long long hi) {
+  if (hi < lo) return 0;
+  auto first = model.lower_bound({lo, INT_MIN});
+  auto last = model.upper_bound({hi, INT_MAX});
+  return std::distance(first, last);
+}
+
+constexpr check::Mix MIX = {.keys = KEYS, .values = 20, .inserts = 67};
+
+void check_all(Tree &tree, const check::Model &model, unsigned seed) {
+  std::mt19937_64 rng(seed);
+  for (int i = 0; i < 500; ++i) {
+    long long lo = (long long)(rng() % (KEYS + 20)) - 10;
+    long long hi = lo + (long long)(rng() % 200) - 20;
+    CHECK(tree.count(lo, hi) == model_count(model, lo, hi));
+    CHECK(tree.count(lo) == model_count(model, lo, lo));
+    CHECK(tree.rank(lo) == model_count(model, LLONG_MIN, lo - 1));
+  }
+  CHECK(tree.count(LLONG_MIN, LLONG_MAX) == (long long)model.size());
+  CHECK(tree.rank(LLONG_MAX) == (long long)model.size());
+
+  std::vector<std::pair<long long, int>> pairs(model.begin(), model.end());
+  for (size_t i = 0; i < pairs.size(); i += 1 + rng() % 40) {
+    Key_Value<long long, int> kv = tree.select(i);
+    CHECK(kv.key == pairs[i].first && kv.value == pairs[i].second);
+  }
+  if (!pairs.empty()) {
+    Key_Value<long long, int> kv = tree.select(pairs.size() - 1);
+    CHECK(kv.key == pairs.back().first && kv.value == pairs.back().second);
+  }
+  bool thrown = false;
+  try {
+    tree.select(pairs.size());
+  } catch (sjtu::index_out_of_bound &) {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+void run(const char *name, bool counted) {
+  check::remove_db(name);
+  check::Model model;
+  {
+    Tree tree(name, counted);
+    CHECK(tree.counted() == counted);
+    CHECK(tree.count(0, KEYS) == 0);
+    CHECK(tree.rank(0) == 0);
+    check::churn(tree, model, MIX, 40000, 1);
+    check_all(tree, model, 2);
+  }
+  {
+    // the flag comes from the files, whatever is passed now
+    Tree tree(name, !counted);
+    CHECK(tree.counted() == counted);
+    check_all(tree, model, 3);
+    check::churn(tree, model, MIX, 40000, 4);
+    check_all(tree, model, 5);
+  }
+  {
+    Tree tree(name);
+    check_all(tree, model, 6);
+  }
+  check::remove_db(name);
+}
+
+// int 1 of the .block header holds the page format version
+void wrong_format(const char *name) {
+  check::remove_db(name);
+  {
+    Tree tree(name, true);
+    tree.insert(1, 1);
+  }
+  {
+    std::fstream block(std::string(name) + ".block",
+                       std::ios::in | std::ios::out | std::ios::binary);
+    int old_format = 0;
+    block.write(reinterpret_cast<const char *>(&old_format), sizeof(int));
+  }
+  bool thrown = false;
+  try {
+    Tree tree(name);
+  } catch (sjtu::runtime_error &) {
+    thrown = true;
+  }
+  CHECK(thrown);
+  check::remove_db(name);
+}
+
+void key_tag(const char *name) {
+  check::remove_db(name);
+  {
+    Tree tree(name, false, 1);
+    CHECK(tree.key_tag() == 1);
+    tree.insert(1, 1);
+  }
+  {
+    Tree tree(name, false, 0);
+    CHECK(tree.key_tag() == 1);
+    CHECK(tree.find(1).size() == 1);
+  }
+  check::remove_db(name);
+}
+
+bool exists(const std::string &file) {
+  std::FILE *f = std::fopen(file.c_str(), "rb");
+  if (f != nullptr) std::fclose(f);
+  return f != nullptr;
+}
+
+// the order code.cpp runs in: the key table is opened next to a tree that
+// may then be refused for carrying the other key tag
+void key_file(const char *name) {
+  const std::string keys = std::string(name) + ".keys";
+  std::remove(keys.c_str());
+  long long key = 0;
+  { KeyTable table(name, HashKind::LEGACY, KeyTable::CHAIN); }
+  CHECK(!exists(keys));
+  {
+    KeyTable table(name, HashKind::FAST, KeyTable::CHAIN);
+    CHECK(table.resolve("a", 1, false, key));
+    CHECK(!exists(keys));
+    CHECK(table.resolve("a", 1, true, key));
+    CHECK(exists(keys));
+  }
+  bool thrown = false;
+  try {
+    KeyTable table(name, HashKind::LEGACY, KeyTable::CHAIN);
+  } catch (sjtu::runtime_error &) {
+    thrown = true;
+  }
+  CHECK(thrown);
+  {
+    KeyTable table(name, HashKind::FAST, KeyTable::CHAIN);
+    CHECK(table.size() == 1);
+  }
+  std::remove(keys.c_str());
+}
+
+}  // namespace
+
+int main() {
+  run("test_count_counted", true);
+  run("test_count_plain", false);
+  wrong_format("test_count_format");
+  key_tag("test_count_tag");
+  key_file("test_count_keys");
+  return check::finish("count_test");
+}
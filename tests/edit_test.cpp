@@ -0,0 +1,110 @@
+// contains, replace and upsert against the multiset model: replace that
+// moves the pair within its leaf, across leaves, and onto a pair that is
+// already stored (which then is stored twice), upsert of present and
+// absent pairs, and both contains overloads on the way.
+#include <random>
+
+#include "BPT.hpp"
+#include "check.hpp"
+
+namespace {
+
+using Tree = BPT<long long, int>;
+
+bool model_contains(const check::Model &model, long long key) {
+  auto it = model.lower_bound({key, INT_MIN});
+  return it != model.end() && it->first == key;
+}
+
+bool model_replace(check::Model &model, long long key, int old_value,
+                   int new_value) {
+  auto it = model.find({key, old_value});
+  if (it == model.end()) return false;
+  model.erase(it);
+  model.insert({key, new_value});
+  return true;
+}
+
+// one key with enough values to fill several leaves, so a new value can
+// land in the same leaf or in another one
+void wide_key(Tree &tree, check::Model &model) {
+  const long long key = 1000;
+  for (int v = 0; v < 4 * (int)DEFAULT_LEAF_SIZE; v += 2) {
+    tree.insert(key, v);
+    model.insert({key, v});
+  }
+  // next to the old value: stays in its leaf
+  CHECK(tree.replace(key, 10, 11));
+  model_replace(model, key, 10, 11);
+  // from the first leaf to the last
+  CHECK(tree.replace(key, 0, 4 * (int)DEFAULT_LEAF_SIZE + 1));
+  model_replace(model, key, 0, 4 * (int)DEFAULT_LEAF_SIZE + 1);
+  // onto a pair that is stored already, in the same leaf and elsewhere
+  CHECK(tree.replace(key, 12, 14));
+  model_replace(model, key, 12, 14);
+  CHECK(tree.replace(key, 2, 3 * (int)DEFAULT_LEAF_SIZE));
+  model_replace(model, key, 2, 3 * (int)DEFAULT_LEAF_SIZE);
+  // to itself, and from a value that is not there
+  CHECK(tree.replace(key, 20, 20));
+  CHECK(!tree.replace(key, 21, 22));
+  CHECK(check::to_std(tree.find(key)) == check::values(model, key));
+  CHECK(tree.contains(key, 14));
+  CHECK(!tree.contains(key, 12));
+}
+
+}  // namespace
+
+int main() {
+  const char *name = "test_edit";
+  const long long KEYS = 300;
+  check::remove_db(name);
+  {
+    Tree tree(name);
+    check::Model model;
+    CHECK(!tree.contains(1));
+    CHECK(!tree.replace(1, 1, 2));
+    wide_key(tree, model);
+
+    std::mt19937_64 rng(29);
+    for (int step = 0; step < 60000; ++step) {
+      long long key = rng() % KEYS;
+      int value = rng() % 40;
+      int other = rng() % 40;
+      switch (rng() % 6) {
+        case 0:
+          tree.insert(key, value);
+          check::apply(model, true, key, value);
+          break;
+        case 1:
+          tree.remove(key, value);
+          check::apply(model, false, key, value);
+          break;
+        case 2:
+          CHECK(tree.contains(key) == model_contains(model, key));
+          CHECK(tree.contains(key, value) == (model.count({key, value}) > 0));
+          break;
+        case 3: {
+          // mostly pairs that are there
+          auto values = check::values(model, key);
+          if (!values.empty() && rng() % 4 != 0) {
+            value = values[rng() % values.size()];
+          }
+          CHECK(tree.replace(key, value, other) ==
+                model_replace(model, key, value, other));
+          break;
+        }
+        default: {
+          bool absent = model.count({key, value}) == 0;
+          CHECK(tree.upsert(key, value) == absent);
+          if (absent) model.insert({key, value});
+          break;
+        }
+      }
+      if (step % 10000 == 0) check::every_key(tree, model, KEYS);
+    }
+    check::every_key(tree, model, KEYS);
+    CHECK(check::to_std(tree.find(1000)) == check::values(model, 1000));
+  }
+  check::remove_db(name);
+  return check::finish("edit_test");
+}
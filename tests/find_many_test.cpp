@@ -0,0 +1,115 @@
+// find_many against find and the multiset model: probe batches that are
+// unsorted, repeat keys and ask for keys that are not stored, on a plain
+// tree and with the Bloom filter in front.
+#include <map>
+#include <random>
+#include <vector>
+
+#include "BPT.hpp"
+#include "check.hpp"
+
+namespace {
+
+using Tree = BPT<long long, int>;
+
+constexpr long long KEYS = 5000;
+
+// the values find_many hands out, per key, checking that keys arrive in
+// order and each key in one run
+std::map<long long, std::vector<int>> answer(Tree &tree,
+                                             const sjtu::vector<long long> &keys) {
+  std::map<long long, std::vector<int>> result;
+  bool first = true;
+  long long last = 0;
+  tree.find_many(keys, [&](const long long &key, const int &value) {
+    CHECK(first || last <= key);
+    CHECK(first || last == key || result.count(key) == 0);
+    first = false;
+    last = key;
+    result[key].push_back(value);
+  });
+  return result;
+}
+
+void check_batch(Tree &tree, const check::Model &model,
+                 const sjtu::vector<long long> &keys) {
+  std::map<long long, std::vector<int>> result = answer(tree, keys);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    std::vector<int> expected = check::values(model, keys[i]);
+    CHECK(check::to_std(tree.find(keys[i])) == expected);
+    auto it = result.find(keys[i]);
+    if (expected.empty()) {
+      CHECK(it == result.end());
+    } else {
+      CHECK(it != result.end() && it->second == expected);
+    }
+  }
+  // nothing that was not asked for
+  for (const auto &entry : result) {
+    bool asked = false;
+    for (size_t i = 0; i < keys.size() && !asked; ++i) {
+      asked = keys[i] == entry.first;
+    }
+    CHECK(asked);
+  }
+}
+
+void run(Tree &tree, unsigned seed) {
+  check::Model model;
+  std::mt19937_64 rng(seed);
+  CHECK(answer(tree, sjtu::vector<long long>()).empty());
+  sjtu::vector<long long> none;
+  none.push_back(1);
+  none.push_back(1);
+  CHECK(answer(tree, none).empty());
+
+  for (int round = 0; round < 20; ++round) {
+    for (int i = 0; i < 2000; ++i) {
+      // even keys only, so odd probes always miss
+      long long key = 2 * (rng() % (KEYS / 2));
+      int value = rng() % 30;
+      bool insert = rng() % 4 != 0;
+      if (insert) {
+        tree.insert(key, value);
+      } else {
+        tree.remove(key, value);
+      }
+      check::apply(model, insert, key, value);
+    }
+    sjtu::vector<long long> keys;
+    size_t batch = 1 + rng() % 300;
+    for (size_t i = 0; i < batch; ++i) {
+      long long key = (long long)(rng() % (KEYS + 100)) - 50;
+      keys.push_back(key);
+      // repeats, next to each other and further on
+      if (rng() % 5 == 0) keys.push_back(key);
+      if (rng() % 7 == 0 && keys.size() > 1) {
+        keys.push_back(keys[rng() % keys.size()]);
+      }
+    }
+    check_batch(tree, model, keys);
+  }
+  // every key once, in descending order
+  sjtu::vector<long long> all;
+  for (long long key = KEYS; key >= 0; --key) all.push_back(key);
+  check_batch(tree, model, all);
+}
+
+}  // namespace
+
+int main() {
+  const char *name = "test_find_many";
+  check::remove_db(name);
+  {
+    Tree tree(name);
+    run(tree, 7);
+  }
+  check::remove_db(name);
+  {
+    Tree tree(name);
+    tree.set_bloom_filter(10);
+    run(tree, 8);
+  }
+  check::remove_db(name);
+  return check::finish("find_many_test");
+}
@@ -0,0 +1,133 @@
+// Snapshot isolation while writers run: every snapshot must keep answering
+// as the model did when it was taken, while threads insert and remove, and
+// after older snapshots are closed and the pages saved for them collected.
+#include <atomic>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "BPT.hpp"
+#include "check.hpp"
+
+namespace {
+
+using Tree = BPT<long long, int>;
+
+constexpr int WRITERS = 4;
+constexpr long long KEYS_PER_WRITER = 4000;
+constexpr int OPS_PER_WRITER = 20000;
+
+// writer w owns the keys w, w + WRITERS, ..., so replaying each writer's
+// operations on the model in turn gives what the tree ends with
+long long key_of(int writer, long long i) { return i * WRITERS + writer; }
+
+struct Op {
+  bool insert;
+  long long key;
+  int value;
+};
+
+std::vector<Op> writer_ops(int writer, int round) {
+  std::mt19937_64 rng(writer * 7919 + round);
+  std::vector<Op> ops;
+  for (int i = 0; i < OPS_PER_WRITER; ++i) {
+    ops.push_back({rng() % 3 != 0, key_of(writer, rng() % KEYS_PER_WRITER),
+                   static_cast<int>(rng() % 50)});
+  }
+  return ops;
+}
+
+// runs a round of writes on WRITERS threads while readers check snapshot
+// against frozen, then brings model up to date
+void write_round(Tree &tree, check::Model &model, int round,
+                 const Tree::Snapshot &snapshot, const check::Model &frozen) {
+  std::vector<std::vector<Op>> ops;
+  for (int w = 0; w < WRITERS; ++w) ops.push_back(writer_ops(w, round));
+  std::atomic<int> running{WRITERS};
+  std::atomic<int> mismatches{0};
+  std::vector<std::thread> threads;
+  for (int w = 0; w < WRITERS; ++w) {
+    threads.emplace_back([&, w] {
+      for (const Op &op : ops[w]) {
+        if (op.insert) {
+          tree.insert(op.key, op.value);
+        } else {
+          tree.remove(op.key, op.value);
+        }
+      }
+      running--;
+    });
+  }
+  for (int r = 0; r < 2; ++r) {
+    threads.emplace_back([&, r] {
+      std::mt19937_64 rng(round * 31 + r);
+      while (running > 0) {
+        long long key = rng() % (KEYS_PER_WRITER * WRITERS);
+        if (check::to_std(snapshot.find(key)) != check::values(frozen, key)) {
+          mismatches++;
+        }
+      }
+    });
+  }
+  for (std::thread &t : threads) t.join();
+  CHECK(mismatches == 0);
+  for (int w = 0; w < WRITERS; ++w) {
+    for (const Op &op : ops[w]) {
+      check::apply(model, op.insert, op.key, op.value);
+    }
+  }
+}
+
+// every key of the key space, the tree or a snapshot against the model
+template <class Reader>
+void check_all(Reader &reader, const check::Model &model) {
+  check::every_key(reader, model, KEYS_PER_WRITER * WRITERS);
+}
+
+}  // namespace
+
+int main() {
+  const char *name = "test_snapshot";
+  check::remove_db(name);
+  {
+    Tree tree(name);
+    check::Model model;
+    std::mt19937_64 rng(1);
+    for (long long i = 0; i < KEYS_PER_WRITER * WRITERS; ++i) {
+      long long key = rng() % (KEYS_PER_WRITER * WRITERS);
+      int value = rng() % 50;
+      tree.insert(key, value);
+      model.insert({key, value});
+    }
+
+    std::optional<Tree::Snapshot> first(tree.snapshot());
+    check::Model first_model = model;
+    write_round(tree, model, 1, *first, first_model);
+
+    std::optional<Tree::Snapshot> second(tree.snapshot());
+    check::Model second_model = model;
+    write_round(tree, model, 2, *second, second_model);
+    check_all(*first, first_model);
+    check_all(*second, second_model);
+
+    // closing the older snapshot collects the pages only it could read;
+    // the newer one must not lose any of its own
+    first.reset();
+    write_round(tree, model, 3, *second, second_model);
+    check_all(*second, second_model);
+
+    std::optional<Tree::Snapshot> third(tree.snapshot());
+    check::Model third_model = model;
+    second.reset();
+    write_round(tree, model, 4, *third, third_model);
+    check_all(*third, third_model);
+    third.reset();
+
+    check_all(tree, model);
+    std::optional<Tree::Snapshot> last(tree.snapshot());
+    check_all(*last, model);
+  }
+  check::remove_db(name);
+  return check::finish("snapshot_test");
+}
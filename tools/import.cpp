@@ -0,0 +1,333 @@
+// Builds a database from `insert <key> <value>` commands in the code.cpp
+// format (an optional leading count line is skipped, find and delete lines
+// are skipped and counted) without ever holding the input in memory:
+//  1. pairs are hashed into a buffer of --memory MiB; whenever it is full
+//     it is sorted with parallel_sort and spilled as a run file
+//  2. the runs are merged k ways, in extra passes if there are more than
+//     the memory budget can read at once, and the merged stream goes
+//     straight into a BulkLoader, which writes the tree bottom-up
+// Throughput of both phases and the peak RSS are printed at the end. Keys
+// are hashed the way bpt_main will read them: --legacy-hash and
+// --key-table must match the flags the database is later used with. The
+// hash is recorded in the database, and bpt_main refuses one written with
+// the other hash.
+//
+// usage: bpt_import <commands|-> [--db NAME] [--tmp DIR] [--memory MiB]
+//                   [--threads N] [--fill F] [--counted] [--force]
+//                   [--legacy-hash] [--key-table chain|reject]
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bulk.hpp"
+#include "keys.hpp"
+#include "timing.hpp"
+
+namespace {
+
+using Pair = Key_Value<long long, int>;
+
+// pairs read from a run at a time; fixes the merge fan-in for a budget
+constexpr size_t RUN_READ_PAIRS = 1 << 16;
+
+// whitespace-separated tokens from a FILE, read in large chunks
+class TokenReader {
+ public:
+  explicit TokenReader(std::FILE *file) : file_(file), pos_(0), len_(0) {}
+
+  bool next(std::string &token) {
+    token.clear();
+    int c;
+    while ((c = get()) != EOF && std::isspace(c)) {
+    }
+    if (c == EOF) return false;
+    do {
+      token.push_back(static_cast<char>(c));
+    } while ((c = get()) != EOF && !std::isspace(c));
+    return true;
+  }
+
+  long long bytes() const { return bytes_; }
+
+ private:
+  int get() {
+    if (pos_ == len_) {
+      len_ = std::fread(buf_, 1, sizeof(buf_), file_);
+      pos_ = 0;
+      bytes_ += len_;
+      if (len_ == 0) return EOF;
+    }
+    return static_cast<unsigned char>(buf_[pos_++]);
+  }
+
+  std::FILE *file_;
+  char buf_[1 << 20];
+  size_t pos_;
+  size_t len_;
+  long long bytes_ = 0;
+};
+
+class RunReader {
+ public:
+  explicit RunReader(const std::string &name)
+      : in_(name, std::ios::binary), buf_(RUN_READ_PAIRS), pos_(0), len_(0) {}
+
+  bool next(Pair &pair) {
+    if (pos_ == len_) {
+      in_.read(reinterpret_cast<char *>(buf_.data()),
+               buf_.size() * sizeof(Pair));
+      len_ = in_.gcount() / sizeof(Pair);
+      pos_ = 0;
+      if (len_ == 0) return false;
+    }
+    pair = buf_[pos_++];
+    return true;
+  }
+
+ private:
+  std::ifstream in_;
+  std::vector<Pair> buf_;
+  size_t pos_;
+  size_t len_;
+};
+
+void write_run(const std::string &name, const Pair *pairs, size_t n) {
+  std::ofstream out(name, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(pairs), n * sizeof(Pair));
+}
+
+// k-way merge of sorted run files into sink, through a min-heap of heads
+void merge_runs(const std::vector<std::string> &runs,
+                const std::function<void(const Pair &)> &sink) {
+  struct Head {
+    Pair pair;
+    size_t run;
+    bool operator<(const Head &other) const { return other.pair < pair; }
+  };
+  std::vector<RunReader *> readers;
+  std::priority_queue<Head> heap;
+  for (size_t i = 0; i < runs.size(); ++i) {
+    readers.push_back(new RunReader(runs[i]));
+    Pair pair;
+    if (readers[i]->next(pair)) heap.push({pair, i});
+  }
+  while (!heap.empty()) {
+    Head head = heap.top();
+    heap.pop();
+    sink(head.pair);
+    if (readers[head.run]->next(head.pair)) heap.push(head);
+  }
+  for (RunReader *reader : readers) delete reader;
+}
+
+// the key tag (HashKind) an existing database was written with, -1 if it
+// cannot be read
+int recorded_key_tag(const std::string &db) {
+  std::ifstream block(db + ".block", std::ios::binary);
+  int word;
+  if (!block.read(reinterpret_cast<char *>(&word), sizeof(word)) ||
+      page_format_version(word) != PAGE_FORMAT_VERSION) {
+    return -1;
+  }
+  return page_format_key_tag(word);
+}
+
+int usage() {
+  std::fprintf(stderr,
+               "usage: bpt_import <commands|-> [--db NAME] [--tmp DIR] "
+               "[--memory MiB] [--threads N] [--fill F] [--counted] "
+               "[--force] [--legacy-hash] [--key-table chain|reject]\n");
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) return usage();
+  std::string input = argv[1];
+  std::string db = "database";
+  std::string tmp = ".";
+  size_t memory_mib = 256;
+  int threads = std::thread::hardware_concurrency();
+  double fill = 1.0;
+  bool counted = false, force = false;
+  KeyHasher hasher;
+  const char *key_table = nullptr;
+  for (int i = 2; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--counted") == 0) {
+      counted = true;
+    } else if (std::strcmp(argv[i], "--force") == 0) {
+      force = true;
+    } else if (std::strcmp(argv[i], "--legacy-hash") == 0) {
+      hasher.kind = HashKind::LEGACY;
+    } else if (i + 1 == argc) {
+      return usage();
+    } else if (std::strcmp(argv[i], "--db") == 0) {
+      db = argv[++i];
+    } else if (std::strcmp(argv[i], "--tmp") == 0) {
+      tmp = argv[++i];
+    } else if (std::strcmp(argv[i], "--memory") == 0) {
+      memory_mib = std::atoll(argv[++i]);
+    } else if (std::strcmp(argv[i], "--threads") == 0) {
+      threads = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--fill") == 0) {
+      fill = std::atof(argv[++i]);
+    } else if (std::strcmp(argv[i], "--key-table") == 0) {
+      key_table = argv[++i];
+    } else {
+      return usage();
+    }
+  }
+  if (threads <= 0) threads = 1;
+  if (!force && std::ifstream(db + ".index")) {
+    int tag = recorded_key_tag(db);
+    std::fprintf(stderr, "%s.index exists%s, pass --force to replace it\n",
+                 db.c_str(),
+                 tag < 0 || tag == static_cast<int>(hasher.kind)
+                     ? ""
+                     : hasher.kind == HashKind::LEGACY
+                           ? " and uses the fast hash"
+                           : " and uses the legacy hash");
+    return 1;
+  }
+  std::unique_ptr<KeyTable> table;
+  if (key_table != nullptr) {
+    // a fresh database gets a fresh key table
+    std::remove((db + ".keys").c_str());
+    table.reset(new KeyTable(db, hasher.kind,
+                             std::strcmp(key_table, "reject") == 0
+                                 ? KeyTable::REJECT
+                                 : KeyTable::CHAIN));
+    hasher.table = table.get();
+  }
+  std::FILE *file = input == "-" ? stdin : std::fopen(input.c_str(), "rb");
+  if (file == nullptr) {
+    std::fprintf(stderr, "cannot open %s\n", input.c_str());
+    return 1;
+  }
+
+  size_t budget = memory_mib * 1024 * 1024 / sizeof(Pair);
+  if (budget < RUN_READ_PAIRS) budget = RUN_READ_PAIRS;
+  std::string run_prefix = tmp + "/" +
+                           db.substr(db.find_last_of('/') + 1) + ".run";
+  int run_names = 0;
+  auto run_name = [&] { return run_prefix + std::to_string(run_names++); };
+
+  // phase 1: sorted runs
+  auto start = std::chrono::steady_clock::now();
+  TokenReader reader(file);
+  std::vector<Pair> buffer;
+  buffer.reserve(budget);
+  std::vector<std::string> runs;
+  long long pairs = 0, skipped = 0;
+  std::string token, key, value;
+  bool first = true;
+  while (reader.next(token)) {
+    if (first && std::isdigit(static_cast<unsigned char>(token[0]))) {
+      first = false;  // the count line of the command format
+      continue;
+    }
+    first = false;
+    if (token == "insert") {
+      if (!reader.next(key) || !reader.next(value)) break;
+      long long hash;
+      if (!hasher(key.data(), key.size(), true, hash)) {
+        skipped++;  // refused by the key table
+        continue;
+      }
+      buffer.push_back({hash, std::atoi(value.c_str())});
+      pairs++;
+      if (buffer.size() == budget) {
+        parallel_sort(buffer.data(), buffer.size(), threads);
+        runs.push_back(run_name());
+        write_run(runs.back(), buffer.data(), buffer.size());
+        buffer.clear();
+      }
+    } else if (token == "find") {
+      reader.next(key);
+      skipped++;
+    } else if (token == "delete") {
+      reader.next(key);
+      reader.next(value);
+      skipped++;
+    } else {
+      std::fprintf(stderr, "unknown command '%s'\n", token.c_str());
+      return 1;
+    }
+  }
+  if (file != stdin) std::fclose(file);
+  parallel_sort(buffer.data(), buffer.size(), threads);
+  double read_seconds = seconds_since(start);
+  size_t spilled = runs.size();
+
+  // phase 2: merge and build
+  start = std::chrono::steady_clock::now();
+  {
+    BulkLoader<long long, int> loader(db, counted, fill,
+                                      static_cast<int>(hasher.kind));
+    if (runs.empty()) {
+      // everything fit in memory, nothing to merge
+      for (const Pair &pair : buffer) loader.add(pair.key, pair.value);
+    } else {
+      if (!buffer.empty()) {
+        runs.push_back(run_name());
+        write_run(runs.back(), buffer.data(), buffer.size());
+      }
+      std::vector<Pair>().swap(buffer);
+      // every open run holds RUN_READ_PAIRS in memory
+      size_t fan_in = budget / RUN_READ_PAIRS;
+      if (fan_in < 2) fan_in = 2;
+      while (runs.size() > fan_in) {
+        std::vector<std::string> merged;
+        for (size_t i = 0; i < runs.size(); i += fan_in) {
+          std::vector<std::string> group(
+              runs.begin() + i, runs.begin() + std::min(i + fan_in, runs.size()));
+          merged.push_back(run_name());
+          std::ofstream out(merged.back(), std::ios::binary | std::ios::trunc);
+          merge_runs(group, [&](const Pair &pair) {
+            out.write(reinterpret_cast<const char *>(&pair), sizeof(Pair));
+          });
+          for (const std::string &name : group) std::remove(name.c_str());
+        }
+        runs.swap(merged);
+      }
+      merge_runs(runs, [&](const Pair &pair) {
+        loader.add(pair.key, pair.value);
+      });
+      for (const std::string &name : runs) std::remove(name.c_str());
+    }
+  }
+  double build_seconds = seconds_since(start);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  double total = read_seconds + build_seconds;
+  std::printf("pairs          %lld (%lld other commands skipped)\n", pairs,
+              skipped);
+  if (table) {
+    std::printf("distinct keys  %zu (%zu hash collisions)\n", table->size(),
+                table->collisions());
+  }
+  std::printf("runs spilled   %zu\n", spilled);
+  std::printf("read+sort      %8.3f s %12.0f pairs/s %8.1f MiB/s\n",
+              read_seconds, pairs / read_seconds,
+              reader.bytes() / read_seconds / (1 << 20));
+  std::printf("merge+build    %8.3f s %12.0f pairs/s\n", build_seconds,
+              pairs / build_seconds);
+  std::printf("total          %8.3f s %12.0f pairs/s\n", total,
+              pairs / total);
+  std::printf("peak RSS       %8.1f MiB\n", usage.ru_maxrss / 1024.0);
+  return 0;
+}
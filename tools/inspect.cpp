@@ -0,0 +1,165 @@
+// Prints the health of a closed database (see inspect.hpp): height, nodes
+// and fill per level, leaf-chain locality, orphaned pages and duplicate-key
+// runs, as text or, with --json, as one JSON object. --export also writes
+// the structure for script/visualize_cpp_bptree.py, every --sample-th child
+// only for big trees.
+//
+// usage: bpt_inspect [--db NAME] [--json] [--export FILE] [--sample K]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "inspect.hpp"
+
+namespace {
+
+using Inspector = TreeInspector<long long, int>;
+
+double percent(uint64_t part, uint64_t whole) {
+  return whole == 0 ? 0 : 100.0 * part / whole;
+}
+
+void print_text(const Inspector::Report &r) {
+  std::printf("height %d (index levels), root page at %d\n", r.height, r.root);
+  std::printf("%-6s %10s %12s %8s  fill histogram (0-10%% ... 90-100%%)\n",
+              "level", "nodes", "entries", "fill");
+  for (size_t i = 0; i < r.levels.size(); ++i) {
+    const Inspector::Level &level = r.levels[i];
+    std::string name =
+        i + 1 == r.levels.size() ? "leaf" : std::to_string(i + 1);
+    std::printf("%-6s %10llu %12llu %7.1f%% ", name.c_str(),
+                static_cast<unsigned long long>(level.nodes),
+                static_cast<unsigned long long>(level.entries),
+                percent(level.entries, level.capacity));
+    for (int b = 0; b < Inspector::FILL_BUCKETS; ++b) {
+      std::printf(" %llu", static_cast<unsigned long long>(level.fill[b]));
+    }
+    std::printf("\n");
+  }
+  std::printf("\npages: %llu index (%llu orphaned), %llu leaf (%llu orphaned)\n",
+              static_cast<unsigned long long>(r.index_pages),
+              static_cast<unsigned long long>(r.orphan_index_pages),
+              static_cast<unsigned long long>(r.leaf_pages),
+              static_cast<unsigned long long>(r.orphan_leaf_pages));
+  uint64_t moves = r.chain_adjacent + r.chain_forward + r.chain_backward;
+  std::printf(
+      "leaf chain: %.1f%% to the adjacent page, %.1f%% forward, %.1f%% "
+      "backward, mean distance %.1f pages, %llu broken links\n",
+      percent(r.chain_adjacent, moves), percent(r.chain_forward, moves),
+      percent(r.chain_backward, moves), r.chain_mean_distance,
+      static_cast<unsigned long long>(r.chain_broken));
+  std::printf("pairs %llu, distinct keys %llu, longest run %llu, "
+              "%llu pairs out of order\n",
+              static_cast<unsigned long long>(r.pairs),
+              static_cast<unsigned long long>(r.distinct_keys),
+              static_cast<unsigned long long>(r.longest_run),
+              static_cast<unsigned long long>(r.unsorted));
+  std::printf("run lengths:");
+  for (int b = 0; b < Inspector::RUN_BUCKETS; ++b) {
+    if (r.runs[b] == 0) continue;
+    std::printf(" [%llu,%llu]:%llu", 1ULL << b, (2ULL << b) - 1,
+                static_cast<unsigned long long>(r.runs[b]));
+  }
+  std::printf("\n");
+}
+
+void print_json(const Inspector::Report &r) {
+  std::printf("{\"root\":%d,\"height\":%d,\"levels\":[", r.root, r.height);
+  for (size_t i = 0; i < r.levels.size(); ++i) {
+    const Inspector::Level &level = r.levels[i];
+    std::printf("%s{\"nodes\":%llu,\"entries\":%llu,\"fill\":%.4f,"
+                "\"fill_histogram\":[",
+                i == 0 ? "" : ",",
+                static_cast<unsigned long long>(level.nodes),
+                static_cast<unsigned long long>(level.entries),
+                level.capacity == 0 ? 0.0
+                                    : double(level.entries) / level.capacity);
+    for (int b = 0; b < Inspector::FILL_BUCKETS; ++b) {
+      std::printf("%s%llu", b == 0 ? "" : ",",
+                  static_cast<unsigned long long>(level.fill[b]));
+    }
+    std::printf("]}");
+  }
+  std::printf("],\"index_pages\":%llu,\"leaf_pages\":%llu,"
+              "\"orphan_index_pages\":%llu,\"orphan_leaf_pages\":%llu,"
+              "\"pairs\":%llu,\"distinct_keys\":%llu,\"longest_run\":%llu,"
+              "\"unsorted\":%llu,\"run_histogram\":[",
+              static_cast<unsigned long long>(r.index_pages),
+              static_cast<unsigned long long>(r.leaf_pages),
+              static_cast<unsigned long long>(r.orphan_index_pages),
+              static_cast<unsigned long long>(r.orphan_leaf_pages),
+              static_cast<unsigned long long>(r.pairs),
+              static_cast<unsigned long long>(r.distinct_keys),
+              static_cast<unsigned long long>(r.longest_run),
+              static_cast<unsigned long long>(r.unsorted));
+  for (int b = 0; b < Inspector::RUN_BUCKETS; ++b) {
+    std::printf("%s%llu", b == 0 ? "" : ",",
+                static_cast<unsigned long long>(r.runs[b]));
+  }
+  std::printf("],\"chain\":{\"adjacent\":%llu,\"forward\":%llu,"
+              "\"backward\":%llu,\"mean_distance\":%.2f,\"broken\":%llu}}\n",
+              static_cast<unsigned long long>(r.chain_adjacent),
+              static_cast<unsigned long long>(r.chain_forward),
+              static_cast<unsigned long long>(r.chain_backward),
+              r.chain_mean_distance,
+              static_cast<unsigned long long>(r.chain_broken));
+}
+
+int usage() {
+  std::fprintf(stderr,
+               "usage: bpt_inspect [--db NAME] [--json] [--export FILE] "
+               "[--sample K]\n");
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::string db = "database";
+  bool json = false;
+  const char *export_name = nullptr;
+  int sample = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (i + 1 == argc) {
+      return usage();
+    } else if (std::strcmp(argv[i], "--db") == 0) {
+      db = argv[++i];
+    } else if (std::strcmp(argv[i], "--export") == 0) {
+      export_name = argv[++i];
+    } else if (std::strcmp(argv[i], "--sample") == 0) {
+      sample = std::atoi(argv[++i]);
+    } else {
+      return usage();
+    }
+  }
+  std::FILE *out = nullptr;
+  if (export_name != nullptr) {
+    out = std::fopen(export_name, "w");
+    if (out == nullptr) {
+      std::fprintf(stderr, "cannot open %s\n", export_name);
+      return 1;
+    }
+  }
+  Inspector::Report report;
+  try {
+    Inspector inspector(db);
+    report = inspector.run(out, sample);
+  } catch (sjtu::runtime_error &) {
+    std::fprintf(stderr,
+                 "%s.index / %s.block cannot be read or use another page "
+                 "format\n",
+                 db.c_str(), db.c_str());
+    if (out != nullptr) std::fclose(out);
+    return 1;
+  }
+  if (out != nullptr) std::fclose(out);
+  if (json) {
+    print_json(report);
+  } else {
+    print_text(report);
+  }
+  return 0;
+}
@@ -0,0 +1,395 @@
+// YCSB-style workloads against BPT, generated natively so 10^8-operation
+// runs are cheap to produce, plus replay of recorded traces.
+//   generate  writes a workload as a trace (see trace.hpp) or, with --text,
+//             as bpt_main commands
+//   run       generates a workload and executes it in process
+//   replay    executes a trace, e.g. one bpt_main --record wrote
+// A workload is a load phase that inserts --records keys with --fanout
+// values each, then --ops operations mixed as insert:find:remove percents.
+// Run-phase keys follow --dist (uniform, zipfian, latest or sequential); one
+// insert in --fanout adds a new key, the others add a value in
+// [0, fanout) to an existing one, and removes pick a value the same way,
+// so every key keeps around --fanout duplicates. Keys are the decimal
+// record ids hashed as bpt_main hashes them, so the text and trace forms
+// of a workload touch the same tree keys.
+//
+// Without --rate operations are issued back to back (closed loop) and an
+// operation's latency is its own execution time. With --rate R operation i
+// is due at i / R seconds (open loop) and its latency runs from when it was
+// due, so a stall shows up in every operation queued behind it. replay
+// --speed X follows the trace's own timestamps instead, X times faster.
+//
+// usage: bpt_workload generate --out FILE [--text] [workload] [--rate R]
+//        bpt_workload run [workload] [--rate R] [--db NAME] [--keep]
+//        bpt_workload replay TRACE [--rate R | --speed X] [--warmup N]
+//                            [--db NAME] [--keep]
+// workload: [--records N] [--ops N] [--mix I:F:R] [--dist D] [--theta T]
+//           [--fanout K] [--seed S]
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "BPT.hpp"
+#include "distribution.hpp"
+#include "hash.hpp"
+#include "histogram.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  uint64_t records = 100000;
+  uint64_t ops = 1000000;
+  int insert = 50, find = 30, remove = 20;
+  KeyDistribution::Kind dist = KeyDistribution::ZIPFIAN;
+  double theta = KeyDistribution::DEFAULT_THETA;
+  int fanout = 1;
+  uint64_t seed = 47;
+};
+
+// one generated operation on record id
+struct Op {
+  Command::Kind kind;
+  uint64_t id;
+  int value;
+};
+
+class Workload {
+ public:
+  explicit Workload(const Options &opt)
+      : opt_(opt),
+        keys_(opt.dist, opt.records, opt.seed, opt.theta),
+        rng_(opt.seed + 1),
+        records_(opt.records) {}
+
+  uint64_t load_size() const { return opt_.records * opt_.fanout; }
+
+  // the i-th insert of the load phase
+  Op load(uint64_t i) const {
+    return {Command::INSERT, i / opt_.fanout,
+            static_cast<int>(i % opt_.fanout)};
+  }
+
+  Op next() {
+    int roll = rng_() % 100;
+    if (roll < opt_.insert) {
+      if (records_ == 0 || rng_() % opt_.fanout == 0) {
+        keys_.grow(++records_);
+        return {Command::INSERT, records_ - 1, 0};
+      }
+      return {Command::INSERT, keys_.next(), value()};
+    }
+    if (roll < opt_.insert + opt_.find) {
+      return {Command::FIND, keys_.next(), 0};
+    }
+    return {Command::REMOVE, keys_.next(), value()};
+  }
+
+ private:
+  int value() { return static_cast<int>(rng_() % opt_.fanout); }
+
+  Options opt_;
+  KeyDistribution keys_;
+  std::mt19937_64 rng_;
+  uint64_t records_;
+};
+
+TraceRecord to_record(const Op &op, uint64_t at) {
+  char digits[24];
+  char *end = std::to_chars(digits, digits + sizeof(digits), op.id).ptr;
+  TraceRecord rec;
+  std::memset(&rec, 0, sizeof(rec));
+  rec.at = at;
+  rec.key = HashKey(HashKind::FAST, digits, end - digits);
+  rec.value = op.value;
+  rec.kind = op.kind;
+  return rec;
+}
+
+// Executes records against the tree and keeps per-kind latency.
+class Runner {
+ public:
+  Runner(BPT<long long, int> &tree, double rate, double speed)
+      : tree_(tree), rate_(rate), speed_(speed), issued_(0), hits_(0) {}
+
+  // not timed: the load phase and replay warm-up
+  void untimed(const TraceRecord &rec) { execute(rec); }
+
+  void timed(const TraceRecord &rec) {
+    if (rec.kind == Command::UNKNOWN) return;
+    if (issued_ == 0) {
+      start_ = Clock::now();
+      first_at_ = rec.at;
+    }
+    Clock::time_point began;
+    if (rate_ > 0) {
+      began = due(std::chrono::nanoseconds(
+          static_cast<uint64_t>(issued_ * 1e9 / rate_)));
+    } else if (speed_ > 0) {
+      began = due(std::chrono::nanoseconds(
+          static_cast<uint64_t>((rec.at - first_at_) / speed_)));
+    } else {
+      began = Clock::now();
+    }
+    if (execute(rec)) hits_++;
+    latency_[rec.kind].record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                             began)
+            .count());
+    issued_++;
+  }
+
+  void report(double load_seconds, uint64_t loaded) const {
+    double seconds = issued_ == 0 ? 0 : seconds_since(start_);
+    if (loaded > 0) {
+      std::printf("load   %12llu ops %10.3f s %12.0f ops/s\n",
+                  static_cast<unsigned long long>(loaded), load_seconds,
+                  loaded / load_seconds);
+    }
+    std::printf("run    %12llu ops %10.3f s %12.0f ops/s",
+                static_cast<unsigned long long>(issued_), seconds,
+                issued_ / seconds);
+    if (rate_ > 0) std::printf(" (target %.0f)", rate_);
+    std::printf("\n\n%-8s %12s %10s %10s %10s %10s %10s\n", "op", "count",
+                "mean us", "p50 us", "p99 us", "p999 us", "max us");
+    static const char *names[] = {"insert", "find", "remove"};
+    LatencyHistogram all;
+    for (int kind = 0; kind < 3; ++kind) {
+      print(names[kind], latency_[kind]);
+      all.merge(latency_[kind]);
+    }
+    print("all", all);
+    uint64_t finds = latency_[Command::FIND].count();
+    if (finds > 0) {
+      std::printf("\nfinds answered: %.1f%%\n", 100.0 * hits_ / finds);
+    }
+  }
+
+ private:
+  Clock::time_point due(std::chrono::nanoseconds offset) {
+    Clock::time_point when = start_ + offset;
+    for (;;) {
+      Clock::time_point now = Clock::now();
+      if (now >= when) return when;
+      // sleep while far off, spin for the last stretch
+      if (when - now > std::chrono::microseconds(200)) {
+        std::this_thread::sleep_for(when - now -
+                                    std::chrono::microseconds(100));
+      }
+    }
+  }
+
+  // true for a find that found something
+  bool execute(const TraceRecord &rec) {
+    if (rec.kind == Command::INSERT) {
+      tree_.insert(rec.key, rec.value);
+    } else if (rec.kind == Command::FIND) {
+      return tree_.find(rec.key).size() > 0;
+    } else if (rec.kind == Command::REMOVE) {
+      tree_.remove(rec.key, rec.value);
+    }
+    return false;
+  }
+
+  static void print(const char *name, const LatencyHistogram &h) {
+    if (h.count() == 0) return;
+    std::printf("%-8s %12llu %10.2f %10.2f %10.2f %10.2f %10.2f\n", name,
+                static_cast<unsigned long long>(h.count()), h.mean() / 1e3,
+                h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3,
+                h.percentile(0.999) / 1e3, h.max() / 1e3);
+  }
+
+  BPT<long long, int> &tree_;
+  double rate_, speed_;
+  uint64_t issued_, hits_;
+  uint64_t first_at_ = 0;
+  Clock::time_point start_;
+  LatencyHistogram latency_[3];
+};
+
+int usage() {
+  std::fprintf(
+      stderr,
+      "usage: bpt_workload generate --out FILE [--text] [workload] "
+      "[--rate R]\n"
+      "       bpt_workload run [workload] [--rate R] [--db NAME] [--keep]\n"
+      "       bpt_workload replay TRACE [--rate R | --speed X] [--warmup N] "
+      "[--db NAME] [--keep]\n"
+      "workload: [--records N] [--ops N] [--mix I:F:R] "
+      "[--dist uniform|zipfian|latest|sequential] [--theta T] [--fanout K] "
+      "[--seed S]\n");
+  return 2;
+}
+
+// "insert:find:remove" in percent, summing to 100
+bool parse_mix(const char *text, Options &opt) {
+  return std::sscanf(text, "%d:%d:%d", &opt.insert, &opt.find,
+                     &opt.remove) == 3 &&
+         opt.insert >= 0 && opt.find >= 0 && opt.remove >= 0 &&
+         opt.insert + opt.find + opt.remove == 100;
+}
+
+void reset_db(const std::string &db) {
+  std::remove((db + ".index").c_str());
+  std::remove((db + ".block").c_str());
+}
+
+int generate(const Options &opt, const char *out, bool text, double rate) {
+  Workload workload(opt);
+  uint64_t loads = workload.load_size();
+  if (text) {
+    std::FILE *file = std::fopen(out, "w");
+    if (file == nullptr) {
+      std::fprintf(stderr, "cannot open %s\n", out);
+      return 1;
+    }
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    static const char *words[] = {"insert", "find", "delete"};
+    std::fprintf(file, "%llu\n",
+                 static_cast<unsigned long long>(loads + opt.ops));
+    for (uint64_t i = 0; i < loads + opt.ops; ++i) {
+      Op op = i < loads ? workload.load(i) : workload.next();
+      if (op.kind == Command::FIND) {
+        std::fprintf(file, "find %llu\n",
+                     static_cast<unsigned long long>(op.id));
+      } else {
+        std::fprintf(file, "%s %llu %d\n", words[op.kind],
+                     static_cast<unsigned long long>(op.id), op.value);
+      }
+    }
+    std::fclose(file);
+  } else {
+    try {
+      TraceWriter trace(out);
+      for (uint64_t i = 0; i < loads; ++i) {
+        trace.append(to_record(workload.load(i), 0));
+      }
+      for (uint64_t i = 0; i < opt.ops; ++i) {
+        uint64_t at = rate > 0 ? static_cast<uint64_t>(i * 1e9 / rate) : 0;
+        trace.append(to_record(workload.next(), at));
+      }
+    } catch (sjtu::runtime_error &) {
+      std::fprintf(stderr, "cannot open %s\n", out);
+      return 1;
+    }
+    std::fprintf(stderr, "replay with --warmup %llu to skip the load phase\n",
+                 static_cast<unsigned long long>(loads));
+  }
+  return 0;
+}
+
+int run(const Options &opt, double rate, const std::string &db, bool keep) {
+  if (!keep) reset_db(db);
+  BPT<long long, int> tree(db);
+  Workload workload(opt);
+  Runner runner(tree, rate, 0);
+  auto start = Clock::now();
+  for (uint64_t i = 0; i < workload.load_size(); ++i) {
+    runner.untimed(to_record(workload.load(i), 0));
+  }
+  double load_seconds = seconds_since(start);
+  for (uint64_t i = 0; i < opt.ops; ++i) {
+    runner.timed(to_record(workload.next(), 0));
+  }
+  runner.report(load_seconds, workload.load_size());
+  return 0;
+}
+
+int replay(const char *name, double rate, double speed, uint64_t warmup,
+           const std::string &db, bool keep) {
+  try {
+    TraceReader trace(name);
+    if (!keep) reset_db(db);
+    BPT<long long, int> tree(db);
+    Runner runner(tree, rate, speed);
+    TraceRecord rec;
+    uint64_t loaded = 0;
+    auto start = Clock::now();
+    while (loaded < warmup && trace.next(rec)) {
+      runner.untimed(rec);
+      loaded++;
+    }
+    double load_seconds = seconds_since(start);
+    while (trace.next(rec)) runner.timed(rec);
+    runner.report(load_seconds, loaded);
+  } catch (sjtu::runtime_error &) {
+    std::fprintf(stderr, "%s is not a trace\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) return usage();
+  std::string mode = argv[1];
+  int first = 2;
+  const char *trace = nullptr;
+  if (mode == "replay") {
+    if (argc < 3) return usage();
+    trace = argv[2];
+    first = 3;
+  } else if (mode != "generate" && mode != "run") {
+    return usage();
+  }
+  Options opt;
+  const char *out = nullptr;
+  bool text = false, keep = false;
+  double rate = 0, speed = 0;
+  uint64_t warmup = 0;
+  std::string db = "workload";
+  for (int i = first; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--text") == 0) {
+      text = true;
+    } else if (std::strcmp(argv[i], "--keep") == 0) {
+      keep = true;
+    } else if (i + 1 == argc) {
+      return usage();
+    } else if (std::strcmp(argv[i], "--records") == 0) {
+      opt.records = std::atoll(argv[++i]);
+    } else if (std::strcmp(argv[i], "--ops") == 0) {
+      opt.ops = std::atoll(argv[++i]);
+    } else if (std::strcmp(argv[i], "--mix") == 0) {
+      if (!parse_mix(argv[++i], opt)) return usage();
+    } else if (std::strcmp(argv[i], "--dist") == 0) {
+      if (!KeyDistribution::parse(argv[++i], opt.dist)) return usage();
+    } else if (std::strcmp(argv[i], "--theta") == 0) {
+      opt.theta = std::atof(argv[++i]);
+    } else if (std::strcmp(argv[i], "--fanout") == 0) {
+      opt.fanout = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--seed") == 0) {
+      opt.seed = std::atoll(argv[++i]);
+    } else if (std::strcmp(argv[i], "--out") == 0) {
+      out = argv[++i];
+    } else if (std::strcmp(argv[i], "--rate") == 0) {
+      rate = std::atof(argv[++i]);
+    } else if (std::strcmp(argv[i], "--speed") == 0) {
+      speed = std::atof(argv[++i]);
+    } else if (std::strcmp(argv[i], "--warmup") == 0) {
+      warmup = std::atoll(argv[++i]);
+    } else if (std::strcmp(argv[i], "--db") == 0) {
+      db = argv[++i];
+    } else {
+      return usage();
+    }
+  }
+  if (opt.fanout < 1) opt.fanout = 1;
+  // theta = 1 divides by zero in the zipfian generator
+  if (opt.theta <= 0 || opt.theta >= 1) return usage();
+  if (mode == "generate") {
+    if (out == nullptr) return usage();
+    return generate(opt, out, text, rate);
+  }
+  if (mode == "run") return run(opt, rate, db, keep);
+  return replay(trace, rate, speed, warmup, db, keep);
+}